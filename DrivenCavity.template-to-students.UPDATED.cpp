@@ -1,5 +1,7 @@
 /************************************************************************ */
 /*      This code solves for the viscous flow in a lid-driven cavity      */
+/*      Build: g++ -std=c++11 -O2 -pthread [-fopenmp] <this file>         */
+/*      (add -DNDEBUG for production runs: removes view bounds checks)    */
 /**************************************************************************/
 
 #include <iostream> 
@@ -7,6 +9,29 @@
 #include <cmath>
 #include <cstdlib>
 #include <cstring>
+#include <strings.h>
+#include <csignal>
+#include <deque>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <dirent.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+#include <fcntl.h>
+#include <cerrno>
+#include <cassert>
+#include <vector>
+#include <algorithm>
+#include <map>
+#include <memory>
+#include <atomic>
+#include <chrono>
+#include <complex>
+#ifdef _OPENMP
+#include <omp.h>
+#endif
 
 using namespace std;
 
@@ -45,15 +70,53 @@ using namespace std;
   const int imms = 0;                   /* Manufactured solution flag: = 1 for manuf. sol., = 0 otherwise */
   const int isgs = 1;                   /* Symmetric Gauss-Seidel  flag: = 1 for SGS, = 0 for point Jacobi */
   const int irstr = 0;                  /* Restart flag: = 1 for restart (file 'restart.in', = 0 for initial run */
+  const int iinit = 0;                  /* Initial condition (irstr = 0, imms = 0): = 0 quiescent, = 1 Stokes flow, */
+                                        /*                                          = 2 quiescent with a ramped lid */
+  const int nramp = 1000;               /* Number of iterations over which the lid is ramped up (iinit = 2) */
   const int ipgorder = 0;               /* Order of pressure gradient: 0 = 2nd, 1 = 3rd (not needed) */
   const int lim = 0;                    /* variable to be used as the limiter sensor (= 0 for pressure) */
   const int residualOut = 10;           /* Number of timesteps between residual output */
+  const int ischedule = 0;              /* Parameter schedule flag: = 1 to vary cfl, Cx, Cy, rkappa from 'schedule.in' */
+  const int imonitor = 0;               /* Residual monitor: = 1 to classify the run (converging, stagnating, oscillating, diverging) */
+  const int imonpolicy = 1;             /* Monitor action on a stagnating/oscillating/diverging run: = 0 report only, */
+                                        /*      = 1 stop, = 2 checkpoint and continue, = 3 switch SGS <-> PJ and halve cfl */
+  const int nmonwin = 2000;             /* Residual monitor window (iterations) */
+  const int istats = 0;                 /* Running statistics: = 1 to accumulate mean, RMS, min, max of p, u, v */
+  const int nstatbeg = 1;               /* First iteration included in the statistics window */
+  const int nstatend = nmax;            /* Last iteration included in the statistics window */
+  const int icheck = 0;                 /* Tiered checkpoints: = 1 to checkpoint to a fast tier, drained in the background */
+  const int ncheck = 100;               /* Number of iterations between tiered checkpoints */
+  const int nckkeep = 3;                /* Durable tier keeps the newest nckkeep checkpoints ... */
+  const int nckevery = 10;              /* ... plus every nckevery-th checkpoint (= 0 for none) */
+  const char ckfast[] = "/dev/shm/cavity";   /* Fast checkpoint tier (RAM disk or local NVMe), shared by the node */
+  const char ckrun[] = "";                   /* Run subdirectory of the fast tier: "" = named after the working directory */
+  const int nckqueue = 4;               /* Checkpoints waiting to be drained at most (the solver waits beyond) */
+  const char ckdurable[] = "./checkpoints";  /* Durable checkpoint tier (shared filesystem) */
+  const int ipipe = 0;                  /* Binary stream output: = 1 to send framed snapshots to 'streampath' */
+  const int nstream = 100;              /* Number of iterations between streamed snapshots */
+  const char streampath[] = "-";        /* Stream sink: "-" = standard output, otherwise a named pipe or file */
+  const int icombine = 0;               /* Sparse-grid combination technique: = 1 to solve the component grids */
+                                        /*      concurrently and combine them instead of the imax x jmax run  */
+  const int ncombl = 7;                 /* Combination: level of the combined grid, (2^ncombl+1) x (2^ncombl+1) */
+  const int ncombmin = 3;               /* Combination: coarsest level in either direction (>= 2) */
+  const int ncombthreads = 0;           /* Combination: number of solver threads (= 0 for one per hardware thread) */
+  const int ncombit = 200000;           /* Combination: maximum iterations per component grid */
+  const int ipipeline = 0;              /* Pipelined point Jacobi (isgs = 0): = 1 to overlap time step/dissipation, */
+                                        /*      update and boundary/residual stages over blocks of grid lines      */
+  const int npipeblock = 8;             /* Pipeline: grid lines per block (>= 3) */
+  const int npipethreads = 1;           /* Pipeline: threads in each of the first two stage groups */
+  const int iflux = 0;                  /* Point Jacobi: = 1 to form each face difference (update and dissipation) once and share it */
+                                        /*      between the two nodes of the face (same discretization) */
+  const int nparsethreads = 0;          /* ASCII restart/field parsing threads (= 0 for one per hardware thread) */
+  const int iconvert = 0;               /* = 1 to convert 'legacyfile' (restart or cavity.dat) to binary and stop */
+  const char legacyfile[] = "./restart.out";   /* Legacy ASCII file to convert (iconvert = 1) */
+  const int ivisc = 0;                  /* Viscous terms in pseudo-time: = 0 explicit, = 1 point-implicit (no dtvisc limit, iengine = 0 only) */
+  const int iengine = 0;                /* Solver engine: = 0 artificial compressibility, = 1 lattice Boltzmann (D2Q9), */
+                                        /*                = 2 pressure correction on a staggered (MAC) grid,       */
+                                        /*                = 3 artificial compressibility, implicit defect correction */
+  const int ipcorr = 0;                 /* MAC engine only: = 0 SIMPLE, = 1 SIMPLEC, = 2 PISO */
 
-  const double cfl  = 0.8;              /* CFL number used to determine time step */
-  const double Cx = 0.01;               /* Parameter for 4th order artificial viscosity in x */
-  const double Cy = 0.01;               /* Parameter for 4th order artificial viscosity in y */
   const double toler = 1.e-10;          /* Tolerance for iterative residual convergence */
-  const double rkappa = 0.1;            /* Time derivative preconditioning constant */
   const double Re = 10.0;              /* Reynolds number = rho*Uinf*L/rmu */
   const double pinf = 0.801333844662;   /* Initial pressure (N/m^2) -> from MMS value at cavity center */
   const double uinf = 1.0;              /* Lid velocity (m/s) */
@@ -65,6 +128,81 @@ using namespace std;
   const double Cx2 = 0.0;               /* Coefficient for 2nd order damping (not required) */
   const double Cy2 = 0.0;               /* Coefficient for 2nd order damping (not required) */
   const double fsmall = 1.e-20;         /* small parameter */
+  const double ulb = 0.1;               /* LBM only: lid velocity in lattice units (sets the lattice Mach number) */
+  const double alphau = 0.7;            /* MAC engine only: momentum under-relaxation factor */
+  const double alphap = 0.3;            /* MAC engine only: pressure under-relaxation factor (SIMPLE only) */
+  const double pcgtol = 1.e-3;          /* MAC engine only: relative tolerance of the pressure-correction CG solve */
+  const double monrate = 0.05;          /* Residual monitor: minimum drop of conv per window (decades) to count as converging */
+  const double tbudget = 0.0;           /* Wall-clock budget (s): = 0 for none; > 0 paces output and stops cleanly before it */
+  const double budgetreserve = 0.05;    /* Fraction of the budget kept in reserve at the end */
+  const double budgetio = 0.05;         /* Largest fraction of the run time spent on periodic output under a budget */
+  const double dccfl = 1000.0;          /* Defect correction: largest CFL number of the implicit pseudo-time step */
+  const double dccfl0 = 10.0;           /* Defect correction: initial CFL number, raised as the residual falls */
+  const double dcdiss = 3.0;            /* Defect correction: 2nd-difference pressure dissipation of the low-order operator, */
+                                        /*      in units of Cx, Cy (> 2 for a stable outer iteration; see 'dc_assemble') */
+  const double amgtol = 0.1;            /* Defect correction: AMG solve reduces the linear residual by this factor */
+  const double amgtheta = 0.08;         /* Defect correction: AMG strength-of-connection threshold */
+  const double errtarget = 1.e-3;       /* Accuracy ladder: target error (imms = 1: largest L2 DE norm; imms = 0: */
+                                        /*      estimated centerline u error, m/s) */
+  const double lidwidth = 0.05;         /* Lid profile (ilid = 2): corner ramp width as a fraction of the lid length */
+  const int isubcycle = 0;              /* = 1 to sub-cycle the pressure (acoustic) update within GS/PJ iterations */
+  const int nsubmax = 4;                /* Sub-cycling: most pressure sub-cycles per iteration (one per decade */
+                                        /*      by which the continuity residual lags the momentum residuals) */
+  const int namgit = 10;                /* Defect correction: most AMG-preconditioned BiCGStab iterations per outer iteration */
+  const int ibatch = 0;                 /* = 1 to solve the small cases listed in 'batchfile' (one "ni nj Re" per line) */
+                                        /*      as a batch and write 'batch.dat' instead of the imax x jmax run */
+  const char batchfile[] = "./batch.in";   /* Batch: case list */
+  const int nbatchthreads = 0;          /* Batch: number of solver threads (= 0 for one per hardware thread) */
+  const int nbatchit = 200000;          /* Batch: maximum iterations per case */
+  const int nbatchres = 10;             /* Batch: iterations between residual checks (a case may run up to */
+                                        /*      nbatchres-1 iterations past 'toler') */
+  const int iaccuracy = 0;              /* = 1 to solve to accuracy: march up a ladder of nested n x n grids (warm-started) */
+                                        /*      and stop at the first one whose error is below errtarget */
+  const int nladmin = 9;                /* Accuracy ladder: points per direction of the coarsest grid */
+  const int nladmax = 257;              /* Accuracy ladder: largest points per direction */
+  const int nladit = 1000000;           /* Accuracy ladder: maximum iterations per grid */
+  const int ihier = 0;                  /* = 1 to solve the nested n x n grids n = nhiermin, 2 nhiermin - 1, ..., imax */
+                                        /*      concurrently from one arena and report all levels' errors together */
+  const int nhiermin = 9;               /* Nested hierarchy: points per direction of the coarsest grid */
+  const int ihierinject = 0;            /* Nested hierarchy: = 1 to inject converged coarse levels into the finer ones */
+                                        /*      (measured to cost iterations, see 'hierarchy_driver') */
+  const int nhiercheck = 100;           /* Nested hierarchy: iterations between looks for a converged coarser level */
+  const int ilid = 0;                   /* Lid velocity profile: = 0 uniform (velocity jump at the lid corners), */
+                                        /*      = 1 regularized 16 x^2 (1-x)^2, = 2 uniform with the corners */
+                                        /*      smoothed by a cubic ramp over lidwidth (x = fraction of the lid) */
+  const int ipredict = 0;               /* = 1 to predict memory, time per iteration and iterations to 'toler' */
+                                        /*      for an npredi x npredj run and stop (no output files written) */
+  const int npredi = 0;                 /* Predictor: target grid points in x (= 0 for imax) */
+  const int npredj = 0;                 /* Predictor: target grid points in y (= 0 for jmax) */
+  const int npredthreads = 0;           /* Predictor: threads available (= 0 for one per hardware thread) */
+  const char predhist[] = "./history.dat";   /* Predictor: past residual histories, separated by commas */
+  const double predsafety = 1.5;        /* Predictor: safety factor on the recommended wall time and memory */
+
+/*-- Scheduled inputs: initial values set here; changed by 'schedule_update' when ischedule = 1 ----*/
+
+  double cfl  = 0.8;              /* CFL number used to determine time step */
+  double Cx = 0.01;               /* Parameter for 4th order artificial viscosity in x */
+  double Cy = 0.01;               /* Parameter for 4th order artificial viscosity in y */
+  double rkappa = 0.1;            /* Time derivative preconditioning constant */
+
+/*-- Parameter schedule (read by 'read_schedule' from 'schedule.in' when ischedule = 1) ----*/
+
+  const int nschedmax = 20;       /* Maximum number of schedule stages */
+  int nsched = 0;                 /* Number of schedule stages */
+  int isched = -1;                /* Current stage (-1 = before the first stage) */
+  int nschedstart = 0;            /* Iteration at which the current stage was entered */
+  int sched_type[nschedmax];      /* Stage trigger: = 0 iteration count, = 1 residual level (conv) */
+  double sched_value[nschedmax];  /* Stage trigger value */
+  double sched_par[nschedmax][4]; /* Stage parameters: cfl, Cx, Cy, rkappa */
+  int sched_nblend[nschedmax];    /* Iterations over which to blend from the previous parameters */
+  double sched_prev[4];           /* Parameters when the current stage was entered */
+  double sched_cflscale = 1.0;    /* Factor on the scheduled cfl (halved by the residual monitor, imonpolicy = 3) */
+
+/*-- Residual monitor state (imonitor = 1) ----*/
+
+  double *monhist = NULL;         /* Ring buffer of log10(conv), allocated on first use */
+  int nmonsamples = 0;            /* Number of samples pushed into the ring buffer */
+  int monlast = -1;               /* Classification of the previous window */
 
 /*-- Derived input quantities (set by function 'set_derived_inputs' called from main)----*/
  
@@ -75,6 +213,7 @@ using namespace std;
   double dx;        /* Delta x (m) */
   double dy;        /* Delta y (m) */
   double rpi;       /* Pi = 3.14159... (defined below) */
+  double ulid;      /* Current lid velocity (m/s): = uinf, except while the lid is ramped (iinit = 2) */
 
 /*-- Constants for manufactured solutions ----*/
   const double phi0[neq] = {0.25, 0.3, 0.2};            /* MMS constant */
@@ -92,6 +231,119 @@ using namespace std;
                                                         /* Note: arrays here refer to the 3 variables */ 
 
 
+/*****************************************************************************
+*                              View2 Class
+*
+*   Non-owning 2D window into Array3/Array2 storage: base pointer plus strides.
+*   Views never allocate or free; they are only valid while the array lives.
+*   Bounds are checked with assert (compiled out with -DNDEBUG).
+*****************************************************************************/
+
+class View2
+{
+    private:
+        double *base;
+        int ni, nj;         //Extent of the view
+        int si, sj;         //Stride (in doubles) between neighbours in i and in j
+
+    public:
+
+        View2(double*, int, int, int, int);
+
+        int size_i() const { return ni; }
+        int size_j() const { return nj; }
+
+        View2 block(int, int, int, int);
+        View2 coarse(int, int);
+        View2 row(int);
+        View2 col(int);
+
+        void fill(double);
+        void copyFrom(const View2&);
+
+        double& operator() (int, int);
+        double operator() (int, int) const;
+};
+
+View2::View2 (double *b, int i, int j, int stri, int strj)
+{
+    base = b;
+    ni = i;
+    nj = j;
+    si = stri;
+    sj = strj;
+}
+
+//Rectangular sub-block of ni x nj points starting at (i0,j0)
+View2 View2::block (int i0, int j0, int nbi, int nbj)
+{
+    assert( i0>=0 && j0>=0 && nbi>=0 && nbj>=0 && i0+nbi<=ni && j0+nbj<=nj );
+    return View2( base + i0*si + j0*sj, nbi, nbj, si, sj );
+}
+
+//Every ri-th point in i and rj-th point in j, starting at (0,0) (e.g. a multigrid coarse level)
+View2 View2::coarse (int ri, int rj)
+{
+    assert( ri>0 && rj>0 );
+    return View2( base, (ni-1)/ri + 1, (nj-1)/rj + 1, si*ri, sj*rj );
+}
+
+//All i at fixed j (ni x 1)
+View2 View2::row (int j)
+{
+    return block(0, j, ni, 1);
+}
+
+//All j at fixed i (1 x nj)
+View2 View2::col (int i)
+{
+    return block(i, 0, 1, nj);
+}
+
+void View2::fill (double value)
+{
+    for(int i=0; i<ni; i++)
+    {
+        for(int j=0; j<nj; j++)
+        {
+            base[i*si + j*sj] = value;
+        }
+    }
+}
+
+//Copies the values of (const View2& A) into the calling view.   Both views must have the same extent
+void View2::copyFrom (const View2& A)
+{
+    assert( A.ni==ni && A.nj==nj );
+    for(int i=0; i<ni; i++)
+    {
+        for(int j=0; j<nj; j++)
+        {
+            base[i*si + j*sj] = A.base[i*A.si + j*A.sj];
+        }
+    }
+}
+
+inline
+double& View2::operator() (int i, int j)
+{
+    assert( i>=0 && i<ni && j>=0 && j<nj );
+    return base[i*si + j*sj];
+}
+
+inline
+double View2::operator() (int i, int j) const
+{
+    assert( i>=0 && i<ni && j>=0 && j<nj );
+    return base[i*si + j*sj];
+}
+
+/*****************************************************************************
+*                              End View2 Class
+*****************************************************************************/
+
+
+
 /*****************************************************************************
 *                              Array3 Class
 *
@@ -102,14 +354,25 @@ class Array3
     private:
         int idim, jdim, kdim;
         double *data;
+        int owner;          //= 1 if the destructor frees data, = 0 for external storage (e.g. an arena)
 
     public:
     
         Array3(int, int, int);
+        Array3(int, int, int, double*);
+        Array3(Array3&&);
         ~Array3();
 
+        Array3(const Array3&) = delete;             //Copying would free the same buffer twice
+        Array3& operator= (const Array3&) = delete;
+        Array3& operator= (Array3&&);
+
         void copyData(Array3&);
         void swapData(Array3&);     
+        double* getData();
+
+        View2 plane(int);
+        View2 block(int, int, int, int, int);
     
         double& operator() (int, int, int);
         double operator() (int, int, int) const;
@@ -121,11 +384,56 @@ Array3::Array3 (int i, int j, int k)
     jdim = j;
     kdim = k;
     data = new double[i*j*k];
+    owner = 1;
+}
+
+//Wraps i*j*k doubles of external storage, which the caller keeps alive and frees
+Array3::Array3 (int i, int j, int k, double *storage)
+{
+    idim = i;
+    jdim = j;
+    kdim = k;
+    data = storage;
+    owner = 0;
+}
+
+//Takes over the buffer of (Array3&& A), which is left empty
+Array3::Array3 (Array3&& A)
+{
+    idim = A.idim;
+    jdim = A.jdim;
+    kdim = A.kdim;
+    data = A.data;
+    owner = A.owner;
+    A.data = NULL;
+    A.idim = A.jdim = A.kdim = 0;
 }
 
 Array3::~Array3 ()
 {
-    delete [] data;
+    if(owner==1)
+    {
+        delete [] data;
+    }
+}
+
+Array3& Array3::operator= (Array3&& A)
+{
+    if(this!=&A)
+    {
+        if(owner==1)
+        {
+            delete [] data;
+        }
+        idim = A.idim;
+        jdim = A.jdim;
+        kdim = A.kdim;
+        data = A.data;
+        owner = A.owner;
+        A.data = NULL;
+        A.idim = A.jdim = A.kdim = 0;
+    }
+    return *this;
 }
 
 //Copies data from (Array3& A) into the calling Array3 class.   Both Array3's now contain identical data arrays
@@ -139,10 +447,33 @@ void Array3::copyData (Array3& A)
 void Array3::swapData (Array3& A)                  
 {
     double *temp;
+    int otemp;
 
     temp = data;
     data = A.data;
     A.data = temp;
+    otemp = owner;
+    owner = A.owner;
+    A.owner = otemp;
+}
+
+//Returns the raw data array (idim*jdim*kdim contiguous doubles), e.g. for binary I/O
+double* Array3::getData ()
+{
+    return data;
+}
+
+//Zero-copy view of equation k over the whole grid, thus U.plane(1)(i,j) is U(i,j,1)
+View2 Array3::plane (int k)
+{
+    assert( k>=0 && k<kdim );
+    return View2( data + k, idim, jdim, jdim*kdim, kdim );
+}
+
+//Zero-copy view of equation k over ni x nj points starting at (i0,j0)
+View2 Array3::block (int k, int i0, int j0, int ni, int nj)
+{
+    return plane(k).block(i0, j0, ni, nj);
 }
 
 inline
@@ -175,14 +506,25 @@ class Array2
     private:
         int idim, jdim;
         double *data;
+        int owner;          //= 1 if the destructor frees data, = 0 for external storage (e.g. an arena)
 
     public:
     
         Array2(int, int);
+        Array2(int, int, double*);
+        Array2(Array2&&);
         ~Array2();
 
+        Array2(const Array2&) = delete;             //Copying would free the same buffer twice
+        Array2& operator= (const Array2&) = delete;
+        Array2& operator= (Array2&&);
+
         void copyData(Array2&);
         void swapData(Array2&);     
+        double* getData();
+
+        View2 view();
+        View2 block(int, int, int, int);
     
         double& operator() (int, int);
         double operator() (int, int) const;
@@ -193,11 +535,53 @@ Array2::Array2 (int i, int j)
     idim = i;
     jdim = j;
     data = new double[i*j];
+    owner = 1;
+}
+
+//Wraps i*j doubles of external storage, which the caller keeps alive and frees
+Array2::Array2 (int i, int j, double *storage)
+{
+    idim = i;
+    jdim = j;
+    data = storage;
+    owner = 0;
+}
+
+//Takes over the buffer of (Array2&& A), which is left empty
+Array2::Array2 (Array2&& A)
+{
+    idim = A.idim;
+    jdim = A.jdim;
+    data = A.data;
+    owner = A.owner;
+    A.data = NULL;
+    A.idim = A.jdim = 0;
 }
 
 Array2::~Array2 ()
 {
-    delete [] data;
+    if(owner==1)
+    {
+        delete [] data;
+    }
+}
+
+Array2& Array2::operator= (Array2&& A)
+{
+    if(this!=&A)
+    {
+        if(owner==1)
+        {
+            delete [] data;
+        }
+        idim = A.idim;
+        jdim = A.jdim;
+        data = A.data;
+        owner = A.owner;
+        A.data = NULL;
+        A.idim = A.jdim = 0;
+    }
+    return *this;
 }
 
 void Array2::copyData (Array2& A)                   //Copies data from (Array2& A) into the calling Array2 class.   
@@ -208,10 +592,32 @@ void Array2::copyData (Array2& A)                   //Copies data from (Array2&
 void Array2::swapData (Array2& A)                   //Swaps pointers to data--
 {                                                   //   thus U.swapData(U2) exchanges data arrays between U and U2
     double *temp;
+    int otemp;
 
     temp = data;
     data = A.data;
     A.data = temp;
+    otemp = owner;
+    owner = A.owner;
+    A.owner = otemp;
+}
+
+//Returns the raw data array (idim*jdim contiguous doubles)
+double* Array2::getData ()
+{
+    return data;
+}
+
+//Zero-copy view of the whole array
+View2 Array2::view ()
+{
+    return View2( data, idim, jdim, jdim, 1 );
+}
+
+//Zero-copy view of ni x nj points starting at (i0,j0)
+View2 Array2::block (int i0, int j0, int ni, int nj)
+{
+    return view().block(i0, j0, ni, nj);
 }
 
 inline
@@ -232,12 +638,106 @@ double Array2::operator() (int i, int j) const
 
 
 
+/*****************************************************************************
+*                              CavityGrid Structure
+*
+*   Self-contained artificial compressibility solution on an ni x nj grid
+*   (any size, independent of imax and jmax), for drivers that solve many grids.
+*   GridGeometry is what the discretization kernels need to know about a grid;
+*   the imax x jmax run passes 'maingrid', a CavityGrid passes itself, so every
+*   mode runs the same kernels. The inputs that depend only on the grid size
+*   (MMS source terms, wall velocities, pinned center pressure) are computed
+*   once per size and shared read-only by every grid of that size, the
+*   imax x jmax run included (see 'grid_inputs')
+*****************************************************************************/
+
+struct GridInputs
+{
+    int ni, nj;             //Points in x and y
+    Array3 s;               //Source terms (MMS; zero for the cavity)
+    Array3 bx;              //Wall velocities (k = 1, 2): bx(0,j,k) on the left wall, bx(1,j,k) on the right wall
+    Array3 by;              //by(i,0,k) on the bottom wall, by(i,1,k) on the lid (cavity: lid profile, times ulid)
+    double pref;            //Pressure pinned at the center point
+
+    GridInputs(int, int);
+};
+
+struct GridGeometry
+{
+    int ni, nj;             //Points in x and y
+    double hx, hy;          //Grid spacing (m)
+    double mu;              //Viscosity (N*s/m^2): = rmu, unless a batch case sets its own Re
+    std::shared_ptr<const GridInputs> in;  //Shared read-only inputs of this grid size
+};
+
+struct CavityGrid : GridGeometry
+{
+    Array3 u;               //Primitive variables p, u, v
+    Array3 uold;            //Previous iteration
+    Array2 viscx;           //Artificial viscosity, x and y directions
+    Array2 viscy;
+    Array2 dt;              //Local time step
+    double res[neq];        //Iterative residual norms of the last iteration
+    double resinit[neq];    //Initial residual norms (= 1, as set by 'initial')
+    double conv;            //Convergence measure, as 'check_iterative_convergence'
+    int niter;              //Iterations performed
+
+    CavityGrid(int, int);
+    CavityGrid(int, int, double*);
+};
+
+/*****************************************************************************
+*                              End CavityGrid Structure
+*****************************************************************************/
+
+
+
+/*****************************************************************************
+*                              SparseMatrix and AMGLevel Structures
+*
+*   Compressed sparse row matrix, and one level of the smoothed-aggregation
+*   algebraic multigrid hierarchy used by the defect correction (iengine = 3).
+*   Unknowns come in blocks of neq (p, u, v of one point or one aggregate).
+*****************************************************************************/
+
+struct SparseMatrix
+{
+    int nrow, ncol;                 //Rows and columns
+    std::vector<int> ptr;           //Start of each row in col/val (nrow+1 entries)
+    std::vector<int> col;           //Column of each entry
+    std::vector<double> val;        //Value of each entry
+
+    SparseMatrix();
+    void multiply(const std::vector<double>&, std::vector<double>&) const;
+};
+
+struct AMGLevel
+{
+    SparseMatrix A;                 //Operator on this level
+    SparseMatrix P;                 //Prolongation from the next coarser level
+    SparseMatrix R;                 //Restriction to the next coarser level (transpose of P)
+    std::vector<double> dinv;       //Inverted neq x neq diagonal blocks (block Gauss-Seidel)
+    std::vector<double> x;          //Solution
+    std::vector<double> b;          //Right-hand side
+    std::vector<double> r;          //Residual
+};
+
+/*****************************************************************************
+*                              End SparseMatrix and AMGLevel Structures
+*****************************************************************************/
+
+
+
 /*****************Function Pointer Typedefs *********************************/
 
 typedef void (*boundaryConditionPointer)( Array3& );
 
 typedef void (*iterationStepPointer)( boundaryConditionPointer, Array3&, Array3&, Array3&, Array2&, Array2&, Array2& );
 
+typedef void (*timeStepPointer)( Array3&, Array2&, double& );
+
+typedef void (*boundaryLinesPointer)( const GridGeometry&, Array3&, int, int );
+
 /**********************Function Prototypes**********************************/
 
 void set_derived_inputs();
@@ -255,12 +755,112 @@ double srcmms_xmtm( double, double );
 double srcmms_ymtm( double, double );
 void compute_time_step( Array3&, Array2&, double& );
 void Compute_Artificial_Viscosity( Array3&, Array2&, Array2& );
-void SGS_forward_sweep( Array3&, Array2&, Array2&, Array2&, Array3& );
-void SGS_backward_sweep( Array3&, Array2&, Array2&, Array2&, Array3& );
+void SGS_forward_sweep( const GridGeometry&, Array3&, Array2&, Array2&, Array2&, const Array3& );
+void SGS_backward_sweep( const GridGeometry&, Array3&, Array2&, Array2&, Array2&, const Array3& );
 void point_Jacobi( Array3&, Array3&, Array2&, Array2&, Array2&, Array3& );
-void pressure_rescaling( Array3& );
+void pressure_rescaling( const GridGeometry&, Array3& );
 void check_iterative_convergence( int, Array3&, Array3&, Array2&, double [neq], double [neq], int, double, double, double& );
 void Discretization_Error_Norms( Array3& );
+void read_schedule();
+void schedule_update( int, double );
+void write_history( int, double, double [neq] );
+int classify_residual_history( double [], int, int& );
+int monitor_residual( int, double );
+void poisson_dirichlet_solve( std::vector<std::complex<double> >&, double [], Array2&, Array2&, Array2& );
+void stokes_operator( Array2&, Array2&, Array2& );
+void stokes_initial( Array3& );
+void lbm_initialize( Array3& );
+void lbm_time_step( Array3&, Array2&, double& );
+void lbm_stream_collide( Array3&, Array3&, Array3&, int );
+void lbm_wall_velocity( int, int, double&, double& );
+void lbm_to_nodes( Array3&, Array3& );
+void LBM_iteration( boundaryConditionPointer, Array3&, Array3&, Array3&, Array2&, Array2&, Array2& );
+double mac_wall_value( double, double, int );
+void mac_initialize( Array3& );
+void mac_momentum_coefficients( void );
+void mac_momentum_solve( int );
+void mac_pressure_coefficients( void );
+void mac_apply_pressure_operator( Array2&, Array2& );
+int mac_pressure_solve( Array2&, Array2& );
+void mac_mass_imbalance( Array2&, Array2&, Array2& );
+void mac_correct_velocity( Array2& );
+void mac_piso_neighbor_correction( void );
+void mac_to_nodes( Array3& );
+void SIMPLE_iteration( boundaryConditionPointer, Array3&, Array3&, Array3&, Array2&, Array2&, Array2& );
+void stats_request_handler( int );
+void write_statistics( int );
+unsigned long long checksum_fnv1a( const unsigned char *, size_t, unsigned long long );
+int write_checkpoint_binary( const char *, int, double, double [neq], Array3& );
+int read_checkpoint_binary( const char *, int&, double&, double [neq], Array3& );
+int list_checkpoints( const char *, int [], int );
+void checkpoint_retention( const char *, int, int, int );
+void checkpoint_drain_agent();
+void checkpoint_tiered( int, Array3&, double [neq], double );
+void checkpoint_shutdown();
+int checkpoint_restart( int&, double&, double [neq], Array3& );
+void stream_writer_agent();
+void stream_open();
+void stream_frame( int, double, double, Array3& );
+void stream_close();
+void grid_bndry( CavityGrid& );
+void grid_initial( CavityGrid& );
+void grid_iteration( CavityGrid& );
+void grid_sweep( CavityGrid&, int );
+void grid_residual_norms( CavityGrid& );
+int grid_solve( CavityGrid&, int, double );
+double grid_interpolate( CavityGrid&, double, double, int );
+void grid_error_norms( CavityGrid&, double [neq], double [neq], double [neq] );
+void combination_driver();
+void bndry_lines( const GridGeometry&, Array3&, int, int );
+void bndrymms_lines( const GridGeometry&, Array3&, int, int );
+void time_step_lines( const GridGeometry&, Array3&, Array2&, double&, int, int );
+void artificial_viscosity_lines( const GridGeometry&, Array3&, Array2&, Array2&, int, int );
+void point_Jacobi_lines( const GridGeometry&, Array3&, Array3&, Array2&, Array2&, Array2&, const Array3&, int, int );
+void report_iterative_convergence( int, double [neq], double [neq], int, double, double, double& );
+int pipeline_run( int, int, boundaryLinesPointer, Array3&, Array3&, Array3&, Array2&, Array2&, Array2&, double [neq], double [neq], int, double&, double&, double& );
+void point_Jacobi_faces( const GridGeometry&, Array3&, Array3&, Array2&, Array2&, Array2&, const Array3&, int, int );
+void artificial_viscosity_faces( const GridGeometry&, Array3&, Array2&, Array2&, int, int );
+const char* map_file( const char *, size_t& );
+int parse_double_fast( const char*&, const char *, double& );
+long parse_doubles_parallel( const char *, const char *, std::vector<double>& );
+int read_restart_fast( const char *, int&, double&, double [neq], Array3& );
+void convert_legacy( const char * );
+double wall_clock();
+int budget_exhausted( double, double );
+int budget_allows_output( double, double );
+double predict_memory( int, int );
+int read_history( const char *, int&, int&, double&, double&, std::vector<double>&, std::vector<double>& );
+double history_iterations( std::vector<double>&, std::vector<double>&, double, double& );
+double calibrate_iteration( iterationStepPointer, timeStepPointer, boundaryConditionPointer, Array3&, Array3&, Array3&, Array2&, Array2&, Array2&, int, double& );
+int parallel_threads( int );
+double predict_speedup( int, double );
+void predict_job( iterationStepPointer, timeStepPointer, boundaryConditionPointer, Array3&, Array3&, Array3&, Array2&, Array2&, Array2& );
+int subcycle_count( double [neq] );
+void pressure_subcycle( boundaryConditionPointer, Array3&, Array2&, Array2&, Array2&, Array3& );
+void steady_residual( Array3&, Array2&, Array2&, Array3&, Array3& );
+void remove_pressure_drift( Array3&, Array2&, Array3& );
+void sparse_transpose( const SparseMatrix&, SparseMatrix& );
+void sparse_product( const SparseMatrix&, const SparseMatrix&, SparseMatrix& );
+void dc_assemble( Array3&, Array2&, SparseMatrix& );
+int amg_aggregate( const SparseMatrix&, std::vector<int>& );
+void amg_block_inverse( const SparseMatrix&, std::vector<double>& );
+void amg_setup( SparseMatrix& );
+void amg_smooth( AMGLevel&, int );
+void amg_vcycle( int );
+int amg_solve( std::vector<double>&, std::vector<double>& );
+void DC_iteration( boundaryConditionPointer, Array3&, Array3&, Array3&, Array2&, Array2&, Array2& );
+void batch_solve( std::vector<int>&, std::vector<int>&, std::vector<double>&, std::vector<double>& );
+void batch_driver();
+double ladder_centerline_change( CavityGrid&, CavityGrid& );
+void accuracy_driver();
+void grid_inputs_fill( GridInputs& );
+std::shared_ptr<const GridInputs> grid_inputs( int, int );
+size_t grid_storage( int, int );
+void hierarchy_driver();
+void iterative_residual_norms( const GridGeometry&, Array3&, Array3&, Array2&, double [neq] );
+double convergence_measure( const GridGeometry&, double [neq], double [neq] );
+void fft_mixed_radix( const std::complex<double> *, int, std::complex<double> *, std::complex<double> *, int, const std::complex<double> *, int );
+const char* checkpoint_fast_dir();
  
 
 /****************** Inline Function Declarations ***************************/
@@ -284,6 +884,34 @@ inline double pow4(double x)                      /* Returns x^4 ... Duplicates
     return x4;
 }
 
+inline int dc_node(int i, int j)                   /* Returns the defect-correction block (unknowns neq*block+k) */
+{                                                 /*    of the interior point (i,j) */
+    return (i - 1)*(jmax - 2) + (j - 1);
+}
+
+inline double lid_profile(double x)               /* Returns the lid velocity at x in units of the lid velocity */
+{                                                 /*    (= 1 everywhere for ilid = 0; see 'ilid') */
+    double xi = (x - xmin)/(xmax - xmin);         /* Fraction of the lid */
+    double t;                                     /* Distance to the nearer corner in units of lidwidth */
+    if(ilid==1)
+    {
+        return 16.0*xi*xi*(1.0 - xi)*(1.0 - xi);
+    }
+    if(ilid==2)
+    {
+        t = fmin(fmin(xi, 1.0 - xi)/lidwidth, 1.0);
+        return t*t*(3.0 - 2.0*t);
+    }
+    return 1.0;
+}
+
+inline double visc_diag(const GridGeometry& g, double dtloc)   /* Returns the point-implicit viscous diagonal */
+{                                                 /*    for the momentum updates on grid g, */
+                                                  /*    1 + dt*mu/rho*(2/dx^2 + 2/dy^2) (= 1 if ivisc = 0) */
+    double diag = 1.0 + (double)(ivisc)*dtloc*g.mu*rhoinv*(2.0/(g.hx*g.hx) + 2.0/(g.hy*g.hy));
+    return diag;
+}
+
 
 /******************* End Inline Function Declarations ************************/
 
@@ -298,6 +926,126 @@ inline double pow4(double x)                      /* Returns x^4 ... Duplicates
   FILE *fp5; /* For output of final DE norms (only for MMS)*/  
 //$$$$$$   FILE *fp6; /* For debug: Uncomment for debugging. */  
 
+/*--- Lattice Boltzmann (D2Q9) state: allocated by 'lbm_initialize' only when iengine = 1 ---*/
+/*--- The lattice has (imax-1) x (jmax-1) cells of size dx x dy, so the walls sit exactly ---*/
+/*--- on the x = xmin, xmax, y = ymin, ymax lines (halfway bounce-back)                   ---*/
+
+  const int lbm_cx[9] = {0, 1, 0, -1, 0, 1, -1, -1, 1};       /* D2Q9 lattice velocities (x) */
+  const int lbm_cy[9] = {0, 0, 1, 0, -1, 1, 1, -1, -1};       /* D2Q9 lattice velocities (y) */
+  const int lbm_opp[9] = {0, 3, 4, 1, 2, 7, 8, 5, 6};         /* Index of the opposite direction */
+  const double lbm_w[9] = {4.0/9.0, 1.0/9.0, 1.0/9.0, 1.0/9.0, 1.0/9.0,
+                           1.0/36.0, 1.0/36.0, 1.0/36.0, 1.0/36.0};  /* D2Q9 weights */
+
+  Array3 *lbm_f = NULL;   /* Populations (single array, AA-pattern in-place streaming) */
+  Array3 *lbm_m = NULL;   /* Cell moments from the last step: rho, ux, uy (lattice units) */
+  Array3 *lbm_s = NULL;   /* Cell sources (lattice units): mass, x-force, y-force (MMS only) */
+  int lbm_parity = 0;     /* AA-pattern step parity: 0 = even (local), 1 = odd (neighbors) */
+  double lbm_omp;         /* TRT relaxation rate for the symmetric part (sets viscosity) */
+  double lbm_omm;         /* TRT relaxation rate for the antisymmetric part (magic parameter 3/16) */
+  double lbm_dt;          /* Physical time per lattice step (s) */
+  double lbm_pscale;      /* Physical pressure per unit lattice density (N/m^2) */
+
+/*--- Staggered (MAC) pressure-correction state: allocated by 'mac_initialize' only when iengine = 2 ---*/
+/*--- (imax-1) x (jmax-1) pressure cells; u on the x-faces, v on the y-faces; walls on the faces     ---*/
+
+  Array2 *mac_u = NULL;   /* x velocity on the x-faces, (imax) x (jmax-1) */
+  Array2 *mac_v = NULL;   /* y velocity on the y-faces, (imax-1) x (jmax) */
+  Array2 *mac_us = NULL;  /* Predicted x velocity (PISO: neighbor correction) */
+  Array2 *mac_vs = NULL;  /* Predicted y velocity (PISO: neighbor correction) */
+  Array2 *mac_ucor = NULL;  /* PISO work array: x-face neighbor correction */
+  Array2 *mac_vcor = NULL;  /* PISO work array: y-face neighbor correction */
+  Array2 *mac_du = NULL;  /* x-face velocity correction coefficient */
+  Array2 *mac_dv = NULL;  /* y-face velocity correction coefficient */
+  Array3 *mac_au = NULL;  /* x-momentum coefficients: aP/alphau, aE, aW, aN, aS, b */
+  Array3 *mac_av = NULL;  /* y-momentum coefficients: aP/alphau, aE, aW, aN, aS, b */
+  Array2 *mac_p = NULL;   /* Cell pressure */
+  Array2 *mac_pc = NULL;  /* Cell pressure correction */
+  Array2 *mac_b = NULL;   /* Mass imbalance, right-hand side of the pressure correction */
+  Array3 *mac_ap = NULL;  /* Pressure-correction coefficients: aP, aE, aW, aN, aS */
+  Array2 *mac_r = NULL;   /* CG work array: residual */
+  Array2 *mac_z = NULL;   /* CG work array: preconditioned residual */
+  Array2 *mac_s = NULL;   /* CG work array: search direction */
+  Array2 *mac_q = NULL;   /* CG work array: operator times search direction */
+
+/*--- Running statistics (istats = 1): allocated in main, updated by 'pressure_rescaling' ---*/
+
+  Array3 *stat_mean = NULL;       /* Running mean of p, u, v */
+  Array3 *stat_m2 = NULL;         /* Running sum of squared deviations (Welford) */
+  Array3 *stat_min = NULL;        /* Running minimum */
+  Array3 *stat_max = NULL;        /* Running maximum */
+  int nstat = 0;                  /* Number of samples accumulated */
+  int stat_accumulate = 0;        /* = 1 when the current iteration is inside the statistics window */
+  volatile sig_atomic_t stat_request = 0;   /* Set by SIGUSR1: write the statistics now */
+
+/*--- Pressure sub-cycling state (isubcycle = 1) ---*/
+
+  Array2 *sub_dp = NULL;          /* Pressure change of the current sub-cycle, allocated on first use */
+  int nsubcycle = 0;              /* Sub-cycles per iteration, set from the latest residuals */
+
+/*--- Defect correction state (iengine = 3) ---*/
+
+  std::vector<AMGLevel> amg_levels;   /* AMG hierarchy, rebuilt every outer iteration */
+  std::vector<double> amg_lu;         /* Coarsest level: dense LU factors (row-major) */
+  std::vector<int> amg_piv;           /* Coarsest level: pivot row of each elimination step */
+  Array3 *dc_r = NULL;                /* Full residual at the start of the last outer iteration */
+  double dc_rnormold = 0.0;           /* Norm of the full residual at the previous outer iteration */
+  double dc_cfl = 0.0;                /* CFL number of the previous outer iteration */
+
+/*--- Batch engine (ibatch = 1) ---*/
+
+  const int nbatchout = 8;            /* Values per case in the packed results: status (1 converged, 0 not, */
+                                      /*   -1 diverged), iterations, conv, minimum u on the vertical centerline */
+                                      /*   and its y, maximum and minimum v on the horizontal centerline, */
+                                      /*   L2 discretization error of u (imms = 1, else 0) */
+
+/*--- Geometry of the imax x jmax run, passed to the discretization kernels: set by 'set_derived_inputs' ---*/
+
+  GridGeometry maingrid;              /* imax, jmax, dx, dy, rmu */
+
+/*--- Shared read-only inputs of the CavityGrid drivers: filled by 'grid_inputs', once per grid size ---*/
+
+  std::mutex inputs_mutex;            /* Protects inputs_registry */
+  std::map<std::pair<int,int>, std::shared_ptr<const GridInputs> > inputs_registry;  /* Inputs by (ni, nj) */
+
+/*--- Tiered checkpoint agent (icheck = 1): started by the first 'checkpoint_tiered' call ---*/
+
+  std::thread ck_agent;               /* Background thread draining the fast tier */
+  std::deque<int> ck_queue;           /* Checkpoints waiting to be drained (at most nckqueue) */
+  std::mutex ck_mutex;                /* Protects ck_queue and ck_stop */
+  std::condition_variable ck_cond;    /* Wakes the agent, and the solver waiting for room in ck_queue */
+  char ck_fastdir[512] = "";          /* This run's fast-tier directory: set by 'checkpoint_fast_dir' */
+  bool ck_stop = false;               /* Set at the end of the run: drain and exit */
+
+/*--- Binary stream sink (ipipe = 1): opened by 'stream_open' ---*/
+/*--- Each frame is a StreamFrameHeader followed by neq planes of imax*jmax doubles (p, u, v) ---*/
+
+  struct StreamFrameHeader
+  {
+      char magic[8];                  /* "CAVFRAME" */
+      int version;                    /* Frame format version (= 1) */
+      int ni;                         /* Points in x (imax) */
+      int nj;                         /* Points in y (jmax) */
+      int nplanes;                    /* Number of field planes that follow */
+      int n;                          /* Iteration number */
+      int flags;                      /* = 1 for the end-of-stream marker (no payload) */
+      double rtime;                   /* Pseudo time */
+      double conv;                    /* Convergence measure */
+      double xmin, xmax, ymin, ymax;  /* Cavity extent */
+      unsigned long long payload;     /* Payload bytes after the header */
+  };
+
+  const int nstreambuf = 2;           /* Frame buffers: one being filled while one is written */
+  char *stream_buf[nstreambuf];       /* Frame buffers (page aligned) */
+  size_t stream_bytes[nstreambuf];    /* Bytes per frame */
+  std::atomic<int> stream_fd(-1);     /* Stream file descriptor (the writer sets it to -1 when the consumer goes away) */
+  int stream_nfree = 0;               /* Number of buffers free to fill */
+  int stream_next = 0;                /* Next buffer to fill (buffers are used round-robin) */
+  std::deque<int> stream_full;        /* Buffers waiting to be written, in order */
+  std::thread stream_agent;           /* Writer thread */
+  std::mutex stream_mutex;            /* Protects the buffer bookkeeping */
+  std::condition_variable stream_cond;/* Signals buffer state changes */
+  bool stream_stop = false;           /* Set at the end of the run: drain and exit */
+
 /***********************************************************************************************************/
 /*      NOTE: The Main routine for this C++ code is found at the end                                       */
 /***********************************************************************************************************/
@@ -319,6 +1067,17 @@ void set_derived_inputs()
     dx = (xmax - xmin)/(double)(imax - 1);          /* Delta x (m) */
     dy = (ymax - ymin)/(double)(jmax - 1);          /* Delta y (m) */
     rpi = acos(-one);                            /* Pi = 3.14159... */
+    maingrid.ni = imax;                          /* Geometry of the imax x jmax run */
+    maingrid.nj = jmax;
+    maingrid.hx = dx;
+    maingrid.hy = dy;
+    maingrid.mu = rmu;
+    maingrid.in = grid_inputs(imax, jmax);       /* Wall velocities and pinned pressure */
+    ulid = uinf;                                 /* Lid velocity (m/s) */
+    if(iinit==2 && irstr==0)
+    {
+        ulid = zero;                             /* Ramped up in the main loop */
+    }
     printf("rho,V,L,mu,Re: %f %f %f %f %f\n",rho,uinf,rlength,rmu,Re);
 }
 
@@ -332,7 +1091,7 @@ void GS_iteration( boundaryConditionPointer set_boundary_conditions, Array3& u,
     /* Artificial Viscosity */
     Compute_Artificial_Viscosity(u, viscx, viscy);
     /* Symmetric Gauss-Siedel: Forward Sweep */
-    SGS_forward_sweep(u, viscx, viscy, dt, src);
+    SGS_forward_sweep(maingrid, u, viscx, viscy, dt, src);
           
     /* Set Boundary Conditions for u */
     set_boundary_conditions(u);
@@ -341,10 +1100,16 @@ void GS_iteration( boundaryConditionPointer set_boundary_conditions, Array3& u,
     Compute_Artificial_Viscosity(u, viscx, viscy);
                  
     /* Symmetric Gauss-Siedel: Backward Sweep */
-    SGS_backward_sweep(u, viscx, viscy, dt, src);
+    SGS_backward_sweep(maingrid, u, viscx, viscy, dt, src);
 
     /* Set Boundary Conditions for u */
     set_boundary_conditions(u);
+
+    /* Pressure sub-cycles (isubcycle = 1, count set from the last residuals) */
+    for(int m=0; m<nsubcycle; m++)
+    {
+        pressure_subcycle(set_boundary_conditions, u, viscx, viscy, dt, src);
+    }
     cout<<"GS_Iteration worked"<<endl;
 }
 
@@ -363,6 +1128,12 @@ void PJ_iteration( boundaryConditionPointer set_boundary_conditions, Array3& u,
            
     /* Set Boundary Conditions for u */
     set_boundary_conditions(u);
+
+    /* Pressure sub-cycles (isubcycle = 1, count set from the last residuals) */
+    for(int m=0; m<nsubcycle; m++)
+    {
+        pressure_subcycle(set_boundary_conditions, u, viscx, viscy, dt, src);
+    }
 }
 
 /**************************************************************************/
@@ -370,7 +1141,7 @@ void PJ_iteration( boundaryConditionPointer set_boundary_conditions, Array3& u,
 void output_file_headers()
 {
   /*
-  Uses global variable(s): imms, fp1, fp2
+  Uses global variable(s): imms, ischedule, fp1, fp2
   */
   
   /* Note: The vector of primitive variables is: */
@@ -379,7 +1150,15 @@ void output_file_headers()
 
     fp1 = fopen("./history.dat","w");
     fprintf(fp1,"TITLE = \"Cavity Iterative Residual History\"\n");
-    fprintf(fp1,"variables=\"Iteration\"\"Time(s)\"\"Res1\"\"Res2\"\"Res3\"\n");
+    fprintf(fp1,"# run: imax= %d jmax= %d Re= %e iengine= %d isgs= %d\n", imax, jmax, Re, iengine, isgs);   /* Read by 'read_history' */
+    if(ischedule==1)
+    {
+        fprintf(fp1,"variables=\"Iteration\"\"Time(s)\"\"Res1\"\"Res2\"\"Res3\"\"CFL\"\"Cx\"\"Cy\"\"rkappa\"\n");
+    }
+    else
+    {
+        fprintf(fp1,"variables=\"Iteration\"\"Time(s)\"\"Res1\"\"Res2\"\"Res3\"\n");
+    }
 
     fp2 = fopen("./cavity.dat","w");
     fprintf(fp2,"TITLE = \"Cavity Field Data\"\n");
@@ -410,15 +1189,12 @@ void output_file_headers()
 void initial(int& ninit, double& rtime, double resinit[neq], Array3& u, Array3& s)
 {
     /* 
-    Uses global variable(s): zero, one, irstr, imax, jmax, neq, uinf, pinf 
+    Uses global variable(s): zero, one, irstr, iinit, icheck, imax, jmax, neq, ulid, pinf, xmin, dx
     To modify: ninit, rtime, resinit, u, s
     */
     int i;                       /* i index (x direction) */
     int j;                       /* j index (y direction) */
     int k;                       /* k index (# of equations) */
-  
-    double x;       /* Temporary variable for x location */
-    double y;       /* Temporary variable for y location */
 
     /* This subroutine sets inital conditions in the cavity */
 
@@ -445,29 +1221,29 @@ void initial(int& ninit, double& rtime, double resinit[neq], Array3& u, Array3&
                 s(i,j,1) = zero;
                 s(i,j,2) = zero;
             }
-            u(i, jmax-1, 1) = uinf; /* Initialize lid (top) to freestream velocity */
+            u(i, jmax-1, 1) = ulid*lid_profile(xmin + dx*(double)(i)); /* Initialize lid (top) to freestream velocity */
+        }
+        if(iinit==1)
+        {
+            stokes_initial(u);   /* Start from the creeping-flow solution */
         }
     }  
+    else if(irstr==1 && icheck==1 && checkpoint_restart(ninit, rtime, resinit, u)==1)  /* Newest valid tiered checkpoint */
+    {
+        ninit += 1;
+        printf("Restarting at iteration %d\n", ninit);
+    }
     else if(irstr==1)  /* Restarting from previous run (file 'restart.in') */
     {
-        fp4 = fopen("./restart.in","r"); /* Note: 'restart.in' must exist! */
-        if (fp4==NULL)
+        /* Note: 'restart.in' must exist! Memory-mapped and parsed in parallel */
+        /* (needs the iteration #, time value and initial iterative residuals for scaling) */
+        if(read_restart_fast("./restart.in", ninit, rtime, resinit, u)==0)
         {
             printf("Error opening restart file. Stopping.\n");
             exit (0);
         }      
-        fscanf(fp4, "%d %lf", ninit, rtime); /* Need to known current iteration # and time value */
-        fscanf(fp4, "%lf %lf %lf", &resinit[0], &resinit[1], &resinit[2]); /* Needs initial iterative residuals for scaling */
-        for(i=0; i<imax; i++)
-        {
-            for(j=0; j<jmax; j++)
-            {
-                fscanf(fp4, "%lf %lf %lf %lf %lf", &x, &y, &u(i,j,0), &u(i,j,1), &u(i,j,2)); 
-            }
-        }
         ninit += 1;
         printf("Restarting at iteration %d\n", ninit);
-        fclose(fp4);
     }   
     else
     {
@@ -476,131 +1252,493 @@ void initial(int& ninit, double& rtime, double resinit[neq], Array3& u, Array3&
     }
 }
 
-
 /**************************************************************************/
 
-void bndry( Array3& u )
+void fft_mixed_radix( const std::complex<double> *in, int stride, std::complex<double> *out, std::complex<double> *tmp, int n, const std::complex<double> *w, int wstride )
 {
     /* 
-    Uses global variable(s): zero, one (not used), two, half, imax, jmax, uinf  
-    To modify: u 
+    Uses: in (n values, 'stride' apart), w (w[t] = exp(-2 pi i t/N) of the full length N = n*wstride)
+    To modify: out (n values, DFT of in), tmp (n values of scratch)
+    Recursive decimation in time over the smallest factor p of n: O(n (p1 + p2 + ...)) for
+    n = p1 p2 ..., i.e. O(n log n) for smooth n and never worse than the O(n^2) direct sum.
     */
-    int i;                                          //i index (x direction)
-    int j;                                          //j index (y direction)
-
-    /* This applies the cavity boundary conditions */
-
-
-/* !************************************************************** */
-/* !************ADD CODING HERE FOR INTRO CFD STUDENTS************ */
-/* !************************************************************** */
- 
-/* Note: The vector of primitive variables is:  */
-    /*              u = [p, u, v]^T               */
-
-for(j = 0; j<jmax; j++)
-
-	{
-        u(0,j,1) = zero; /*Ux = 0 Left wall*/
-		u(0,j,2) = zero; /*Uy = 0 Left wall*/
-
-        u(imax-1,j,1) = zero; /*Ux = 0 Right wall*/
-		u(imax-1,j,2) = zero; /*Uy = 0 Right wall*/
-
-		/*Pressure */
- 		u(imax-1,j,0) = two* u(imax-2,j,0) - u(imax-3,j,0);  /*Pressure at Right wall*/
-
-
-
- 		u(0,j,0) = two* u(1,j,0) - u(2,j,0); /*Pressure at left wall*/
+    int p = n;                   /* Smallest factor of n */
+    int m;                       /* Length of the sub-transforms */
 
+    if(n==1)
+    {
+        out[0] = in[0];
+        return;
+    }
+    for(int f=2; f*f<=n; f++)
+    {
+        if(n%f==0)
+        {
+            p = f;
+            break;
+        }
+    }
+    m = n/p;
 
+    /* Sub-transform r of the samples r, r+p, ... goes to tmp[r*m..]; out serves as its scratch */
+    for(int r=0; r<p; r++)
+    {
+        fft_mixed_radix(in + r*stride, stride*p, tmp + r*m, out + r*m, m, w, wstride*p);
+    }
+    for(int k=0; k<m; k++)
+    {
+        for(int q=0; q<p; q++)
+        {
+            std::complex<double> sum = tmp[k];
+            for(int r=1; r<p; r++)
+            {
+                sum += tmp[r*m+k]*w[((long)(r)*(long)(k+m*q)%n)*wstride];
             }
-
-
-for(i = 1; i<imax-1; i++)
-
-	{
-	    u(i,0,1) = zero; /*Ux = 0 bottom wall*/
-	    u(i,0,2) = zero; /*Uy = 0 bottom wall*/
-
-	    u(i,0,0) = two* u(i,1,0) - u(i,2,0);  /*Pressure at bottom wall*/
-        /*cout<<u(i,0,0)<< endl;*/
-
-
-
-        u(i, jmax-1, 1) = uinf;  /* Initialize lid (top) to freestream velocity */
-        u(i, jmax-1, 2) = 0; /*Initialize lid top UY = 0*/
-        u(i, jmax-1, 0) = two * u(i,jmax-2,0) - u(i,jmax-3,0); /*Pressure at top wall*/
-
-
-
-
+            out[k+m*q] = sum;
         }
-
+    }
 }
 
 /**************************************************************************/
 
-void bndrymms( Array3& u )
+void poisson_dirichlet_solve( std::vector<std::complex<double> >& w, double lam[], Array2& r, Array2& z, Array2& work )
 {
     /* 
-    Uses global variable(s): two, imax, jmax, neq, xmax, xmin, ymax, ymin, rlength  
-    To modify: u
+    Uses global variable(s): zero, one, two, half, imax, jmax, dy
+    Uses: w (FFT twiddles of length 2 (imax-1)), lam (1D x-eigenvalues), r (right-hand side, interior nodes)
+    To modify: z (solution of Lap(z) = r with z = 0 on the boundary), work
     */
     int i;                       /* i index (x direction) */
     int j;                       /* j index (y direction) */
-    int k;                       /* k index (# of equations) */
-  
-    double x;       /* Temporary variable for x location */
-    double y;       /* Temporary variable for y location */
+    int k;                       /* k index (sine mode) */
+
+    int n1 = imax - 2;           /* Number of interior nodes in x */
+    int n2 = jmax - 2;           /* Number of interior nodes in y */
+    int nfft = 2*(n1+1);         /* FFT length of the odd extension */
+
+    double bet;                  /* Thomas algorithm pivot */
+    double scale = sqrt(two/(double)(n1+1));   /* Orthonormal sine transform scaling */
+    double *gam = new double[jmax];   /* Thomas algorithm work array */
+
+    std::vector<std::complex<double> > a(nfft);   /* Odd extension of one line */
+    std::vector<std::complex<double> > b(nfft);   /* Its DFT */
+    std::vector<std::complex<double> > c(nfft);   /* FFT scratch */
+
+    /* Orthonormal sine transform in x (its own inverse): the DFT of the odd extension  */
+    /* (0, r(1), ..., r(n1), 0, -r(n1), ..., -r(1)) is -2i sum_i r(i) sin(pi k i/(n1+1)) */
+    auto sine_transform = [&](Array2& from, Array2& to, int jline)
+    {
+        a[0] = zero;
+        a[n1+1] = zero;
+        for(i=1; i<=n1; i++)
+        {
+            a[i] = from(i,jline);
+            a[nfft-i] = -from(i,jline);
+        }
+        fft_mixed_radix(a.data(), 1, b.data(), c.data(), nfft, w.data(), 1);
+        for(k=1; k<=n1; k++)
+        {
+            to(k,jline) = -half*scale*b[k].imag();
+        }
+    };
+
+    /* Fast direct solve: sine transform in x, tridiagonal (Thomas) solves in y */
+    /* O(imax jmax (p1 + p2 + ...)) for 2 (imax-1) = p1 p2 ..., e.g. O(N^2 log N) on N x N */
+    for(j=1; j<=n2; j++)
+    {
+        sine_transform(r, work, j);
+    }
+    for(k=1; k<=n1; k++)
+    {
+        /* (z(j+1) - 2 z(j) + z(j-1))/dy^2 + lam(k) z(j) = work(k,j) */
+        bet = lam[k] - two/(dy*dy);
+        work(k,1) = work(k,1)/bet;
+        for(j=2; j<=n2; j++)
+        {
+            gam[j] = (one/(dy*dy))/bet;
+            bet = (lam[k] - two/(dy*dy)) - (one/(dy*dy))*gam[j];
+            work(k,j) = (work(k,j) - (one/(dy*dy))*work(k,j-1))/bet;
+        }
+        for(j=n2-1; j>=1; j--)
+        {
+            work(k,j) -= gam[j+1]*work(k,j+1);
+        }
+    }
+    for(j=1; j<=n2; j++)
+    {
+        sine_transform(work, z, j);
+    }
+    delete [] gam;
+}
+
+/**************************************************************************/
+
+void stokes_operator( Array2& psi, Array2& lap, Array2& out )
+{
+    /* 
+    Uses global variable(s): zero, two, imax, jmax, dx, dy
+    Uses: psi (interior nodes; zero on the walls)
+    To modify: out = biharmonic(psi) at the interior nodes (no-slip walls, homogeneous), lap
+    */
+    int i;                       /* i index (x direction) */
+    int j;                       /* j index (y direction) */
+
+    /* Laplacian at the interior nodes */
+    for(i=1; i<imax-1; i++)
+    {
+        for(j=1; j<jmax-1; j++)
+        {
+            lap(i,j) = (psi(i+1,j) - two*psi(i,j) + psi(i-1,j))/(dx*dx)
+                     + (psi(i,j+1) - two*psi(i,j) + psi(i,j-1))/(dy*dy);
+        }
+    }
+    /* Laplacian at the walls with the mirror ghost psi(-1) = psi(1) (zero normal derivative) */
+    for(j=1; j<jmax-1; j++)
+    {
+        lap(0,j)      = two*psi(1,j)/(dx*dx);
+        lap(imax-1,j) = two*psi(imax-2,j)/(dx*dx);
+    }
+    for(i=1; i<imax-1; i++)
+    {
+        lap(i,0)      = two*psi(i,1)/(dy*dy);
+        lap(i,jmax-1) = two*psi(i,jmax-2)/(dy*dy);
+    }
+    for(i=1; i<imax-1; i++)
+    {
+        for(j=1; j<jmax-1; j++)
+        {
+            out(i,j) = (lap(i+1,j) - two*lap(i,j) + lap(i-1,j))/(dx*dx)
+                     + (lap(i,j+1) - two*lap(i,j) + lap(i,j-1))/(dy*dy);
+        }
+    }
+}
+
+/**************************************************************************/
+
+void stokes_initial( Array3& u )
+{
+    /* 
+    Uses global variable(s): zero, one, two, half, imax, jmax, dx, dy, rmu, pinf, uinf, rpi, xmin, ilid
+    To modify: u (creeping-flow solution: p, u, v)
+    */
+    int i;                       /* i index (x direction) */
+    int j;                       /* j index (y direction) */
+    int k;                       /* k index (sine mode) */
+    int it;                      /* CG iteration */
+
+    int n1 = imax - 2;           /* Number of interior nodes in x */
+    int iref = (imax-1)/2;       /* Pressure reference location (cavity center) */
+    int jref = (jmax-1)/2;
+
+    double rz;                   /* r . z */
+    double rzold;                /* Previous r . z */
+    double sq;                   /* s . q */
+    double alpha;                /* CG step length */
+    double rnorm;                /* Residual norm */
+    double rnorm0 = zero;        /* Initial residual norm */
+    double dwdx;                 /* Vorticity x derivative */
+    double dwdy;                 /* Vorticity y derivative */
+    double *lam = new double[imax];   /* 1D Dirichlet Laplacian eigenvalues in x */
+
+    Array2 psi(imax, jmax);      /* Stream function (u = dpsi/dy, v = -dpsi/dx) */
+    Array2 r(imax, jmax);        /* CG residual */
+    Array2 z(imax, jmax);        /* Preconditioned residual */
+    Array2 s(imax, jmax);        /* Search direction */
+    Array2 q(imax, jmax);        /* Operator times search direction */
+    Array2 lap(imax, jmax);      /* Laplacian work array (holds -vorticity at the end) */
+    Array2 work(imax, jmax);     /* Fast Poisson work array */
+    std::vector<std::complex<double> > w(2*(imax-1));   /* FFT twiddles for the sine transform */
+
+    /* Creeping flow: biharmonic(psi) = 0, psi = 0 and dpsi/dn = wall velocity on the walls. */
+    /* Solved by CG preconditioned with two fast Poisson solves (Lap_D^2 ~ biharmonic).      */
+
+    for(k=1; k<=n1; k++)
+    {
+        lam[k] = -four/(dx*dx)*pow2(sin(half*(double)(k)*rpi/(double)(n1+1)));
+    }
+    for(size_t t=0; t<w.size(); t++)
+    {
+        w[t] = std::polar(one, -two*rpi*(double)(t)/(double)(w.size()));
+    }
+    for(i=0; i<imax; i++)
+    {
+        for(j=0; j<jmax; j++)
+        {
+            psi(i,j) = zero;
+            r(i,j) = zero;
+            z(i,j) = zero;
+            s(i,j) = zero;
+            q(i,j) = zero;
+        }
+    }
+
+    /* The moving lid enters through the top ghost psi(jmax) = psi(jmax-2) + 2 dy uinf (times the lid profile) */
+    for(i=1; i<imax-1; i++)
+    {
+        r(i,jmax-2) = -two*uinf*lid_profile(xmin + dx*(double)(i))/(dy*dy*dy);
+        rnorm0 += pow2(r(i,jmax-2));
+    }
+    rnorm0 = sqrt(rnorm0);
+
+    poisson_dirichlet_solve(w, lam, r, work, lap);
+    poisson_dirichlet_solve(w, lam, work, z, lap);
+    rz = zero;
+    for(i=1; i<imax-1; i++)
+    {
+        for(j=1; j<jmax-1; j++)
+        {
+            s(i,j) = z(i,j);
+            rz += r(i,j)*z(i,j);
+        }
+    }
+    for(it=0; it<1000; it++)
+    {
+        stokes_operator(s, lap, q);
+        sq = zero;
+        for(i=1; i<imax-1; i++)
+        {
+            for(j=1; j<jmax-1; j++)
+            {
+                sq += s(i,j)*q(i,j);
+            }
+        }
+        alpha = rz/sq;
+        rnorm = zero;
+        for(i=1; i<imax-1; i++)
+        {
+            for(j=1; j<jmax-1; j++)
+            {
+                psi(i,j) += alpha*s(i,j);
+                r(i,j) -= alpha*q(i,j);
+                rnorm += pow2(r(i,j));
+            }
+        }
+        if(sqrt(rnorm)<1.e-10*rnorm0)
+        {
+            break;
+        }
+        poisson_dirichlet_solve(w, lam, r, work, lap);
+        poisson_dirichlet_solve(w, lam, work, z, lap);
+        rzold = rz;
+        rz = zero;
+        for(i=1; i<imax-1; i++)
+        {
+            for(j=1; j<jmax-1; j++)
+            {
+                rz += r(i,j)*z(i,j);
+            }
+        }
+        for(i=1; i<imax-1; i++)
+        {
+            for(j=1; j<jmax-1; j++)
+            {
+                s(i,j) = z(i,j) + (rz/rzold)*s(i,j);
+            }
+        }
+    }
+    printf("Stokes initial guess: %d PCG iterations\n", it+1);
+
+    /* Velocities from the stream function */
+    for(i=1; i<imax-1; i++)
+    {
+        for(j=1; j<jmax-1; j++)
+        {
+            u(i,j,1) =  (psi(i,j+1) - psi(i,j-1))/(two*dy);
+            u(i,j,2) = -(psi(i+1,j) - psi(i-1,j))/(two*dx);
+        }
+    }
+
+    /* Vorticity w = -Lap(psi) everywhere (Thom's formula on the walls, including the lid) */
+    stokes_operator(psi, lap, q);
+    for(i=1; i<imax-1; i++)
+    {
+        lap(i,jmax-1) += two*uinf*lid_profile(xmin + dx*(double)(i))/dy;
+    }
+    lap(0,0) = lap(imax-1,0) = lap(0,jmax-1) = lap(imax-1,jmax-1) = zero;
+
+    /* Pressure and mu*w are harmonic conjugates: dp/dx = -mu dw/dy, dp/dy = mu dw/dx.   */
+    /* Integrate from the cavity center along row jref, then up and down every column.  */
+    u(iref,jref,0) = pinf;
+    for(i=iref+1; i<imax-1; i++)
+    {
+        dwdy = -half*((lap(i-1,jref+1) - lap(i-1,jref-1)) + (lap(i,jref+1) - lap(i,jref-1)))/(two*dy);
+        u(i,jref,0) = u(i-1,jref,0) - rmu*dwdy*dx;
+    }
+    for(i=iref-1; i>0; i--)
+    {
+        dwdy = -half*((lap(i+1,jref+1) - lap(i+1,jref-1)) + (lap(i,jref+1) - lap(i,jref-1)))/(two*dy);
+        u(i,jref,0) = u(i+1,jref,0) + rmu*dwdy*dx;
+    }
+    for(i=1; i<imax-1; i++)
+    {
+        for(j=jref+1; j<jmax-1; j++)
+        {
+            dwdx = -half*((lap(i+1,j-1) - lap(i-1,j-1)) + (lap(i+1,j) - lap(i-1,j)))/(two*dx);
+            u(i,j,0) = u(i,j-1,0) + rmu*dwdx*dy;
+        }
+        for(j=jref-1; j>0; j--)
+        {
+            dwdx = -half*((lap(i+1,j+1) - lap(i-1,j+1)) + (lap(i+1,j) - lap(i-1,j)))/(two*dx);
+            u(i,j,0) = u(i,j+1,0) - rmu*dwdx*dy;
+        }
+    }
+    delete [] lam;
+}
+
+
+/**************************************************************************/
+
+void bndry( Array3& u )
+{
+    /* 
+    Uses global variable(s): imax, maingrid
+    To modify: u 
+    */
+
+    /* This applies the cavity boundary conditions */
+    bndry_lines(maingrid, u, 0, imax);
+}
+
+/**************************************************************************/
+
+void bndry_lines( const GridGeometry& g, Array3& u, int i0, int i1 )
+{
+    /* 
+    Uses global variable(s): zero, one (not used), two, half, ulid
+    Uses: g (points, lid profile)
+    To modify: u 
+    Cavity boundary conditions on the grid lines i0 <= i < i1: the side walls when the range
+    includes them (applied first), then the top and bottom walls of the lines in the range
+    */
+    int i;                                          //i index (x direction)
+    int j;                                          //j index (y direction)
+
+    /* This applies the cavity boundary conditions */
+
+
+/* !************************************************************** */
+/* !************ADD CODING HERE FOR INTRO CFD STUDENTS************ */
+/* !************************************************************** */
+ 
+/* Note: The vector of primitive variables is:  */
+    /*              u = [p, u, v]^T               */
+
+for(j = 0; j<g.nj; j++)
+
+	{
+      if(i0==0)
+      {
+        u(0,j,1) = zero; /*Ux = 0 Left wall*/
+		u(0,j,2) = zero; /*Uy = 0 Left wall*/
+      }
+
+      if(i1==g.ni)
+      {
+        u(g.ni-1,j,1) = zero; /*Ux = 0 Right wall*/
+		u(g.ni-1,j,2) = zero; /*Uy = 0 Right wall*/
+
+		/*Pressure */
+ 		u(g.ni-1,j,0) = two* u(g.ni-2,j,0) - u(g.ni-3,j,0);  /*Pressure at Right wall*/
+      }
+
+
+
+      if(i0==0)
+      {
+ 		u(0,j,0) = two* u(1,j,0) - u(2,j,0); /*Pressure at left wall*/
+      }
+
+
+            }
+
+
+for(i = max(i0,1); i<min(i1,g.ni-1); i++)
+
+	{
+	    u(i,0,1) = zero; /*Ux = 0 bottom wall*/
+	    u(i,0,2) = zero; /*Uy = 0 bottom wall*/
+
+	    u(i,0,0) = two* u(i,1,0) - u(i,2,0);  /*Pressure at bottom wall*/
+        /*cout<<u(i,0,0)<< endl;*/
+
+
+
+        u(i, g.nj-1, 1) = ulid*g.in->by(i,1,1);  /* Initialize lid (top) to freestream velocity */
+        u(i, g.nj-1, 2) = 0; /*Initialize lid top UY = 0*/
+        u(i, g.nj-1, 0) = two * u(i,g.nj-2,0) - u(i,g.nj-3,0); /*Pressure at top wall*/
+
+
+
+
+        }
+
+}
+
+/**************************************************************************/
+
+void bndrymms( Array3& u )
+{
+    /* 
+    Uses global variable(s): imax, maingrid
+    To modify: u
+    */
+
+    /* This applies the cavity boundary conditions for the manufactured solution */
+    bndrymms_lines(maingrid, u, 0, imax);
+}
+
+/**************************************************************************/
+
+void bndrymms_lines( const GridGeometry& g, Array3& u, int i0, int i1 )
+{
+    /* 
+    Uses global variable(s): two
+    Uses: g (points, MMS wall velocities)
+    To modify: u
+    Manufactured-solution boundary conditions on the grid lines i0 <= i < i1: the side walls
+    when the range includes them (applied first), then the top and bottom walls in increasing i.
+    The wall velocities are evaluated once per grid size ('grid_inputs_fill')
+    */
+    int i;                       /* i index (x direction) */
+    int j;                       /* j index (y direction) */
+    const GridInputs& in = *g.in;
 
     /* This applies the cavity boundary conditions for the manufactured solution */
 
     /* Side Walls */
-    for( j = 1; j<jmax-1; j++)
+    for( j = 1; j<g.nj-1; j++)
     {
-        y = (ymax - ymin)*(double)(j)/(double)(jmax - 1);
-        i = 0;
-        x = xmin;
-            
-        u(i,j,0)  = umms(x,y,0);
-        u(i,j,1)  = umms(x,y,1);
-        u(i,j,2)  = umms(x,y,2);
+        if(i0==0)
+        {
+            u(0,j,1) = in.bx(0,j,1);
+            u(0,j,2) = in.bx(0,j,2);
 
-        u(0,j,0) = two*u(1,j,0) - u(2,j,0);    /* 2nd Order BC */
+            u(0,j,0) = two*u(1,j,0) - u(2,j,0);    /* 2nd Order BC */
+        }
 
-        i=imax-1;
-        x = xmax;
-            
-        u(i,j,0)  = umms(x,y,0);
-        u(i,j,1)  = umms(x,y,1);
-        u(i,j,2)  = umms(x,y,2);
+        if(i1==g.ni)
+        {
+            i = g.ni-1;
+            u(i,j,1) = in.bx(1,j,1);
+            u(i,j,2) = in.bx(1,j,2);
 
-        u(imax-1,j,0) = two*u(imax-2,j,0) - u(imax-3,j,0);   /* 2nd Order BC */
+            u(g.ni-1,j,0) = two*u(g.ni-2,j,0) - u(g.ni-3,j,0);   /* 2nd Order BC */
+        }
     }
 
     /* Top/Bottom Walls */
-    for(i=0; i<imax; i++)
+    for(i=i0; i<i1; i++)
     {
-        x = (xmax - xmin)*(double)(i)/(double)(imax - 1);
-        j = 0;
-        y = ymin;
-
-        u(i,j,0)  = umms(x,y,0);
-        u(i,j,1)  = umms(x,y,1);
-        u(i,j,2)  = umms(x,y,2);
+        u(i,0,1) = in.by(i,0,1);
+        u(i,0,2) = in.by(i,0,2);
 
         u(i,0,0) = two*u(i,1,0) - u(i,2,0);   /* 2nd Order BC */
 
-        j = jmax-1;
-        y = ymax;
-            
-        u(i,j,0)  = umms(x,y,0);
-        u(i,j,1)  = umms(x,y,1);
-        u(i,j,2)  = umms(x,y,2);
+        j = g.nj-1;
+        u(i,j,1) = in.by(i,1,1);
+        u(i,j,2) = in.by(i,1,2);
 
-        u(i,jmax-1,0) = two*u(i,jmax-2,0) - u(i,jmax-3,0);   /* 2nd Order BC */
+        u(i,g.nj-1,0) = two*u(i,g.nj-2,0) - u(i,g.nj-3,0);   /* 2nd Order BC */
     }
 }
 
@@ -873,12 +2011,24 @@ double srcmms_ymtm(double x, double y)
 void compute_time_step( Array3& u, Array2& dt, double& dtmin )
 {
     /* 
- * cout <<
-    Uses global variable(s): one (not used), two, four, half, fourth
-    Uses global variable(s): vel2ref, rmu, rho, dx, dy, cfl, rkappa, imax, jmax
+    Uses global variable(s): imax, maingrid
     Uses: u
     To Modify: dt, dtmin
     */
+    time_step_lines(maingrid, u, dt, dtmin, 1, imax-1);
+}
+
+/**************************************************************************/
+
+void time_step_lines( const GridGeometry& g, Array3& u, Array2& dt, double& dtmin, int i0, int i1 )
+{
+    /* 
+ * cout <<
+    Uses global variable(s): one (not used), two, four, half, fourth
+    Uses global variable(s): vel2ref, rho, cfl, rkappa
+    Uses: g (points, spacing, viscosity), u
+    To Modify: dt, dtmin (local time step on the interior lines i0 <= i < i1)
+    */
     int i;                      //i index (x direction)
     int j;                      //j index (y direction)
   
@@ -894,9 +2044,9 @@ void compute_time_step( Array3& u, Array2& dt, double& dtmin )
 /* !************ADD CODING HERE FOR INTRO CFD STUDENTS************ */
 /* !************************************************************** */
 
-for(i=1; i<imax-1; i++)
+for(i=i0; i<i1; i++)
 {
-	for(j=1; j<jmax-1; j++)
+	for(j=1; j<g.nj-1; j++)
 	{
 
 	uvel2 = u(i,j,1)* u(i,j,1) + u(i,j,2)* u(i,j,2);
@@ -909,11 +2059,18 @@ for(i=1; i<imax-1; i++)
 	lambda_max = (lambda_x > lambda_y)? lambda_x:lambda_y;
 	
 	/*cout << "lambda_x = " << lambda_max << endl;*/
-	dtconv = fmin(dx, dy)/lambda_max ;
+	dtconv = fmin(g.hx, g.hy)/lambda_max ;
 	
-	dtvisc = (dx*dy) / (four*rmu*rhoinv);
+	dtvisc = (g.hx*g.hy) / (two*g.mu*rhoinv*(g.hy/g.hx + g.hx/g.hy));   /* = dx*dy/(4 mu/rho) for dx = dy */
 	
-	dtmin = cfl*fmin(dtconv, dtvisc);
+	if(ivisc==1) /* viscous terms are point-implicit: only the convective CFL limits the step */
+	{
+	    dtmin = cfl*dtconv;
+	}
+	else
+	{
+	    dtmin = cfl*fmin(dtconv, dtvisc);
+	}
 	
 	dt(i,j) = dtmin;
         }
@@ -926,12 +2083,25 @@ for(i=1; i<imax-1; i++)
 void Compute_Artificial_Viscosity( Array3& u, Array2& viscx, Array2& viscy )
 {
     /* 
-    Uses global variable(s): zero (not used), one (not used), two, four, six, half, fourth (not used)
-    Uses global variable(s): imax, jmax, lim (not used), rho, dx, dy, Cx, Cy, Cx2 (not used), Cy2 (not used)
-    , fsmall (not used), vel2ref, rkappa
+    Uses global variable(s): imax, maingrid
     Uses: u
     To Modify: artviscx, artviscy
     */
+    artificial_viscosity_lines(maingrid, u, viscx, viscy, 1, imax-1);
+}
+
+/**************************************************************************/
+
+void artificial_viscosity_lines( const GridGeometry& g, Array3& u, Array2& viscx, Array2& viscy, int i0, int i1 )
+{
+    /* 
+    Uses global variable(s): zero (not used), one (not used), two, four, six, half, fourth (not used)
+    Uses global variable(s): lim (not used), rho, Cx, Cy, Cx2 (not used), Cy2 (not used)
+    , fsmall (not used), vel2ref, rkappa
+    Uses: g (points and spacing), u
+    To Modify: artviscx, artviscy (interior lines i0 <= i < i1; the extrapolation to i = 1
+               uses lines 2 and 3, which must be in the same range)
+    */
     int i;                  //i index (x direction)
     int j;                  //j index (y direction)
 
@@ -945,27 +2115,33 @@ void Compute_Artificial_Viscosity( Array3& u, Array2& viscx, Array2& viscy )
 /* !************************************************************** */
 /* !************ADD CODING HERE FOR INTRO CFD STUDENTS************ */
 /* !************************************************************** */
-for(j=2; j<jmax-2; j++) //for nodes interior of the nodes closest to the wall! 
+if(iflux==1)
+{
+    artificial_viscosity_faces(g, u, viscx, viscy, i0, i1);
+}
+else
+{
+for(j=2; j<g.nj-2; j++) //for nodes interior of the nodes closest to the wall! 
 {
-	for(i=2; i<imax-2; i++)
+	for(i=max(i0,2); i<min(i1,g.ni-2); i++)
 	{
 
 	   uvel2 = pow2(u(i,j,1)) + pow2(u(i,j,2));
 
            beta2 = fmax(uvel2,rkappa*uinf);
 //          cout<<"i index: "<<i<<"\t"<<"j index: "<<j<<endl;
-//          cout<<"imax: "<<imax<<"\t"<<"jmax: "<<jmax<<endl;
+//          cout<<"g.ni: "<<g.ni<<"\t"<<"g.nj: "<<g.nj<<endl;
 
            lambda_x = 0.5 * (fabs(u(i,j,1)) +  sqrt(uvel2 + four*beta2));
 //          cout<<"lamba x: "<<lambda_x<<endl;
            lambda_y = 0.5 * (fabs(u(i,j,2)) +  sqrt(uvel2 + four*beta2));
 //          cout<<"lamba y: "<<lambda_y<<endl;
 
-           d4pdx4 = (u(i+2,j,0) - four*u(i+1,j,0) + six*u(i,j,0) - four*u(i-1,j,0) + u(i-2,j,0))/ double(dx);
+           d4pdx4 = (u(i+2,j,0) - four*u(i+1,j,0) + six*u(i,j,0) - four*u(i-1,j,0) + u(i-2,j,0))/ double(g.hx);
 
 //         cout<< "d4pdx4="<< d4pdx4<<endl;
 
-           d4pdy4 = (u(i,j+2,0) - four*u(i,j+1,0) + six*u(i,j,0) - four*u(i,j-1,0) + u(i,j-2,0))/ double(dy);
+           d4pdy4 = (u(i,j+2,0) - four*u(i,j+1,0) + six*u(i,j,0) - four*u(i,j-1,0) + u(i,j-2,0))/ double(g.hy);
 
 //         cout<< "d4pdy4="<< d4pdy4<<endl;
 
@@ -978,54 +2154,56 @@ for(j=2; j<jmax-2; j++) //for nodes interior of the nodes closest to the wall!
 //        cout<< "viscy="<< viscy(i,j)<<endl;
         }
 }
+}
 //*********LINEAR EXTRAPOLATIONS*************//
 
-int sides[2] = {1,imax-2};
-int top_bottom[2] = {1,jmax-2};
+int sides[2] = {1,g.ni-2};
+int top_bottom[2] = {1,g.nj-2};
 
 for(auto i:sides){ // for nodes closest to side boundaries
-  for(j=1;j<jmax-1;j++){
+  if(i<i0 || i>=i1) continue;
+  for(j=1;j<g.nj-1;j++){
 
     if(i==1){
       // for x-component of articial viscosity
-      double slope_x = (viscx(i+2,j)-viscx(i+1,j)) / dx;
-      viscx(i,j) = viscx(i+1,j) + (slope_x*dx);
+      double slope_x = (viscx(i+2,j)-viscx(i+1,j)) / g.hx;
+      viscx(i,j) = viscx(i+1,j) + (slope_x*g.hx);
     
       //for y-component of artifcial viscosity
-      double slope_y = (viscx(i+2,j)-viscx(i+1,j)) / dx;
-      viscx(i,j) = viscx(i+1,j) + (slope_y*dx);
+      double slope_y = (viscx(i+2,j)-viscx(i+1,j)) / g.hx;
+      viscx(i,j) = viscx(i+1,j) + (slope_y*g.hx);
     }
-    if(i==imax-1){
+    if(i==g.ni-1){
       // for x-component of articial viscosity
-      double slope_x = (viscx(i-2,j)-viscx(i-1,j)) / dx;
-      viscx(i,j) = viscx(i-1,j) + (slope_x*dx);
+      double slope_x = (viscx(i-2,j)-viscx(i-1,j)) / g.hx;
+      viscx(i,j) = viscx(i-1,j) + (slope_x*g.hx);
     
       //for y-component of artifcial viscosity
-      double slope_y = (viscx(i-2,j)-viscx(i-1,j)) / dx;
-      viscx(i,j) = viscx(i-1,j) + (slope_y*dx);
+      double slope_y = (viscx(i-2,j)-viscx(i-1,j)) / g.hx;
+      viscx(i,j) = viscx(i-1,j) + (slope_y*g.hx);
      }
   }
 }
 for(auto j:top_bottom){ // for nodes closest to top & bottom boundaries
-  for(i=1;i<imax-1;i++){
+  for(i=max(i0,1);i<min(i1,g.ni-1);i++){
 
     if(j==1){
       // for x-component of articial viscosity
-      double slope_x = (viscx(i,j+2)-viscx(i,j+1)) / dy;
-      viscx(i,j) = viscx(i,j+1) + (slope_x*dy);
+      double slope_x = (viscx(i,j+2)-viscx(i,j+1)) / g.hy;
+      viscx(i,j) = viscx(i,j+1) + (slope_x*g.hy);
     
       //for y-component of artifcial viscosity
-      double slope_y = (viscy(i,j+2)-viscy(i,j+1)) / dy;
-      viscx(i,j) = viscy(i,j+1) + (slope_y*dy);
+      double slope_y = (viscy(i,j+2)-viscy(i,j+1)) / g.hy;
+      viscx(i,j) = viscy(i,j+1) + (slope_y*g.hy);
     }
-    if(j==jmax-1){
+    if(j==g.nj-1){
       // for x-component of articial viscosity
-      double slope_x = (viscx(i,j-2)-viscx(i,j-1)) / dy;
-      viscx(i,j) = viscx(i-1,j) + (slope_x*dy);
+      double slope_x = (viscx(i,j-2)-viscx(i,j-1)) / g.hy;
+      viscx(i,j) = viscx(i-1,j) + (slope_x*g.hy);
     
       //for y-component of artifcial viscosity
-      double slope_y = (viscy(i,j-2)-viscy(i,j-1)) / dy;
-      viscx(i,j) = viscy(i,j-1) + (slope_y*dy);
+      double slope_y = (viscy(i,j-2)-viscy(i,j-1)) / g.hy;
+      viscx(i,j) = viscy(i,j-1) + (slope_y*g.hy);
      }
   
   }
@@ -1035,14 +2213,14 @@ for(auto j:top_bottom){ // for nodes closest to top & bottom boundaries
 
 /**************************************************************************/
 
-void SGS_forward_sweep( Array3& u, Array2& viscx, Array2& viscy, Array2& dt, Array3& s )
+void SGS_forward_sweep( const GridGeometry& g, Array3& u, Array2& viscx, Array2& viscy, Array2& dt, const Array3& s )
 {
     /* 
     Uses global variable(s): two, three (not used), six (not used), half
-    Uses global variable(s): imax, jmax, ipgorder (not used), rho, rhoinv, dx, dy, rkappa,
+    Uses global variable(s): ipgorder (not used), rho, rhoinv, rkappa,
                         xmax (not used), xmin (not used), ymax (not used), ymin (not used), 
-                        rmu, vel2ref
-    Uses: artviscx, artviscy, dt, s
+                        vel2ref
+    Uses: g (points, spacing, viscosity), artviscx, artviscy, dt, s
     To Modify: u
     */
  
@@ -1065,40 +2243,40 @@ void SGS_forward_sweep( Array3& u, Array2& viscx, Array2& viscy, Array2& dt, Arr
 /* !************ADD CODING HERE FOR INTRO CFD STUDENTS************ */
 /* !************************************************************** */
 /****ONLY FOR 1 ITERATION STEP*******/
-  for (auto j=1;j<jmax-1;j++){ //inner nodes only - STARTING FROM node i=1,j=1
-    for (auto i=1;i<imax-1;i++){
+  for (auto j=1;j<g.nj-1;j++){ //inner nodes only - STARTING FROM node i=1,j=1
+    for (auto i=1;i<g.ni-1;i++){
      //local constants
      uvel2 = pow2(u(i,j,1)) + pow2(u(i,j,2)); //local velocity mag.
      beta2 = fmax(uvel2,rkappa*uinf); //time preconditioning constant
 
-     dpdx = (u(i+1,j,0)-u(i-1,j,0))/(two*dx); //pressure derivatives
-     dpdy = (u(i,j+1,0)-u(i,j-1,0))/(two*dy);
+     dpdx = (u(i+1,j,0)-u(i-1,j,0))/(two*g.hx); //pressure derivatives
+     dpdy = (u(i,j+1,0)-u(i,j-1,0))/(two*g.hy);
 
-     dudx = (u(i+1,j,1)-u(i-1,j,1))/(two*dx); //u velocity derivatives
-     dudy = (u(i,j+1,1)-u(i,j-1,1))/(two*dy);
+     dudx = (u(i+1,j,1)-u(i-1,j,1))/(two*g.hx); //u velocity derivatives
+     dudy = (u(i,j+1,1)-u(i,j-1,1))/(two*g.hy);
 
-     d2udx2 = (u(i+1,j,1)-2*u(i,j,1)+u(i-1,j,1))/(dx*dx);
-     d2udy2 = (u(i,j+1,1)-2*u(i,j,1)+u(i,j-1,1))/(dy*dy);
+     d2udx2 = (u(i+1,j,1)-2*u(i,j,1)+u(i-1,j,1))/(g.hx*g.hx);
+     d2udy2 = (u(i,j+1,1)-2*u(i,j,1)+u(i,j-1,1))/(g.hy*g.hy);
 
-     dvdx = (u(i+1,j,2)-u(i-1,j,2))/(two*dx); //v velocity derivatives
-     dvdy = (u(i,j+1,2)-u(i,j-1,2))/(two*dy);
+     dvdx = (u(i+1,j,2)-u(i-1,j,2))/(two*g.hx); //v velocity derivatives
+     dvdy = (u(i,j+1,2)-u(i,j-1,2))/(two*g.hy);
 
-     d2vdx2 = (u(i+1,j,2)-two*u(i,j,2)+u(i-1,j,2))/(dx*dx);
-     d2vdy2 = (u(i,j+1,2)-two*u(i,j,2)+u(i,j-1,2))/(dy*dy);
+     d2vdx2 = (u(i+1,j,2)-two*u(i,j,2)+u(i-1,j,2))/(g.hx*g.hx);
+     d2vdy2 = (u(i,j+1,2)-two*u(i,j,2)+u(i,j-1,2))/(g.hy*g.hy);
      // ----continuity equation----------
      double continuity_it_resid = (rho*dudx) + (rho*dvdy) - viscx(i,j) - viscy(i,j) - s(i,j,0); //steady-state iterative residual for continuity equation
 
      u(i,j,0) = u(i,j,0) - beta2*dt(i,j)*continuity_it_resid; //updates pressure value of node i,j
 
      // ----x-momentum equation----------
-     double xmomentum_it_resid = (rho*u(i,j,1)*dudx) + (rho*u(i,j,2)*dudy) + dpdx - (rmu*d2udx2) - (rmu*d2udy2) - s(i,j,1); //steady-state iterative residual for x-momentum equation
+     double xmomentum_it_resid = (rho*u(i,j,1)*dudx) + (rho*u(i,j,2)*dudy) + dpdx - (g.mu*d2udx2) - (g.mu*d2udy2) - s(i,j,1); //steady-state iterative residual for x-momentum equation
 
-     u(i,j,1) = u(i,j,1) - dt(i,j)*rhoinv*xmomentum_it_resid; //updates u-velocity value of node i,j
+     u(i,j,1) = u(i,j,1) - dt(i,j)*rhoinv*xmomentum_it_resid/visc_diag(g, dt(i,j)); //updates u-velocity value of node i,j
      
      // ----y-momentum equation---------- 
-     double ymomentum_it_resid = (rho*u(i,j,1)*dvdx) + (rho*u(i,j,2)*dvdy) + dpdy - (rmu*d2vdx2) - (rmu*d2vdy2) - s(i,j,2); //steady-state iterative residval for y-momentum equation
+     double ymomentum_it_resid = (rho*u(i,j,1)*dvdx) + (rho*u(i,j,2)*dvdy) + dpdy - (g.mu*d2vdx2) - (g.mu*d2vdy2) - s(i,j,2); //steady-state iterative residval for y-momentum equation
 
-     u(i,j,2) = u(i,j,2) - dt(i,j)*rhoinv*ymomentum_it_resid; //updates v-velocity value of node i,j
+     u(i,j,2) = u(i,j,2) - dt(i,j)*rhoinv*ymomentum_it_resid/visc_diag(g, dt(i,j)); //updates v-velocity value of node i,j
     }
   }
 
@@ -1108,14 +2286,14 @@ void SGS_forward_sweep( Array3& u, Array2& viscx, Array2& viscy, Array2& dt, Arr
 
 /**************************************************************************/
 
-void SGS_backward_sweep( Array3& u, Array2& viscx, Array2& viscy, Array2& dt, Array3& s )
+void SGS_backward_sweep( const GridGeometry& g, Array3& u, Array2& viscx, Array2& viscy, Array2& dt, const Array3& s )
 {
     /* 
     Uses global variable(s): two, three (not used), six (not used), half
-    Uses global variable(s): imax, jmax, ipgorder (not used), rho, rhoinv, dx, dy, rkappa,
+    Uses global variable(s): ipgorder (not used), rho, rhoinv, rkappa,
                         xmax (not used), xmin (not used), ymax (not used), ymin (not used), 
-                        rmu, vel2ref
-    Uses: artviscx, artviscy, dt, s
+                        vel2ref
+    Uses: g (points, spacing, viscosity), artviscx, artviscy, dt, s
     To Modify: u
     */
  
@@ -1140,26 +2318,26 @@ void SGS_backward_sweep( Array3& u, Array2& viscx, Array2& viscy, Array2& dt, Ar
 /* !************************************************************** */
 
 /****ONLY FOR 1 ITERATION STEP*******/
-  for (auto j=jmax-2;j>0;j--){ //inner nodes only - STARTING FROM node i=imax-2,j=jmax-2
-    for (auto i=imax-2;i>0;i--){
+  for (auto j=g.nj-2;j>0;j--){ //inner nodes only - STARTING FROM node i=g.ni-2,j=g.nj-2
+    for (auto i=g.ni-2;i>0;i--){
      //local constants
      uvel2 = pow2(u(i,j,1)) + pow2(u(i,j,2)); //local velocity mag.
      beta2 = fmax(uvel2,rkappa*uinf); //time preconditioning constant
 
-     dpdx = (u(i+1,j,0)-u(i-1,j,0))/(two*dx); //pressure derivatives
-     dpdy = (u(i,j+1,0)-u(i,j-1,0))/(two*dy);
+     dpdx = (u(i+1,j,0)-u(i-1,j,0))/(two*g.hx); //pressure derivatives
+     dpdy = (u(i,j+1,0)-u(i,j-1,0))/(two*g.hy);
 
-     dudx = (u(i+1,j,1)-u(i-1,j,1))/(two*dx); //u velocity derivatives
-     dudy = (u(i,j+1,1)-u(i,j-1,1))/(two*dy);
+     dudx = (u(i+1,j,1)-u(i-1,j,1))/(two*g.hx); //u velocity derivatives
+     dudy = (u(i,j+1,1)-u(i,j-1,1))/(two*g.hy);
 
-     d2udx2 = (u(i+1,j,1)-two*u(i,j,1)+u(i-1,j,1))/(dx*dx);
-     d2udy2 = (u(i,j+1,1)-two*u(i,j,1)+u(i,j-1,1))/(dy*dy);
+     d2udx2 = (u(i+1,j,1)-two*u(i,j,1)+u(i-1,j,1))/(g.hx*g.hx);
+     d2udy2 = (u(i,j+1,1)-two*u(i,j,1)+u(i,j-1,1))/(g.hy*g.hy);
 
-     dvdx = (u(i+1,j,2)-u(i-1,j,2))/(two*dx); //v velocity derivatives
-     dvdy = (u(i,j+1,2)-u(i,j-1,2))/(two*dy);
+     dvdx = (u(i+1,j,2)-u(i-1,j,2))/(two*g.hx); //v velocity derivatives
+     dvdy = (u(i,j+1,2)-u(i,j-1,2))/(two*g.hy);
 
-     d2vdx2 = (u(i+1,j,2)-two*u(i,j,2)+u(i-1,j,2))/(dx*dx);
-     d2vdy2 = (u(i,j+1,2)-two*u(i,j,2)+u(i,j-1,2))/(dy*dy);
+     d2vdx2 = (u(i+1,j,2)-two*u(i,j,2)+u(i-1,j,2))/(g.hx*g.hx);
+     d2vdy2 = (u(i,j+1,2)-two*u(i,j,2)+u(i,j-1,2))/(g.hy*g.hy);
  
      // ----continuity equation----------
      double continuity_it_resid = (rho*dudx) + (rho*dvdy) - viscx(i,j) - viscy(i,j) - s(i,j,0); //steady-state iterative residual for continuity equation
@@ -1167,14 +2345,14 @@ void SGS_backward_sweep( Array3& u, Array2& viscx, Array2& viscy, Array2& dt, Ar
      u(i,j,0) = u(i,j,0) - beta2*dt(i,j)*continuity_it_resid; //updates pressure value of node i,j
 
      // ----x-momentum equation----------
-     double xmomentum_it_resid = (rho*u(i,j,1)*dudx) + (rho*u(i,j,2)*dudy) + dpdx - (rmu*d2udx2) - (rmu*d2udy2) - s(i,j,1); //steady-state iterative residual for x-momentum equation
+     double xmomentum_it_resid = (rho*u(i,j,1)*dudx) + (rho*u(i,j,2)*dudy) + dpdx - (g.mu*d2udx2) - (g.mu*d2udy2) - s(i,j,1); //steady-state iterative residual for x-momentum equation
 
-     u(i,j,1) = u(i,j,1) - dt(i,j)*rhoinv*xmomentum_it_resid; //updates v-velocity value of node i,j
+     u(i,j,1) = u(i,j,1) - dt(i,j)*rhoinv*xmomentum_it_resid/visc_diag(g, dt(i,j)); //updates v-velocity value of node i,j
      
      // ----y-momentum equation---------- 
-     double ymomentum_it_resid = (rho*u(i,j,1)*dvdx) + (rho*u(i,j,2)*dvdy) + dpdy - (rmu*d2vdx2) - (rmu*d2vdy2) - s(i,j,2); //steady-state iterative residval for y-momentum equation
+     double ymomentum_it_resid = (rho*u(i,j,1)*dvdx) + (rho*u(i,j,2)*dvdy) + dpdy - (g.mu*d2vdx2) - (g.mu*d2vdy2) - s(i,j,2); //steady-state iterative residval for y-momentum equation
 
-     u(i,j,2) = u(i,j,2) - dt(i,j)*rhoinv*ymomentum_it_resid; //updates v-velocity value of node i,j
+     u(i,j,2) = u(i,j,2) - dt(i,j)*rhoinv*ymomentum_it_resid/visc_diag(g, dt(i,j)); //updates v-velocity value of node i,j
     }
   }
 
@@ -1188,18 +2366,30 @@ void SGS_backward_sweep( Array3& u, Array2& viscx, Array2& viscy, Array2& dt, Ar
 void point_Jacobi( Array3& u, Array3& uold, Array2& viscx, Array2& viscy, Array2& dt, Array3& s )
 {
     /* 
-    Uses global variable(s): two, three (not used), six (not used), half
-    Uses global variable(s): imax, jmax, ipgorder (not used), rho, rhoinv, dx, dy, rkappa,
-                        xmax (not used), xmin (not used), ymax (not used), ymin (not used), 
-                        rmu, vel2ref
+    Uses global variable(s): imax, maingrid
     Uses: uold, artviscx, artviscy, dt, s
     To Modify: u
     */
- 
-    double dpdx;        //First derivative of pressure w.r.t. x
-    double dudx;        //First derivative of x velocity w.r.t. x
-    double dvdx;        //First derivative of y velocity w.r.t. x
-    double dpdy;        //First derivative of pressure w.r.t. y
+    point_Jacobi_lines(maingrid, u, uold, viscx, viscy, dt, s, 1, imax-1);
+}
+
+/**************************************************************************/
+
+void point_Jacobi_lines( const GridGeometry& g, Array3& u, Array3& uold, Array2& viscx, Array2& viscy, Array2& dt, const Array3& s, int i0, int i1 )
+{
+    /* 
+    Uses global variable(s): two, three (not used), six (not used), half
+    Uses global variable(s): ipgorder (not used), rho, rhoinv, rkappa,
+                        xmax (not used), xmin (not used), ymax (not used), ymin (not used), 
+                        vel2ref
+    Uses: g (points, spacing, viscosity), uold, artviscx, artviscy, dt, s
+    To Modify: u (interior lines i0 <= i < i1)
+    */
+ 
+    double dpdx;        //First derivative of pressure w.r.t. x
+    double dudx;        //First derivative of x velocity w.r.t. x
+    double dvdx;        //First derivative of y velocity w.r.t. x
+    double dpdy;        //First derivative of pressure w.r.t. y
     double dudy;        //First derivative of x velocity w.r.t. y
     double dvdy;        //First derivative of y velocity w.r.t. y
     double d2udx2;      //Second derivative of x velocity w.r.t. x
@@ -1211,6 +2401,12 @@ void point_Jacobi( Array3& u, Array3& uold, Array2& viscx, Array2& viscy, Array2
 
     /* Point Jacobi method */
 
+    if(iflux==1)
+    {
+        point_Jacobi_faces(g, u, uold, viscx, viscy, dt, s, i0, i1);
+        return;
+    }
+
 
 /* !************************************************************** */
 /* !************ADD CODING HERE FOR INTRO CFD STUDENTS************ */
@@ -1219,22 +2415,22 @@ void point_Jacobi( Array3& u, Array3& uold, Array2& viscx, Array2& viscy, Array2
     int i;
     int j;
 
-for(int i=1; i<imax-1; i++){
-        for(j=1; j<jmax-1; j++){
-            dpdx = (uold(i+1,j,0)-uold(i-1,j,0))/(two*dx);
-            dpdy = (uold(i,j+1,0)-uold(i,j-1,0))/(two*dy);
+for(int i=i0; i<i1; i++){
+        for(j=1; j<g.nj-1; j++){
+            dpdx = (uold(i+1,j,0)-uold(i-1,j,0))/(two*g.hx);
+            dpdy = (uold(i,j+1,0)-uold(i,j-1,0))/(two*g.hy);
 
-            dudx = (uold(i+1,j,1)-uold(i-1,j,1))/(two*dx);
-            dudy = (uold(i,j+1,1)-uold(i,j-1,1))/(two*dy);
+            dudx = (uold(i+1,j,1)-uold(i-1,j,1))/(two*g.hx);
+            dudy = (uold(i,j+1,1)-uold(i,j-1,1))/(two*g.hy);
 
-            dvdx = (uold(i+1,j,2)-uold(i-1,j,2))/(two*dx);
-            dvdy = (uold(i,j+1,2)-uold(i,j-1,2))/(two*dy);
+            dvdx = (uold(i+1,j,2)-uold(i-1,j,2))/(two*g.hx);
+            dvdy = (uold(i,j+1,2)-uold(i,j-1,2))/(two*g.hy);
 
-            d2udx2 = (uold(i+1,j,1)-two*uold(i,j,1)+uold(i-1,j,1))/pow2(dx);
-            d2udy2 = (uold(i,j+1,1)-two*uold(i,j,1)+uold(i,j-1,1))/pow2(dy);
+            d2udx2 = (uold(i+1,j,1)-two*uold(i,j,1)+uold(i-1,j,1))/pow2(g.hx);
+            d2udy2 = (uold(i,j+1,1)-two*uold(i,j,1)+uold(i,j-1,1))/pow2(g.hy);
 
-            d2vdx2 = (uold(i+1,j,2)-two*uold(i,j,2)+uold(i-1,j,2))/pow2(dx);
-            d2vdy2 = (uold(i,j+1,2)-two*uold(i,j,2)+uold(i,j-1,2))/pow2(dy);
+            d2vdx2 = (uold(i+1,j,2)-two*uold(i,j,2)+uold(i-1,j,2))/pow2(g.hx);
+            d2vdy2 = (uold(i,j+1,2)-two*uold(i,j,2)+uold(i,j-1,2))/pow2(g.hy);
 
             uvel2 = pow2(u(i,j,1)) + pow2(u(i,j,2));
 
@@ -1242,9 +2438,9 @@ for(int i=1; i<imax-1; i++){
 
             u(i,j,0) = uold(i,j,0)- (beta2*dt(i,j)*((rho*dudx)+ (rho*dvdy)-viscx(i,j)-viscy(i,j)-s(i,j,0)));
 
-            u(i,j,1) = uold(i,j,1) - ((dt(i,j)*rhoinv)*((rho*uold(i,j,1)*dudx) + (rho*uold(i,j,2)*dudy) +(dpdx)-(rmu *d2udx2)-(rmu*d2udy2)-s(i,j,1)));
+            u(i,j,1) = uold(i,j,1) - ((dt(i,j)*rhoinv/visc_diag(g, dt(i,j)))*((rho*uold(i,j,1)*dudx) + (rho*uold(i,j,2)*dudy) +(dpdx)-(g.mu *d2udx2)-(g.mu*d2udy2)-s(i,j,1)));
 
-            u(i,j,2) = uold(i,j,2) - ((dt(i,j)*rhoinv)*((rho*uold(i,j,1)*dvdx) + (rho*uold(i,j,2)*dvdy) +(dpdy)-(rmu *d2vdx2)-(rmu*d2vdy2)-s(i,j,2)));
+            u(i,j,2) = uold(i,j,2) - ((dt(i,j)*rhoinv/visc_diag(g, dt(i,j)))*((rho*uold(i,j,1)*dvdx) + (rho*uold(i,j,2)*dvdy) +(dpdy)-(g.mu *d2vdx2)-(g.mu*d2vdy2)-s(i,j,2)));
 
             //cout<< "p="<< u(i,j,0)<<endl;
             //cout<< "u="<< u(i,j,1)<<endl;
@@ -1260,36 +2456,54 @@ for(int i=1; i<imax-1; i++){
 
 /**************************************************************************/
 
-void pressure_rescaling( Array3& u )
+void pressure_rescaling( const GridGeometry& g, Array3& u )
 {
     /* 
-    Uses global variable(s): imax, jmax, imms, xmax, xmin, ymax, ymin, rlength, pinf
-    To Modify: u
+    Uses global variable(s): neq, stat_accumulate
+    Uses: g (points, pinned pressure; the statistics are those of the imax x jmax run)
+    To Modify: u, running statistics (when stat_accumulate = 1)
     */
 
     int iref;                     /* i index location of pressure rescaling point */
     int jref;                     /* j index location of pressure rescaling point */
 
-    double x;               /* Temporary variable for x location */
-    double y;               /* Temporary variable for y location */  
     double deltap;          /* delta_pressure for rescaling all values */
 
-    iref = (imax-1)/2;     /* Set reference pressure to center of cavity */
-    jref = (jmax-1)/2;
-    if(imms==1)
-    {
-        x = (xmax - xmin)*(double)(iref)/(double)(imax - 1);
-        y = (ymax - ymin)*(double)(jref)/(double)(jmax - 1);
-        deltap = u(iref,jref,0) - umms(x,y,0); /* Constant in MMS */
-    }
-    else
+    iref = (g.ni-1)/2;     /* Set reference pressure to center of cavity */
+    jref = (g.nj-1)/2;
+    deltap = u(iref,jref,0) - g.in->pref;   /* MMS pressure or pinf at the center */
+
+    if(stat_accumulate==1)
     {
-        deltap = u(iref,jref,0) - pinf; /* Reference pressure */
+        /* Fused with the rescaling pass: Welford update of mean/M2 plus min/max */
+        double delta;           /* Deviation from the previous mean */
+        double val;             /* Sampled value */
+        double rn;              /* 1/(number of samples) */
+
+        nstat++;
+        rn = 1.0/(double)(nstat);
+        for(int i=0; i<g.ni; i++)
+        {
+            for(int j=0; j<g.nj; j++)
+            {
+                u(i,j,0) -= deltap;
+                for(int k=0; k<neq; k++)
+                {
+                    val = u(i,j,k);
+                    delta = val - (*stat_mean)(i,j,k);
+                    (*stat_mean)(i,j,k) += delta*rn;
+                    (*stat_m2)(i,j,k) += delta*(val - (*stat_mean)(i,j,k));
+                    (*stat_min)(i,j,k) = (nstat==1) ? val : fmin((*stat_min)(i,j,k), val);
+                    (*stat_max)(i,j,k) = (nstat==1) ? val : fmax((*stat_max)(i,j,k), val);
+                }
+            }
+        }
+        return;
     }
 
-    for(int i=0; i<imax; i++)
+    for(int i=0; i<g.ni; i++)
     {
-        for(int j=0; j<jmax; j++)
+        for(int j=0; j<g.nj; j++)
         {
             u(i,j,0) -= deltap;
         }
@@ -1302,8 +2516,8 @@ void check_iterative_convergence(int n, Array3& u, Array3& uold, Array2& dt, dou
 {
   /* 
   Uses global variable(s): zero
-  Uses global variable(s): imax, jmax, neq, fsmall (not used)
-  Uses: n, u, uold, dt, res, resinit, ninit, rtime, dtmin
+  Uses global variable(s): imax, jmax, neq, fsmall (not used), iengine, maingrid
+  Uses: n, u, uold, dt, res, resinit, ninit, rtime, dtmin, dc_r (iengine = 3)
   To modify: conv
   */
 
@@ -1317,19 +2531,60 @@ void check_iterative_convergence(int n, Array3& u, Array3& uold, Array2& dt, dou
     res[1] = zero;
     res[2] = zero;
 
+    /* Defect correction: norms of the full residual of the last outer iteration */
+    if(iengine==3)
+    {
+        for(i=1; i<imax-1; i++)
+        {
+            for(j=1; j<jmax-1; j++)
+            {
+                for(k=0; k<neq; k++)
+                {
+                    res[k] += pow2((*dc_r)(i,j,k));
+                }
+            }
+        }
+        for(k=0; k<neq; k++)
+        {
+            res[k] = sqrt(res[k]/double(imax*jmax));
+        }
+        report_iterative_convergence(n, res, resinit, ninit, rtime, dtmin, conv);
+        return;
+    }
+
+    iterative_residual_norms(maingrid, u, uold, dt, res);
+    report_iterative_convergence(n, res, resinit, ninit, rtime, dtmin, conv);
+}
+
+/**************************************************************************/
+
+void iterative_residual_norms( const GridGeometry& g, Array3& u, Array3& uold, Array2& dt, double res[neq] )
+{
+  /* 
+  Uses global variable(s): zero, neq, rho, rhoinv, rkappa, uinf, ivisc
+  Uses: g (points, spacing, viscosity), u, uold, dt
+  To modify: res (L2 norms of the iterative residuals, recovered from the change over the
+  iteration; shared by the imax x jmax run and the CavityGrid drivers)
+  */
+
+  int i;                       /* i index (x direction) */
+  int j;                       /* j index (y direction) */
+  int k;                       /* k index (# of equations) */
+
   double beta2;
   double uvel2;
 
   double local_resid = 0.0; /*Stores sum of all res[0]*/
-  
 
-  double L2Norminit =0; /*To Calculate initial L2norm*/
+    res[0] = zero;              //Reset to zero (as they are sums)
+    res[1] = zero;
+    res[2] = zero;
 
 /* !************************************************************** */
 /* !************ADD CODING HERE FOR INTRO CFD STUDENTS************ */
 /* !************************************************************** */
-   for(i=1; i<imax-1; i++){
-        for(j=1; j<jmax-1; j++){
+   for(i=1; i<g.ni-1; i++){
+        for(j=1; j<g.nj-1; j++){
             for (k=0; k<neq; k++){
                
                /* cout<<"Pressure: "<<"new:"<<u(i,j,0)<<"\t"<<"old:"<<uold(i,j,0)<<endl;
@@ -1349,11 +2604,11 @@ void check_iterative_convergence(int n, Array3& u, Array3& uold, Array2& dt, dou
             //        cout<<"local continuity residual: "<<res[k]<<endl;
 
                 }else if (k==1){ //x-momentum equation
-                    local_resid = -rho*(u(i,j,1)-uold(i,j,1)) / dt(i,j); 
+                    local_resid = -rho*(u(i,j,1)-uold(i,j,1))*visc_diag(g, dt(i,j)) / dt(i,j); 
           //          cout<<"local x-momentum residual: "<<res[k]<<endl;
 
                 }else if (k==2){ //y-momentum equation
-                    local_resid = -rho*(u(i,j,2)-uold(i,j,2)) / dt(i,j); 
+                    local_resid = -rho*(u(i,j,2)-uold(i,j,2))*visc_diag(g, dt(i,j)) / dt(i,j); 
         //            cout<<"local y-momentum residual: "<<res[k]<<endl;
                 }
                 res[k] += pow2(fabs(local_resid));
@@ -1364,18 +2619,61 @@ void check_iterative_convergence(int n, Array3& u, Array3& uold, Array2& dt, dou
         }
 
         //Norms of each equation
-	res[0] = sqrt(res[0]/ double(imax*jmax)); //continuity norm
-        res[1] = sqrt(res[1]/ double(imax*jmax)); //x-momentum norm
-        res[2] = sqrt(res[2]/ double(imax*jmax)); //y-momentum norm
+	res[0] = sqrt(res[0]/ double(g.ni*g.nj)); //continuity norm
+        res[1] = sqrt(res[1]/ double(g.ni*g.nj)); //x-momentum norm
+        res[2] = sqrt(res[2]/ double(g.ni*g.nj)); //y-momentum norm
 
         //cout<<"Continuity iterative residual L2 norm: "<<norm_continuity<<endl;
         //cout<<"X-Momentum iterative residual L2 norm: "<<norm_xmomentum<<endl;
         //cout<<"Y-Momentum iterative residual L2 norm: "<<norm_ymomentum<<endl;
+}
+
+/**************************************************************************/
+
+double convergence_measure( const GridGeometry& g, double res[neq], double resinit[neq] )
+{
+  /* 
+  Uses global variable(s): neq
+  Uses: g (points), res, resinit
+  Returns: the convergence measure, the largest residual norm over the initial continuity
+  norm sqrt(resinit[0]^2/(ni*nj)); NaN if any norm is NaN
+  */
+
+  double L2Norminit = sqrt(pow2(resinit[0])/(g.ni*g.nj));   /* Initial L2 norm */
+  double conv = fmax(res[0],fmax(res[1],res[2])) / L2Norminit;
+
+    for(int k=0; k<neq; k++)
+    {
+        if(res[k]!=res[k])
+        {
+            conv = res[k];      /* fmax drops NaN: keep it visible to the stopping tests */
+        }
+    }
+    return conv;
+}
+
+/**************************************************************************/
+
+void report_iterative_convergence(int n, double res[neq], double resinit[neq], int ninit, double rtime, double dtmin, double& conv)
+{
+  /* 
+  Uses global variable(s): imax, jmax, residualOut, maingrid
+  Uses: n, res, resinit, ninit, rtime, dtmin
+  To modify: conv
+  Convergence measure from the residual norms ('convergence_measure'), plus the residual history output
+  */
+
+  double L2Norminit =0; /*To Calculate initial L2norm*/
 
         L2Norminit = sqrt(pow2(resinit[0])/(imax*jmax));
 
         cout<<"L2Norminit: "<<L2Norminit<<endl;
-        conv = fmax(res[0],fmax(res[1],res[2])) / L2Norminit; /*L2 Norms ratio*/
+        conv = convergence_measure(maingrid, res, resinit); /*L2 Norms ratio*/
+
+        if(isubcycle==1)
+        {
+            nsubcycle = subcycle_count(res);
+        }
 
         cout<<"conv: "<<conv<<endl;
   
@@ -1383,7 +2681,7 @@ void check_iterative_convergence(int n, Array3& u, Array3& uold, Array2& dt, dou
     /* Write iterative residuals every "residualOut" iterations */
     if( ((n%residualOut)==0)||(n==ninit) )
     {
-        fprintf(fp1, "%d %e %e %e %e\n",n, rtime, res[0], res[1], res[2] );
+        write_history(n, rtime, res);
         printf("%d   %e   %e   %e   %e   %e\n",n, rtime, dtmin, res[0], res[1], res[2] );    
 
         /* Write header for iterative residuals every 20 residual printouts */
@@ -1435,6 +2733,9 @@ void Discretization_Error_Norms( Array3& u )
         rL1norm[k] = 0.0;
         rL2norm[k] = 0.0;
         rLinfnorm[k] = 0.0;
+        rL1[k] = 0.0;
+        rL2[k] = 0.0;
+        rLinf[k] = 0.0;
       }
 
       for(int i=1; i<imax-1; i++)
@@ -1473,147 +2774,5636 @@ void Discretization_Error_Norms( Array3& u )
    cout<<"Y-Momentum DE Norms:\n"<<endl;cout<<"L1Norm: "<<rL1norm[2]<<" L2Norm: "<<rL2norm[2]<<" LinfNorm: "<<rLinfnorm[2]<<endl;
 }
 
-/********************************************************************************************************************/
-/*                                                                                                                  */
-/*                                                End Functions                                                     */
-/*                                                                                                                  */
-/********************************************************************************************************************/
+/**************************************************************************/
 
+void lbm_initialize( Array3& u )
+{
+    /* 
+    Uses global variable(s): fourth, half, one, three, imax, jmax, imms, uinf, ulb, rho, pinf, Re, dx, dy
+    Uses: u (initial/restart solution, boundary conditions already set)
+    To modify: lbm_f, lbm_m, lbm_s, lbm_omp, lbm_omm, lbm_dt, lbm_pscale
+    */
+    int i;                       /* i index (x direction) */
+    int j;                       /* j index (y direction) */
+    int q;                       /* q index (lattice direction) */
+
+    int nx = imax - 1;           /* Number of lattice cells in x */
+    int ny = jmax - 1;           /* Number of lattice cells in y */
+
+    double x;                    /* Temporary variable for x location (cell center) */
+    double y;                    /* Temporary variable for y location (cell center) */
+    double nulb;                 /* Lattice kinematic viscosity */
+    double taup;                 /* Symmetric relaxation time */
+    double taum;                 /* Antisymmetric relaxation time */
+    double vscale;               /* Lattice velocity per physical velocity */
+    double p;                    /* Cell pressure (N/m^2) */
+    double ux;                   /* Cell x velocity (lattice units) */
+    double uy;                   /* Cell y velocity (lattice units) */
+    double rhol;                 /* Cell density (lattice units) */
+    double cu;                   /* c_q . u */
+
+    if(dx!=dy)
+    {
+        printf("ERROR: the LBM engine needs dx = dy (square lattice cells)!\n");
+        exit (0);
+    }
 
+    /* Lattice units: the lid moves at ulb and the cavity is nx cells wide */
+    nulb = ulb*(double)(nx)/Re;
+    taup = three*nulb + half;
+    taum = half + (three/16.0)/(taup - half);   /* TRT magic parameter 3/16: viscosity independent wall location */
+    lbm_omp = one/taup;
+    lbm_omm = one/taum;
+    lbm_dt = dx*ulb/uinf;
+    vscale = ulb/uinf;
+    lbm_pscale = rho/(three*vscale*vscale);
+    printf("LBM D2Q9: %d x %d cells, tau = %f, lattice step = %e s\n", nx, ny, taup, lbm_dt);
+
+    lbm_f = new Array3(nx, ny, 9);
+    lbm_m = new Array3(nx, ny, 3);
+    lbm_s = new Array3(nx, ny, 3);
+    lbm_parity = 0;
+
+    /* Equilibrium populations from the node values averaged to cell centers */
+    for(i=0; i<nx; i++)
+    {
+        for(j=0; j<ny; j++)
+        {
+            p  = fourth*(u(i,j,0) + u(i+1,j,0) + u(i,j+1,0) + u(i+1,j+1,0));
+            ux = fourth*(u(i,j,1) + u(i+1,j,1) + u(i,j+1,1) + u(i+1,j+1,1))*vscale;
+            uy = fourth*(u(i,j,2) + u(i+1,j,2) + u(i,j+1,2) + u(i+1,j+1,2))*vscale;
+            rhol = one + (p - pinf)/lbm_pscale;
+            for(q=0; q<9; q++)
+            {
+                cu = (double)(lbm_cx[q])*ux + (double)(lbm_cy[q])*uy;
+                (*lbm_f)(i,j,q) = lbm_w[q]*(rhol + three*cu + 4.5*cu*cu - 1.5*(ux*ux + uy*uy));
+            }
+            (*lbm_m)(i,j,0) = rhol;
+            (*lbm_m)(i,j,1) = ux;
+            (*lbm_m)(i,j,2) = uy;
+
+            /* MMS sources evaluated at the cell center and converted to lattice units */
+            x = xmin + ((double)(i) + half)*dx;
+            y = ymin + ((double)(j) + half)*dy;
+            (*lbm_s)(i,j,0) = (double)(imms)*srcmms_mass(x,y)*lbm_dt/rho;
+            (*lbm_s)(i,j,1) = (double)(imms)*srcmms_xmtm(x,y)*lbm_dt*vscale/rho;
+            (*lbm_s)(i,j,2) = (double)(imms)*srcmms_ymtm(x,y)*lbm_dt*vscale/rho;
+        }
+    }
+}
 
+/**************************************************************************/
 
+void lbm_time_step( Array3&, Array2& dt, double& dtmin )
+{
+    /* 
+    Uses global variable(s): imax, jmax, lbm_dt
+    To Modify: dt, dtmin
+    */
+    int i;                      //i index (x direction)
+    int j;                      //j index (y direction)
 
+    /* The lattice step is fixed by dx, ulb and uinf (acoustic scaling) */
+    for(i=1; i<imax-1; i++)
+    {
+        for(j=1; j<jmax-1; j++)
+        {
+            dt(i,j) = lbm_dt;
+        }
+    }
+    dtmin = lbm_dt;
+}
 
+/**************************************************************************/
 
-/********************************************************************************************************************/
-/*                                                                                                                  */
-/*                                                Main Function                                                     */
-/*                                                                                                                  */
-/********************************************************************************************************************/
-int main()
+void lbm_wall_velocity( int i, int j, double& uwx, double& uwy )
 {
-    //Data class declarations: hold all the data needed across the entire grid
-    Array3 u     (imax, jmax, neq);     //u and uold store the current and previous primitive variable solution on the entire grid
-    Array3 uold  (imax, jmax, neq);
+    /* 
+    Uses global variable(s): zero, half, imax, jmax, imms, ulb, uinf, ulid, ilid, xmin, ymin, dx, dy
+    Inputs: i, j (index of the solid cell just across the wall)
+    To modify: uwx, uwy (wall velocity in lattice units)
+    */
+    int nx = imax - 1;          /* Number of lattice cells in x */
+    int ny = jmax - 1;          /* Number of lattice cells in y */
+    int ic;                     /* Fluid-side i index of the wall crossing */
+    int jc;                     /* Fluid-side j index of the wall crossing */
 
-    Array3 src   (imax, jmax, neq);     //src stores the source terms over the entire grid (used for MMS)
+    double x;                   /* Wall crossing x location */
+    double y;                   /* Wall crossing y location */
 
-    Array2 viscx (imax, jmax);          //Artificial viscosity, x and y directions
-    Array2 viscy (imax, jmax);
+    if(imms==1)
+    {
+        /* Wall crossing halfway between the solid cell and its fluid neighbor */
+        ic = (i<0) ? 0 : ((i>nx-1) ? nx-1 : i);
+        jc = (j<0) ? 0 : ((j>ny-1) ? ny-1 : j);
+        x = xmin + half*((double)(i + ic) + one)*dx;
+        y = ymin + half*((double)(j + jc) + one)*dy;
+        uwx = umms(x,y,1)*ulb/uinf;
+        uwy = umms(x,y,2)*ulb/uinf;
+    }
+    else
+    {
+        /* Only the lid moves; the lid corners belong to the stationary side walls (as in 'bndry') */
+        uwx = (j>ny-1 && i>=0 && i<=nx-1) ? ulb*ulid*lid_profile(xmin + ((double)(i) + half)*dx)/uinf : zero;
+        uwy = zero;
+    }
+}
 
-    Array2 dt    (imax, jmax);          //Local timestep array
+/**************************************************************************/
 
+void lbm_stream_collide( Array3& f, Array3& m, Array3& s, int parity )
+{
+    /* 
+    Uses global variable(s): half, one, three, imax, jmax, imms, lbm_cx, lbm_cy, lbm_opp, lbm_w, lbm_omp, lbm_omm
+    Uses: s, parity
+    To Modify: f, m
+    */
 
+    /* Fused stream-collide step with the AA access pattern (one population array, in place): */
+    /*   even step: read f_q from own slot q, collide, write to own slot opp(q)              */
+    /*   odd step:  read f_q from slot opp(q) of x-c_q, collide, write to slot q of x+c_q     */
+    /* Each memory location is read and written by the same cell, so cells are independent. */
+    /* Walls use halfway bounce-back with the moving-wall correction 6 w_q (c_q . u_w).      */
 
-    /* Minimum of iterative residual norms from three equations */
-    double conv;
-    double resTest;
-    int n = 0;  //Iteration number
+    int nx = imax - 1;          /* Number of lattice cells in x */
+    int ny = jmax - 1;          /* Number of lattice cells in y */
 
-                                                      
-    /*--------- Solution variables declaration ----------------------*/
-      
-     int ninit = 0;                 /* Initial iteration number (used for restart file) */
+#ifdef _OPENMP
+    #pragma omp parallel for schedule(static)
+#endif
+    for(int i=0; i<nx; i++)
+    {
+        double fin[9];          /* Incoming populations */
+        double fout[9];         /* Post-collision populations */
+        double feq[9];          /* Equilibrium populations */
+        double rhol;            /* Lattice density */
+        double ux;              /* Lattice x velocity */
+        double uy;              /* Lattice y velocity */
+        double fx;              /* Lattice x force */
+        double fy;              /* Lattice y force */
+        double smass;           /* Lattice mass source */
+        double cu;              /* c_q . u */
+        double usq;             /* u . u */
+        double fp;              /* Symmetric part of (f - feq) */
+        double fm;              /* Antisymmetric part of (f - feq) */
+        double uwx;             /* Wall x velocity */
+        double uwy;             /* Wall y velocity */
+        int ii;                 /* Neighbor i index */
+        int jj;                 /* Neighbor j index */
+        int q;                  /* Lattice direction */
+        int qb;                 /* Opposite lattice direction */
+
+        for(int j=0; j<ny; j++)
+        {
+            /* Stream (gather) */
+            for(q=0; q<9; q++)
+            {
+                if(parity==0)
+                {
+                    fin[q] = f(i,j,q);
+                }
+                else
+                {
+                    ii = i - lbm_cx[q];
+                    jj = j - lbm_cy[q];
+                    if(ii>=0 && ii<nx && jj>=0 && jj<ny)
+                    {
+                        fin[q] = f(ii,jj,lbm_opp[q]);
+                    }
+                    else
+                    {
+                        lbm_wall_velocity(ii, jj, uwx, uwy);
+                        fin[q] = f(i,j,q) + 6.0*lbm_w[q]*((double)(lbm_cx[q])*uwx + (double)(lbm_cy[q])*uwy);
+                    }
+                }
+            }
 
-     double res[neq];               /* Iterative residual for each equation */
-     double resinit[neq];           /* Initial iterative residual for each equation (from iteration 1) */
-     double rtime;                  /* Variable to estimate simulation time */
-     double dtmin = 1.0e99;         /* Minimum time step for a given iteration (initialized large) */
+            /* Moments (incompressible equilibrium, half-force velocity shift) */
+            fx = s(i,j,1);
+            fy = s(i,j,2);
+            smass = s(i,j,0);
+            rhol = fin[0] + fin[1] + fin[2] + fin[3] + fin[4] + fin[5] + fin[6] + fin[7] + fin[8];
+            ux = fin[1] - fin[3] + fin[5] - fin[6] - fin[7] + fin[8] + half*fx;
+            uy = fin[2] - fin[4] + fin[5] + fin[6] - fin[7] - fin[8] + half*fy;
+            usq = ux*ux + uy*uy;
 
-     double x;                      /* Temporary variable for x location */
-     double y;                      /* Temporary variable for y location */
+            for(q=0; q<9; q++)
+            {
+                cu = (double)(lbm_cx[q])*ux + (double)(lbm_cy[q])*uy;
+                feq[q] = lbm_w[q]*(rhol + three*cu + 4.5*cu*cu - 1.5*usq);
+            }
 
+            /* Collide (two-relaxation-time) */
+            for(q=0; q<9; q++)
+            {
+                qb = lbm_opp[q];
+                fp = half*((fin[q] + fin[qb]) - (feq[q] + feq[qb]));
+                fm = half*((fin[q] - fin[qb]) - (feq[q] - feq[qb]));
+                fout[q] = fin[q] - lbm_omp*fp - lbm_omm*fm;
+            }
+            if(imms==1)
+            {
+                for(q=0; q<9; q++)
+                {
+                    fout[q] += lbm_w[q]*(smass + three*((double)(lbm_cx[q])*fx + (double)(lbm_cy[q])*fy));
+                }
+            }
 
-    /*-------Set Function Pointers-----------------------------------*/
-    
-    iterationStepPointer     iterationStep;
-    boundaryConditionPointer set_boundary_conditions;
+            /* Stream (scatter) */
+            for(q=0; q<9; q++)
+            {
+                if(parity==0)
+                {
+                    f(i,j,lbm_opp[q]) = fout[q];
+                }
+                else
+                {
+                    ii = i + lbm_cx[q];
+                    jj = j + lbm_cy[q];
+                    if(ii>=0 && ii<nx && jj>=0 && jj<ny)
+                    {
+                        f(ii,jj,q) = fout[q];
+                    }
+                    else
+                    {
+                        lbm_wall_velocity(ii, jj, uwx, uwy);
+                        f(i,j,lbm_opp[q]) = fout[q] - 6.0*lbm_w[q]*((double)(lbm_cx[q])*uwx + (double)(lbm_cy[q])*uwy);
+                    }
+                }
+            }
 
-    if(isgs==1)                 /* ==Symmetric Gauss Seidel== */
-    {
-        iterationStep = &GS_iteration;
-    }
-    else if(isgs==0)             /* ==Point Jacobi== */
-    {
-        iterationStep = &PJ_iteration;
-    }
-    else
-    {
-        printf("ERROR: isgs must equal 0 or 1!\n");
-        exit (0);  
+            m(i,j,0) = rhol;
+            m(i,j,1) = ux;
+            m(i,j,2) = uy;
+        }
     }
-      
-    if(imms==0) 
+}
+
+/**************************************************************************/
+
+void lbm_to_nodes( Array3& m, Array3& u )
+{
+    /* 
+    Uses global variable(s): fourth, one, imax, jmax, uinf, ulb, pinf, lbm_pscale
+    Uses: m
+    To Modify: u (interior nodes only; boundary nodes are set by the boundary conditions)
+    */
+    int i;                       /* i index (x direction) */
+    int j;                       /* j index (y direction) */
+
+    double vscale = uinf/ulb;    /* Physical velocity per lattice velocity */
+
+    /* Interior nodes sit at the shared corner of four lattice cells */
+    for(i=1; i<imax-1; i++)
     {
-            set_boundary_conditions = &bndry;
-    }
-    else if(imms==1)
-        {
-            set_boundary_conditions = &bndrymms;
-        }
-        else
+        for(j=1; j<jmax-1; j++)
         {
-            printf("ERROR: imms must equal 0 or 1!\n");
-            exit (0);
+            u(i,j,0) = pinf + lbm_pscale*(fourth*(m(i-1,j-1,0) + m(i,j-1,0) + m(i-1,j,0) + m(i,j,0)) - one);
+            u(i,j,1) = vscale*fourth*(m(i-1,j-1,1) + m(i,j-1,1) + m(i-1,j,1) + m(i,j,1));
+            u(i,j,2) = vscale*fourth*(m(i-1,j-1,2) + m(i,j-1,2) + m(i-1,j,2) + m(i,j,2));
         }
+    }
+}
 
-    /*-------End Set Function Pointers-------------------------------*/
-
-    /* Debug output: Uncomment and modify if debugging */
-    //$$$$$$ fp6 = fopen("./Debug.dat","w");
-    //$$$$$$ fprintf(fp6,"TITLE = \"Debug Data Data\"\n");
-    //$$$$$$ fprintf(fp6,"variables=\"x(m)\"\"y(m)\"\"visc-x\"\"visc-y\"\n");
-    //$$$$$$ fprintf(fp6, "zone T=\"n=%d\"\n",n);
-    //$$$$$$ fprintf(fp6, "I= %d J= %d\n",imax, jmax);
-    //$$$$$$ fprintf(fp6, "DATAPACKING=POINT\n");
+/**************************************************************************/
 
-    /* Set derived input quantities */
-    set_derived_inputs();
+void LBM_iteration( boundaryConditionPointer set_boundary_conditions, Array3& u, Array3& uold, Array3&, Array2&, Array2&, Array2& )
+{
+    /* Copy u to uold (save previous flow values)*/
+    uold.copyData(u);
 
-    /* Set up headers for output files */
-    output_file_headers();
+    /* One fused stream-collide lattice step */
+    lbm_stream_collide(*lbm_f, *lbm_m, *lbm_s, lbm_parity);
+    lbm_parity = 1 - lbm_parity;
 
-    /* Set Initial Profile for u vector */
-    initial( ninit, rtime, resinit, u, src );   
+    /* Convert lattice moments to p, u, v at the nodes */
+    lbm_to_nodes(*lbm_m, u);
 
     /* Set Boundary Conditions for u */
-    set_boundary_conditions( u );
+    set_boundary_conditions(u);
+}
 
-    /* Write out inital conditions to solution file */
-    write_output(ninit, u, dt, resinit, rtime);
-     
-    /* Evaluate Source Terms Once at Beginning */
-    /*(only interior points; will be zero for standard cavity) */
-    compute_source_terms( src );
+/**************************************************************************/
 
-    /*========== Main Loop ==========*/
-    for (n = ninit; n<= nmax; n++)
+double mac_wall_value( double x, double y, int k )
+{
+    /* 
+    Uses global variable(s): zero, imms, ulid, ymax, ilid
+    Inputs: x, y (point on the cavity wall), k (= 1 for u, = 2 for v)
+    Returns: prescribed wall velocity
+    */
+    if(imms==1)
     {
-        /* Calculate time step */  
-        compute_time_step( u, dt, dtmin );
-           
-        /* Perform main iteration step (point jacobi or gauss seidel)*/    
-        iterationStep( set_boundary_conditions, u, uold, src, viscx, viscy, dt ); 
+        return umms(x,y,k);
+    }
+    if(k==1 && y>=ymax)
+    {
+        return ulid*lid_profile(x);      /* Lid */
+    }
+    return zero;
+}
 
-        /* Pressure Rescaling (based on center point) */
-        pressure_rescaling( u );
+/**************************************************************************/
 
-        /* Update the time */
+void mac_initialize( Array3& u )
+{
+    /* 
+    Uses global variable(s): half, fourth, imax, jmax, xmin, ymin, dx, dy, xmax, ymax
+    Uses: u (initial/restart solution, boundary conditions already set)
+    To modify: all mac_ arrays
+    */
+    int i;                       /* i index (x direction) */
+    int j;                       /* j index (y direction) */
+
+    int nx = imax - 1;           /* Number of pressure cells in x */
+    int ny = jmax - 1;           /* Number of pressure cells in y */
+
+    double y;                    /* Temporary variable for y location */
+    double x;                    /* Temporary variable for x location */
+
+    mac_u  = new Array2(nx+1, ny);
+    mac_v  = new Array2(nx, ny+1);
+    mac_us = new Array2(nx+1, ny);
+    mac_vs = new Array2(nx, ny+1);
+    mac_ucor = new Array2(nx+1, ny);
+    mac_vcor = new Array2(nx, ny+1);
+    mac_du = new Array2(nx+1, ny);
+    mac_dv = new Array2(nx, ny+1);
+    mac_au = new Array3(nx+1, ny, 6);
+    mac_av = new Array3(nx, ny+1, 6);
+    mac_p  = new Array2(nx, ny);
+    mac_pc = new Array2(nx, ny);
+    mac_b  = new Array2(nx, ny);
+    mac_ap = new Array3(nx, ny, 6);
+    mac_r  = new Array2(nx, ny);
+    mac_z  = new Array2(nx, ny);
+    mac_s  = new Array2(nx, ny);
+    mac_q  = new Array2(nx, ny);
+
+    /* Face velocities from the node values, cell pressures from the four corner nodes */
+    for(i=0; i<=nx; i++)
+    {
+        for(j=0; j<ny; j++)
+        {
+            (*mac_u)(i,j) = half*(u(i,j,1) + u(i,j+1,1));
+        }
+    }
+    for(i=0; i<nx; i++)
+    {
+        for(j=0; j<=ny; j++)
+        {
+            (*mac_v)(i,j) = half*(u(i,j,2) + u(i+1,j,2));
+        }
+    }
+    for(i=0; i<nx; i++)
+    {
+        for(j=0; j<ny; j++)
+        {
+            (*mac_p)(i,j) = fourth*(u(i,j,0) + u(i+1,j,0) + u(i,j+1,0) + u(i+1,j+1,0));
+        }
+    }
+
+    /* Wall-normal face velocities are fixed by the boundary conditions */
+    for(j=0; j<ny; j++)
+    {
+        y = ymin + ((double)(j) + half)*dy;
+        (*mac_u)(0,j)  = mac_wall_value(xmin, y, 1);
+        (*mac_u)(nx,j) = mac_wall_value(xmax, y, 1);
+    }
+    for(i=0; i<nx; i++)
+    {
+        x = xmin + ((double)(i) + half)*dx;
+        (*mac_v)(i,0)  = mac_wall_value(x, ymin, 2);
+        (*mac_v)(i,ny) = mac_wall_value(x, ymax, 2);
+    }
+    mac_us->copyData(*mac_u);
+    mac_vs->copyData(*mac_v);
+}
+
+/**************************************************************************/
+
+inline void mac_hybrid( double F, double D, double& aup, double& adown )
+{
+    /* Hybrid differencing coefficients for a face with mass flux F (in the +direction) */
+    /* and diffusion conductance D: aup = upstream (W/S) side, adown = downstream (E/N)  */
+    aup   = fmax(F, fmax(D + half*F, zero));
+    adown = fmax(-F, fmax(D - half*F, zero));
+}
+
+/**************************************************************************/
+
+void mac_momentum_coefficients( void )
+{
+    /* 
+    Uses global variable(s): zero, half, two, one, imax, jmax, imms, rho, rmu, dx, dy, xmin, ymin, alphau
+    Uses: mac_u, mac_v, mac_p
+    To modify: mac_au, mac_av (k: 0 = aP/alphau, 1 = aE, 2 = aW, 3 = aN, 4 = aS, 5 = b without pressure)
+    */
+    int i;                       /* i index (x direction) */
+    int j;                       /* j index (y direction) */
+
+    int nx = imax - 1;           /* Number of pressure cells in x */
+    int ny = jmax - 1;           /* Number of pressure cells in y */
+
+    double Fe, Fw, Fn, Fs;       /* Face mass fluxes */
+    double De, Dw, Dn, Ds;       /* Face diffusion conductances */
+    double aE, aW, aN, aS;       /* Neighbor coefficients */
+    double adum;                 /* Coefficient belonging to the neighboring control volume */
+    double ap;                   /* Central coefficient */
+    double b;                    /* Source */
+    double x;                    /* Temporary variable for x location */
+    double y;                    /* Temporary variable for y location */
+
+    Array2& U = *mac_u;
+    Array2& V = *mac_v;
+
+    /* x-momentum on the u control volumes (interior faces only) */
+    for(i=1; i<nx; i++)
+    {
+        for(j=0; j<ny; j++)
+        {
+            x = xmin + (double)(i)*dx;
+            y = ymin + ((double)(j) + half)*dy;
+
+            Fe = rho*half*(U(i,j) + U(i+1,j))*dy;
+            Fw = rho*half*(U(i-1,j) + U(i,j))*dy;
+            Fn = rho*half*(V(i-1,j+1) + V(i,j+1))*dx;
+            Fs = rho*half*(V(i-1,j) + V(i,j))*dx;
+            De = rmu*dy/dx;
+            Dw = De;
+            Dn = (j==ny-1) ? two*rmu*dx/dy : rmu*dx/dy;   /* Wall at half a cell */
+            Ds = (j==0)    ? two*rmu*dx/dy : rmu*dx/dy;
+
+            mac_hybrid(Fe, De, adum, aE);
+            mac_hybrid(Fw, Dw, aW, adum);
+            mac_hybrid(Fn, Dn, adum, aN);
+            mac_hybrid(Fs, Ds, aS, adum);
+
+            /* aP without the net outflow (Fe - Fw + Fn - Fs) gives the non-conservative */
+            /* convection u.grad(u) used by the MMS source terms (mass source is nonzero) */
+            ap = aE + aW + aN + aS;
+            b = (double)(imms)*srcmms_xmtm(x,y)*dx*dy;
+
+            /* Tangential wall values are known: move them to the source */
+            if(j==ny-1)
+            {
+                b += aN*mac_wall_value(x, ymax, 1);
+                aN = zero;
+            }
+            if(j==0)
+            {
+                b += aS*mac_wall_value(x, ymin, 1);
+                aS = zero;
+            }
+
+            (*mac_au)(i,j,0) = ap/alphau;
+            (*mac_au)(i,j,1) = aE;
+            (*mac_au)(i,j,2) = aW;
+            (*mac_au)(i,j,3) = aN;
+            (*mac_au)(i,j,4) = aS;
+            (*mac_au)(i,j,5) = b + (one - alphau)*(ap/alphau)*U(i,j);
+        }
+    }
+
+    /* y-momentum on the v control volumes (interior faces only) */
+    for(i=0; i<nx; i++)
+    {
+        for(j=1; j<ny; j++)
+        {
+            x = xmin + ((double)(i) + half)*dx;
+            y = ymin + (double)(j)*dy;
+
+            Fe = rho*half*(U(i+1,j-1) + U(i+1,j))*dy;
+            Fw = rho*half*(U(i,j-1) + U(i,j))*dy;
+            Fn = rho*half*(V(i,j) + V(i,j+1))*dx;
+            Fs = rho*half*(V(i,j-1) + V(i,j))*dx;
+            De = (i==nx-1) ? two*rmu*dy/dx : rmu*dy/dx;   /* Wall at half a cell */
+            Dw = (i==0)    ? two*rmu*dy/dx : rmu*dy/dx;
+            Dn = rmu*dx/dy;
+            Ds = Dn;
+
+            mac_hybrid(Fe, De, adum, aE);
+            mac_hybrid(Fw, Dw, aW, adum);
+            mac_hybrid(Fn, Dn, adum, aN);
+            mac_hybrid(Fs, Ds, aS, adum);
+
+            ap = aE + aW + aN + aS;
+            b = (double)(imms)*srcmms_ymtm(x,y)*dx*dy;
+
+            if(i==nx-1)
+            {
+                b += aE*mac_wall_value(xmax, y, 2);
+                aE = zero;
+            }
+            if(i==0)
+            {
+                b += aW*mac_wall_value(xmin, y, 2);
+                aW = zero;
+            }
+
+            (*mac_av)(i,j,0) = ap/alphau;
+            (*mac_av)(i,j,1) = aE;
+            (*mac_av)(i,j,2) = aW;
+            (*mac_av)(i,j,3) = aN;
+            (*mac_av)(i,j,4) = aS;
+            (*mac_av)(i,j,5) = b + (one - alphau)*(ap/alphau)*V(i,j);
+        }
+    }
+}
+
+/**************************************************************************/
+
+void mac_momentum_solve( int nsweep )
+{
+    /* 
+    Uses global variable(s): imax, jmax, dx, dy
+    Uses: mac_au, mac_av, mac_p
+    To modify: mac_u, mac_v (now hold the predicted velocities u*, v*)
+    */
+    int i;                       /* i index (x direction) */
+    int j;                       /* j index (y direction) */
+    int m;                       /* Sweep counter */
+
+    int nx = imax - 1;           /* Number of pressure cells in x */
+    int ny = jmax - 1;           /* Number of pressure cells in y */
+
+    Array2& U = *mac_u;
+    Array2& V = *mac_v;
+    Array2& P = *mac_p;
+    Array3& au = *mac_au;
+    Array3& av = *mac_av;
+
+    /* Symmetric Gauss-Seidel sweeps on the linearized momentum equations */
+    for(m=0; m<nsweep; m++)
+    {
+        for(j=0; j<ny; j++)
+        {
+            for(i=1; i<nx; i++)
+            {
+                U(i,j) = ( au(i,j,1)*U(i+1,j) + au(i,j,2)*U(i-1,j)
+                         + ((j<ny-1) ? au(i,j,3)*U(i,j+1) : zero) + ((j>0) ? au(i,j,4)*U(i,j-1) : zero)
+                         + au(i,j,5) + (P(i-1,j) - P(i,j))*dy )/au(i,j,0);
+            }
+        }
+        for(j=ny-1; j>=0; j--)
+        {
+            for(i=nx-1; i>0; i--)
+            {
+                U(i,j) = ( au(i,j,1)*U(i+1,j) + au(i,j,2)*U(i-1,j)
+                         + ((j<ny-1) ? au(i,j,3)*U(i,j+1) : zero) + ((j>0) ? au(i,j,4)*U(i,j-1) : zero)
+                         + au(i,j,5) + (P(i-1,j) - P(i,j))*dy )/au(i,j,0);
+            }
+        }
+        for(j=1; j<ny; j++)
+        {
+            for(i=0; i<nx; i++)
+            {
+                V(i,j) = ( ((i<nx-1) ? av(i,j,1)*V(i+1,j) : zero) + ((i>0) ? av(i,j,2)*V(i-1,j) : zero)
+                         + av(i,j,3)*V(i,j+1) + av(i,j,4)*V(i,j-1)
+                         + av(i,j,5) + (P(i,j-1) - P(i,j))*dx )/av(i,j,0);
+            }
+        }
+        for(j=ny-1; j>0; j--)
+        {
+            for(i=nx-1; i>=0; i--)
+            {
+                V(i,j) = ( ((i<nx-1) ? av(i,j,1)*V(i+1,j) : zero) + ((i>0) ? av(i,j,2)*V(i-1,j) : zero)
+                         + av(i,j,3)*V(i,j+1) + av(i,j,4)*V(i,j-1)
+                         + av(i,j,5) + (P(i,j-1) - P(i,j))*dx )/av(i,j,0);
+            }
+        }
+    }
+}
+
+/**************************************************************************/
+
+void mac_pressure_coefficients( void )
+{
+    /* 
+    Uses global variable(s): zero, imax, jmax, ipcorr, rho, dx, dy
+    Uses: mac_au, mac_av
+    To modify: mac_du, mac_dv, mac_ap (k: 0 = aP, 1 = aE, 2 = aW, 3 = aN, 4 = aS)
+    */
+    int i;                       /* i index (x direction) */
+    int j;                       /* j index (y direction) */
+    int k;                       /* k index (coefficient) */
+
+    int nx = imax - 1;           /* Number of pressure cells in x */
+    int ny = jmax - 1;           /* Number of pressure cells in y */
+
+    double asum;                 /* Sum of neighbor coefficients (SIMPLEC) */
+
+    Array3& au = *mac_au;
+    Array3& av = *mac_av;
+    Array2& du = *mac_du;
+    Array2& dv = *mac_dv;
+
+    /* Velocity correction coefficients: d = A/aP (SIMPLE, PISO), d = A/(aP - sum anb) (SIMPLEC) */
+    /* With aP = aP0/alphau, aP - sum anb >= (1/alphau - 1) aP0 stays positive only for alphau < 1 (checked in main) */
+    for(i=0; i<=nx; i++)
+    {
+        for(j=0; j<ny; j++)
+        {
+            du(i,j) = zero;
+            if(i>0 && i<nx)
+            {
+                asum = (ipcorr==1) ? au(i,j,1) + au(i,j,2) + au(i,j,3) + au(i,j,4) : zero;
+                du(i,j) = dy/(au(i,j,0) - asum);
+            }
+        }
+    }
+    for(i=0; i<nx; i++)
+    {
+        for(j=0; j<=ny; j++)
+        {
+            dv(i,j) = zero;
+            if(j>0 && j<ny)
+            {
+                asum = (ipcorr==1) ? av(i,j,1) + av(i,j,2) + av(i,j,3) + av(i,j,4) : zero;
+                dv(i,j) = dx/(av(i,j,0) - asum);
+            }
+        }
+    }
+
+    /* Pressure-correction (Poisson-like) coefficients; wall faces have d = 0 */
+    for(i=0; i<nx; i++)
+    {
+        for(j=0; j<ny; j++)
+        {
+            (*mac_ap)(i,j,1) = rho*du(i+1,j)*dy;
+            (*mac_ap)(i,j,2) = rho*du(i,j)*dy;
+            (*mac_ap)(i,j,3) = rho*dv(i,j+1)*dx;
+            (*mac_ap)(i,j,4) = rho*dv(i,j)*dx;
+            (*mac_ap)(i,j,0) = zero;
+            for(k=1; k<5; k++)
+            {
+                (*mac_ap)(i,j,0) += (*mac_ap)(i,j,k);
+            }
+        }
+    }
+}
+
+/**************************************************************************/
+
+void mac_apply_pressure_operator( Array2& x, Array2& y )
+{
+    /* 
+    Uses global variable(s): zero, imax, jmax
+    Uses: mac_ap, x
+    To modify: y = A x (A = pressure-correction matrix)
+    */
+    int nx = imax - 1;           /* Number of pressure cells in x */
+    int ny = jmax - 1;           /* Number of pressure cells in y */
+
+    Array3& ap = *mac_ap;
+
+    for(int i=0; i<nx; i++)
+    {
+        for(int j=0; j<ny; j++)
+        {
+            y(i,j) = ap(i,j,0)*x(i,j)
+                   - ((i<nx-1) ? ap(i,j,1)*x(i+1,j) : zero) - ((i>0) ? ap(i,j,2)*x(i-1,j) : zero)
+                   - ((j<ny-1) ? ap(i,j,3)*x(i,j+1) : zero) - ((j>0) ? ap(i,j,4)*x(i,j-1) : zero);
+        }
+    }
+}
+
+/**************************************************************************/
+
+int mac_pressure_solve( Array2& b, Array2& pc )
+{
+    /* 
+    Uses global variable(s): zero, fsmall, imax, jmax, pcgtol
+    Uses: mac_ap, b (mass imbalance source)
+    To modify: pc (pressure correction), b (mean removed)
+    Returns: number of conjugate gradient iterations
+    */
+    int i;                       /* i index (x direction) */
+    int j;                       /* j index (y direction) */
+    int it;                      /* CG iteration */
+
+    int nx = imax - 1;           /* Number of pressure cells in x */
+    int ny = jmax - 1;           /* Number of pressure cells in y */
+    int itmax = 4*nx*ny;         /* Safety limit on CG iterations */
+
+    double bmean = zero;         /* Mean of the source (the Neumann problem is singular) */
+    double rz;                   /* r . z */
+    double rzold;                /* Previous r . z */
+    double alpha;                /* CG step length */
+    double beta;                 /* CG direction update */
+    double sq;                   /* s . q */
+    double rnorm0 = zero;        /* Initial residual norm */
+    double rnorm;                /* Residual norm */
+
+    Array3& ap = *mac_ap;
+    Array2& r = *mac_r;
+    Array2& z = *mac_z;
+    Array2& s = *mac_s;
+    Array2& q = *mac_q;
+
+    /* Jacobi-preconditioned conjugate gradient with a compatible (zero-mean) source */
+    for(i=0; i<nx; i++)
+    {
+        for(j=0; j<ny; j++)
+        {
+            bmean += b(i,j);
+        }
+    }
+    bmean /= (double)(nx*ny);
+
+    rz = zero;
+    for(i=0; i<nx; i++)
+    {
+        for(j=0; j<ny; j++)
+        {
+            b(i,j) -= bmean;
+            pc(i,j) = zero;
+            r(i,j) = b(i,j);
+            z(i,j) = r(i,j)/ap(i,j,0);
+            s(i,j) = z(i,j);
+            rz += r(i,j)*z(i,j);
+            rnorm0 += r(i,j)*r(i,j);
+        }
+    }
+    rnorm0 = sqrt(rnorm0);
+
+    for(it=0; it<itmax; it++)
+    {
+        mac_apply_pressure_operator(s, q);
+        sq = zero;
+        for(i=0; i<nx; i++)
+        {
+            for(j=0; j<ny; j++)
+            {
+                sq += s(i,j)*q(i,j);
+            }
+        }
+        if(fabs(sq)<fsmall)
+        {
+            break;
+        }
+        alpha = rz/sq;
+        rzold = rz;
+        rz = zero;
+        rnorm = zero;
+        for(i=0; i<nx; i++)
+        {
+            for(j=0; j<ny; j++)
+            {
+                pc(i,j) += alpha*s(i,j);
+                r(i,j) -= alpha*q(i,j);
+                z(i,j) = r(i,j)/ap(i,j,0);
+                rz += r(i,j)*z(i,j);
+                rnorm += r(i,j)*r(i,j);
+            }
+        }
+        if(sqrt(rnorm)<=pcgtol*rnorm0)
+        {
+            return it+1;
+        }
+        beta = rz/rzold;
+        for(i=0; i<nx; i++)
+        {
+            for(j=0; j<ny; j++)
+            {
+                s(i,j) = z(i,j) + beta*s(i,j);
+            }
+        }
+    }
+    return it;
+}
+
+/**************************************************************************/
+
+void mac_mass_imbalance( Array2& U, Array2& V, Array2& b )
+{
+    /* 
+    Uses global variable(s): imax, jmax, imms, rho, dx, dy, xmin, ymin, half
+    Uses: U, V (face velocities)
+    To modify: b (= mass source - net mass outflow, per cell)
+    */
+    int nx = imax - 1;           /* Number of pressure cells in x */
+    int ny = jmax - 1;           /* Number of pressure cells in y */
+
+    double x;                    /* Temporary variable for x location */
+    double y;                    /* Temporary variable for y location */
+
+    for(int i=0; i<nx; i++)
+    {
+        for(int j=0; j<ny; j++)
+        {
+            x = xmin + ((double)(i) + half)*dx;
+            y = ymin + ((double)(j) + half)*dy;
+            b(i,j) = (double)(imms)*srcmms_mass(x,y)*dx*dy
+                   - rho*((U(i+1,j) - U(i,j))*dy + (V(i,j+1) - V(i,j))*dx);
+        }
+    }
+}
+
+/**************************************************************************/
+
+void mac_correct_velocity( Array2& pc )
+{
+    /* 
+    Uses global variable(s): imax, jmax
+    Uses: mac_du, mac_dv, pc
+    To modify: mac_u, mac_v (interior faces)
+    */
+    int nx = imax - 1;           /* Number of pressure cells in x */
+    int ny = jmax - 1;           /* Number of pressure cells in y */
+
+    for(int i=1; i<nx; i++)
+    {
+        for(int j=0; j<ny; j++)
+        {
+            (*mac_u)(i,j) += (*mac_du)(i,j)*(pc(i-1,j) - pc(i,j));
+        }
+    }
+    for(int i=0; i<nx; i++)
+    {
+        for(int j=1; j<ny; j++)
+        {
+            (*mac_v)(i,j) += (*mac_dv)(i,j)*(pc(i,j-1) - pc(i,j));
+        }
+    }
+}
+
+/**************************************************************************/
+
+void mac_piso_neighbor_correction( void )
+{
+    /* 
+    Uses global variable(s): zero, imax, jmax
+    Uses: mac_au, mac_av, mac_u, mac_v (after first correction), mac_us, mac_vs (predicted)
+    To modify: mac_us, mac_vs (now hold the neighbor correction sum(anb u'nb)/aP), mac_ucor, mac_vcor
+    */
+    int i;                       /* i index (x direction) */
+    int j;                       /* j index (y direction) */
+
+    int nx = imax - 1;           /* Number of pressure cells in x */
+    int ny = jmax - 1;           /* Number of pressure cells in y */
+
+    Array2& U = *mac_u;
+    Array2& V = *mac_v;
+    Array2& Us = *mac_us;
+    Array2& Vs = *mac_vs;
+    Array3& au = *mac_au;
+    Array3& av = *mac_av;
+    Array2& ucor = *mac_ucor;
+    Array2& vcor = *mac_vcor;
+
+    /* First convert the predictor into the first velocity correction u' = u** - u* */
+    for(i=0; i<=nx; i++)
+    {
+        for(j=0; j<ny; j++)
+        {
+            Us(i,j) = U(i,j) - Us(i,j);
+        }
+    }
+    for(i=0; i<nx; i++)
+    {
+        for(j=0; j<=ny; j++)
+        {
+            Vs(i,j) = V(i,j) - Vs(i,j);
+        }
+    }
+
+    /* Then the neighbor contribution dropped by the first corrector (Jacobi-style, from u') */
+    for(i=0; i<=nx; i++)
+    {
+        for(j=0; j<ny; j++)
+        {
+            ucor(i,j) = zero;
+            if(i>0 && i<nx)
+            {
+                ucor(i,j) = ( au(i,j,1)*Us(i+1,j) + au(i,j,2)*Us(i-1,j)
+                            + ((j<ny-1) ? au(i,j,3)*Us(i,j+1) : zero) + ((j>0) ? au(i,j,4)*Us(i,j-1) : zero) )/au(i,j,0);
+            }
+        }
+    }
+    for(i=0; i<nx; i++)
+    {
+        for(j=0; j<=ny; j++)
+        {
+            vcor(i,j) = zero;
+            if(j>0 && j<ny)
+            {
+                vcor(i,j) = ( ((i<nx-1) ? av(i,j,1)*Vs(i+1,j) : zero) + ((i>0) ? av(i,j,2)*Vs(i-1,j) : zero)
+                            + av(i,j,3)*Vs(i,j+1) + av(i,j,4)*Vs(i,j-1) )/av(i,j,0);
+            }
+        }
+    }
+    Us.copyData(ucor);
+    Vs.copyData(vcor);
+}
+
+/**************************************************************************/
+
+void mac_to_nodes( Array3& u )
+{
+    /* 
+    Uses global variable(s): half, fourth, imax, jmax
+    Uses: mac_u, mac_v, mac_p
+    To Modify: u (interior nodes only; boundary nodes are set by the boundary conditions)
+    */
+    for(int i=1; i<imax-1; i++)
+    {
+        for(int j=1; j<jmax-1; j++)
+        {
+            u(i,j,0) = fourth*((*mac_p)(i-1,j-1) + (*mac_p)(i,j-1) + (*mac_p)(i-1,j) + (*mac_p)(i,j));
+            u(i,j,1) = half*((*mac_u)(i,j-1) + (*mac_u)(i,j));
+            u(i,j,2) = half*((*mac_v)(i-1,j) + (*mac_v)(i,j));
+        }
+    }
+}
+
+/**************************************************************************/
+
+void SIMPLE_iteration( boundaryConditionPointer set_boundary_conditions, Array3& u, Array3& uold, Array3&, Array2&, Array2&, Array2& )
+{
+    /* 
+    Uses global variable(s): imax, jmax, ipcorr, alphap, one
+    Uses: mac_b (pressure-correction right-hand side)
+    One outer pressure-correction iteration on the staggered (MAC) grid:
+    SIMPLE/SIMPLEC use one corrector, PISO adds a second one.
+    No artificial dissipation, source array or local time step is needed
+    (the last four arguments are unused).
+    */
+    int nx = imax - 1;           /* Number of pressure cells in x */
+    int ny = jmax - 1;           /* Number of pressure cells in y */
+
+    double palpha;               /* Pressure under-relaxation for this corrector */
+
+    Array2& b = *mac_b;
+
+    /* Copy u to uold (save previous flow values)*/
+    uold.copyData(u);
+
+    /* Momentum predictor */
+    mac_momentum_coefficients();
+    mac_momentum_solve(2);
+    mac_us->copyData(*mac_u);
+    mac_vs->copyData(*mac_v);
+
+    /* First pressure corrector */
+    mac_pressure_coefficients();
+    mac_mass_imbalance(*mac_u, *mac_v, *mac_r);
+    b.copyData(*mac_r);
+    mac_pressure_solve(b, *mac_pc);
+    mac_correct_velocity(*mac_pc);
+    palpha = (ipcorr==0) ? alphap : one;
+    for(int i=0; i<nx; i++)
+    {
+        for(int j=0; j<ny; j++)
+        {
+            (*mac_p)(i,j) += palpha*(*mac_pc)(i,j);
+        }
+    }
+
+    /* Second pressure corrector (PISO) */
+    if(ipcorr==2)
+    {
+        mac_piso_neighbor_correction();
+        for(int i=1; i<nx; i++)
+        {
+            for(int j=0; j<ny; j++)
+            {
+                (*mac_u)(i,j) += (*mac_us)(i,j);
+            }
+        }
+        for(int i=0; i<nx; i++)
+        {
+            for(int j=1; j<ny; j++)
+            {
+                (*mac_v)(i,j) += (*mac_vs)(i,j);
+            }
+        }
+        mac_mass_imbalance(*mac_u, *mac_v, b);
+        mac_pressure_solve(b, *mac_pc);
+        mac_correct_velocity(*mac_pc);
+        for(int i=0; i<nx; i++)
+        {
+            for(int j=0; j<ny; j++)
+            {
+                (*mac_p)(i,j) += (*mac_pc)(i,j);
+            }
+        }
+    }
+
+    /* Interpolate the staggered solution to the nodes */
+    mac_to_nodes(u);
+
+    /* Set Boundary Conditions for u */
+    set_boundary_conditions(u);
+}
+
+/**************************************************************************/
+
+void read_schedule()
+{
+    /* 
+    Uses global variable(s): nschedmax
+    To modify: nsched, sched_type, sched_value, sched_par, sched_nblend
+    Reads the parameter schedule from 'schedule.in'. One stage per line:
+        <trigger> <value> <cfl> <Cx> <Cy> <rkappa> <nblend>
+    trigger = "iter": stage starts at iteration >= value
+    trigger = "res" : stage starts once conv <= value
+    Stages are entered in file order; the parameters are blended linearly
+    from the previous stage over nblend iterations. Lines starting with #
+    are comments.
+    */
+    FILE *fps;                   /* Schedule file */
+    char line[256];              /* Input line */
+    char trig[16];               /* Trigger keyword */
+
+    fps = fopen("./schedule.in","r");
+    if (fps==NULL)
+    {
+        printf("Error opening schedule file 'schedule.in'. Stopping.\n");
+        exit (0);
+    }
+    nsched = 0;
+    while(fgets(line, sizeof(line), fps)!=NULL)
+    {
+        if(line[0]=='#' || line[0]=='\n')
+        {
+            continue;
+        }
+        if(nsched>=nschedmax)
+        {
+            printf("ERROR: more than %d stages in 'schedule.in'!\n", nschedmax);
+            exit (0);
+        }
+        if(sscanf(line, "%15s %lf %lf %lf %lf %lf %d", trig, &sched_value[nsched], &sched_par[nsched][0],
+                  &sched_par[nsched][1], &sched_par[nsched][2], &sched_par[nsched][3], &sched_nblend[nsched])!=7)
+        {
+            printf("ERROR: bad line in 'schedule.in': %s", line);
+            exit (0);
+        }
+        if(strcmp(trig,"iter")==0)
+        {
+            sched_type[nsched] = 0;
+        }
+        else if(strcmp(trig,"res")==0)
+        {
+            sched_type[nsched] = 1;
+        }
+        else
+        {
+            printf("ERROR: schedule trigger must be 'iter' or 'res': %s", line);
+            exit (0);
+        }
+        nsched++;
+    }
+    fclose(fps);
+    printf("Read %d parameter schedule stages\n", nsched);
+}
+
+/**************************************************************************/
+
+void schedule_update( int n, double conv )
+{
+    /* 
+    Uses global variable(s): one, nsched, sched_type, sched_value, sched_par, sched_nblend, sched_cflscale
+    Uses: n (current iteration), conv (latest convergence measure)
+    To modify: cfl, Cx, Cy, rkappa, isched, nschedstart, sched_prev
+    The scheduled cfl is multiplied by sched_cflscale, so a reduction by the residual
+    monitor persists through later stages and blends.
+    */
+    double w;                    /* Blending weight of the current stage */
+
+    /* Enter every stage whose trigger has fired (a stage is never left once entered) */
+    while(isched+1<nsched)
+    {
+        if( (sched_type[isched+1]==0 && (double)(n)>=sched_value[isched+1]) ||
+            (sched_type[isched+1]==1 && conv<=sched_value[isched+1]) )
+        {
+            sched_prev[0] = cfl/sched_cflscale;
+            sched_prev[1] = Cx;
+            sched_prev[2] = Cy;
+            sched_prev[3] = rkappa;
+            isched++;
+            nschedstart = n;
+            printf("Schedule stage %d at iteration %d: cfl=%g Cx=%g Cy=%g rkappa=%g\n", isched, n,
+                   sched_par[isched][0], sched_par[isched][1], sched_par[isched][2], sched_par[isched][3]);
+        }
+        else
+        {
+            break;
+        }
+    }
+    if(isched<0)
+    {
+        return;
+    }
+
+    w = one;
+    if(sched_nblend[isched]>0)
+    {
+        w = fmin(one, (double)(n - nschedstart)/(double)(sched_nblend[isched]));
+    }
+    cfl    = sched_cflscale*((one - w)*sched_prev[0] + w*sched_par[isched][0]);
+    Cx     = (one - w)*sched_prev[1] + w*sched_par[isched][1];
+    Cy     = (one - w)*sched_prev[2] + w*sched_par[isched][2];
+    rkappa = (one - w)*sched_prev[3] + w*sched_par[isched][3];
+}
+
+/**************************************************************************/
+
+void write_history( int n, double rtime, double res[neq] )
+{
+    /* 
+    Uses global variable(s): fp1, ischedule, cfl, Cx, Cy, rkappa
+    Writes one line of the iterative residual history (plus the scheduled parameters)
+    */
+    if(ischedule==1)
+    {
+        fprintf(fp1, "%d %e %e %e %e %e %e %e %e\n",n, rtime, res[0], res[1], res[2], cfl, Cx, Cy, rkappa);
+    }
+    else
+    {
+        fprintf(fp1, "%d %e %e %e %e\n",n, rtime, res[0], res[1], res[2]);
+    }
+}
+
+/**************************************************************************/
+
+int classify_residual_history( double hist[], int nwin, int& period )
+{
+    /* 
+    Uses global variable(s): zero, half, one, two, monrate
+    Inputs: hist (log10 of conv over the last nwin iterations, oldest first)
+    To modify: period (dominant oscillation period in iterations, 0 if none)
+    Returns: 0 = converging, 1 = stagnating, 2 = oscillating, 3 = diverging
+    */
+    int i;                       /* Sample index */
+    int lag;                     /* Autocorrelation lag */
+
+    double tmean = half*(double)(nwin - 1);  /* Mean sample index */
+    double hmean = zero;         /* Mean of the samples */
+    double sxy = zero;           /* Covariance sum (index, sample) */
+    double sxx = zero;           /* Variance sum (index) */
+    double slope;                /* Least-squares trend (decades per iteration) */
+    double drop;                 /* Trend over the window (decades, > 0 = decreasing) */
+    double var = zero;           /* Variance of the detrended samples */
+    double acf;                  /* Autocorrelation of the detrended samples */
+    double acfmax = zero;        /* Largest autocorrelation after the first zero crossing */
+    int crossed = 0;             /* = 1 once the autocorrelation has gone negative */
+
+    for(i=0; i<nwin; i++)
+    {
+        if(!(fabs(hist[i])<1.e30))     /* inf or NaN residuals */
+        {
+            period = 0;
+            return 3;
+        }
+        hmean += hist[i];
+    }
+    hmean /= (double)(nwin);
+
+    /* Linear trend of log10(conv) over the window */
+    for(i=0; i<nwin; i++)
+    {
+        sxy += ((double)(i) - tmean)*(hist[i] - hmean);
+        sxx += pow2((double)(i) - tmean);
+    }
+    slope = sxy/sxx;
+    drop = -slope*(double)(nwin);
+
+    /* Autocorrelation of the detrended history: a periodic residual shows a */
+    /* strong second peak after the first zero crossing                      */
+    for(i=0; i<nwin; i++)
+    {
+        var += pow2(hist[i] - hmean - slope*((double)(i) - tmean));
+    }
+    period = 0;
+    if(var>1.e-12*(double)(nwin))
+    {
+        for(lag=1; lag<nwin/2; lag++)
+        {
+            acf = zero;
+            for(i=0; i<nwin-lag; i++)
+            {
+                acf += (hist[i] - hmean - slope*((double)(i) - tmean))*(hist[i+lag] - hmean - slope*((double)(i+lag) - tmean));
+            }
+            acf /= var;
+            if(acf<zero)
+            {
+                crossed = 1;
+            }
+            else if(crossed==1 && acf>acfmax)
+            {
+                acfmax = acf;
+                period = lag;
+            }
+        }
+    }
+
+    if(drop<-two*monrate && drop<-two*sqrt(var/(double)(nwin)))
+    {
+        return 3;       /* Residual trending up */
+    }
+    if(drop>=monrate)
+    {
+        return 0;       /* Still converging */
+    }
+    if(acfmax>half && sqrt(var/(double)(nwin))>0.01)
+    {
+        return 2;       /* Limit cycle: periodic, no net progress */
+    }
+    period = 0;
+    return 1;           /* Flat: no progress */
+}
+
+/**************************************************************************/
+
+int monitor_residual( int n, double conv )
+{
+    /* 
+    Uses global variable(s): nmonwin, fsmall
+    Uses: n (iteration), conv (latest convergence measure)
+    To modify: monhist, nmonsamples, monlast
+    Returns: class of the run (see classify_residual_history) at the end of each window,
+             -1 otherwise or while the history is still filling
+    */
+    int i;                       /* Sample index */
+    int state;                   /* Classification */
+    int period;                  /* Oscillation period */
+
+    const char *names[4] = {"converging", "stagnating", "oscillating", "diverging"};
+
+    double *hist;                /* Window in chronological order */
+
+    if(!(conv<1.e30))   /* inf or NaN: no need to wait for the window */
+    {
+        if(monlast!=3)
+        {
+            printf("Residual monitor at iteration %d: %s\n", n, names[3]);
+        }
+        monlast = 3;
+        return 3;
+    }
+    if(monhist==NULL)
+    {
+        monhist = new double[nmonwin];
+    }
+    monhist[nmonsamples%nmonwin] = log10(conv + fsmall);
+    nmonsamples++;
+    if(nmonsamples<nmonwin || (nmonsamples%nmonwin)!=0)
+    {
+        return -1;
+    }
+
+    hist = new double[nmonwin];
+    for(i=0; i<nmonwin; i++)
+    {
+        hist[i] = monhist[(nmonsamples + i)%nmonwin];
+    }
+    state = classify_residual_history(hist, nmonwin, period);
+    delete [] hist;
+
+    if(state==2)
+    {
+        printf("Residual monitor at iteration %d: %s (period %d iterations)\n", n, names[state], period);
+    }
+    else
+    {
+        printf("Residual monitor at iteration %d: %s\n", n, names[state]);
+    }
+
+    /* Only a repeated verdict counts as hopeless (one bad window is not enough) */
+    if(state==0 || state!=monlast)
+    {
+        monlast = state;
+        return (state==3) ? 3 : ((state==0) ? 0 : -1);
+    }
+    return state;
+}
+
+/**************************************************************************/
+
+void stats_request_handler( int )
+{
+    /* SIGUSR1: write the running statistics at the end of the current iteration */
+    stat_request = 1;
+}
+
+/**************************************************************************/
+
+void write_statistics( int n )
+{
+    /* 
+    Uses global variable(s): imax, jmax, neq, xmax, xmin, ymax, ymin, nstat, nstatbeg, nstatend, stat_mean, stat_m2,
+                             stat_min, stat_max
+    Uses: n (current iteration; the last sample is at min(n, nstatend))
+    Writes the running mean, RMS fluctuation, minimum and maximum of p, u, v to 'stats.dat'
+    */
+    int i;                       /* i index (x direction) */
+    int j;                       /* j index (y direction) */
+    int k;                       /* k index (# of equations) */
+
+    double x;       /* Temporary variable for x location */
+    double y;       /* Temporary variable for y location */
+
+    FILE *fps;      /* Statistics file */
+
+    if(nstat==0)
+    {
+        printf("No statistics samples yet (window starts at iteration %d)\n", nstatbeg);
+        return;
+    }
+    fps = fopen("./stats.dat","w");
+    fprintf(fps,"TITLE = \"Cavity Running Statistics (%d samples, iterations %d to %d)\"\n", nstat, nstatbeg, min(n, nstatend));
+    fprintf(fps,"variables=\"x(m)\"\"y(m)\"\"p-mean\"\"u-mean\"\"v-mean\"\"p-rms\"\"u-rms\"\"v-rms\"");
+    fprintf(fps,"\"p-min\"\"u-min\"\"v-min\"\"p-max\"\"u-max\"\"v-max\"\n");
+    fprintf(fps, "zone T=\"n=%d\"\n",n);
+    fprintf(fps, "I= %d J= %d\n",imax, jmax);
+    fprintf(fps, "DATAPACKING=POINT\n");
+    for(i=0; i<imax; i++)
+    {
+        for(j=0; j<jmax; j++)
+        {
+            x = (xmax - xmin)*(double)(i)/(double)(imax - 1);
+            y = (ymax - ymin)*(double)(j)/(double)(jmax - 1);
+            fprintf(fps,"%e %e", x, y);
+            for(k=0; k<neq; k++)
+            {
+                fprintf(fps," %e", (*stat_mean)(i,j,k));
+            }
+            for(k=0; k<neq; k++)
+            {
+                fprintf(fps," %e", sqrt((*stat_m2)(i,j,k)/(double)(nstat)));
+            }
+            for(k=0; k<neq; k++)
+            {
+                fprintf(fps," %e", (*stat_min)(i,j,k));
+            }
+            for(k=0; k<neq; k++)
+            {
+                fprintf(fps," %e", (*stat_max)(i,j,k));
+            }
+            fprintf(fps,"\n");
+        }
+    }
+    fclose(fps);
+    printf("Wrote running statistics (%d samples) to stats.dat\n", nstat);
+}
+
+/**************************************************************************/
+
+unsigned long long checksum_fnv1a( const unsigned char *buf, size_t nbytes, unsigned long long h )
+{
+    /* 64-bit FNV-1a hash of nbytes of buf, continuing from h (start with 14695981039346656037) */
+    for(size_t b=0; b<nbytes; b++)
+    {
+        h ^= (unsigned long long)(buf[b]);
+        h *= 1099511628211ULL;
+    }
+    return h;
+}
+
+/**************************************************************************/
+
+int write_checkpoint_binary( const char *path, int n, double rtime, double resinit[neq], Array3& u )
+{
+    /* 
+    Uses global variable(s): imax, jmax, neq
+    Writes a binary restart file: "CAVRST01", imax, jmax, neq, n, rtime, resinit[neq],
+    the u array and an FNV-1a checksum of everything before it. The file is written
+    under a temporary name and renamed, so a reader never sees a partial file.
+    Returns: 1 on success, 0 on failure
+    */
+    char tmppath[512];           /* Temporary file name */
+    int hdr[4];                  /* imax, jmax, neq, n */
+    size_t nvals = (size_t)(imax)*(size_t)(jmax)*(size_t)(neq);   /* Number of solution values */
+    unsigned long long h = 14695981039346656037ULL;               /* Checksum */
+
+    FILE *fpc;                   /* Checkpoint file */
+
+    snprintf(tmppath, sizeof(tmppath), "%s.tmp", path);
+    fpc = fopen(tmppath, "wb");
+    if(fpc==NULL)
+    {
+        return 0;
+    }
+    hdr[0] = imax;
+    hdr[1] = jmax;
+    hdr[2] = neq;
+    hdr[3] = n;
+    h = checksum_fnv1a((const unsigned char *)"CAVRST01", 8, h);
+    h = checksum_fnv1a((const unsigned char *)hdr, sizeof(hdr), h);
+    h = checksum_fnv1a((const unsigned char *)&rtime, sizeof(double), h);
+    h = checksum_fnv1a((const unsigned char *)resinit, neq*sizeof(double), h);
+    h = checksum_fnv1a((const unsigned char *)u.getData(), nvals*sizeof(double), h);
+    fwrite("CAVRST01", 1, 8, fpc);
+    fwrite(hdr, sizeof(int), 4, fpc);
+    fwrite(&rtime, sizeof(double), 1, fpc);
+    fwrite(resinit, sizeof(double), neq, fpc);
+    fwrite(u.getData(), sizeof(double), nvals, fpc);
+    fwrite(&h, sizeof(h), 1, fpc);
+    if(fclose(fpc)!=0)
+    {
+        remove(tmppath);
+        return 0;
+    }
+    return (rename(tmppath, path)==0) ? 1 : 0;
+}
+
+/**************************************************************************/
+
+int read_checkpoint_binary( const char *path, int& n, double& rtime, double resinit[neq], Array3& u )
+{
+    /* 
+    Uses global variable(s): imax, jmax, neq
+    Reads a file written by write_checkpoint_binary
+    To modify: n, rtime, resinit, u (only when the file is valid)
+    Returns: 1 if the file is complete, matches the grid and its checksum is correct, 0 otherwise
+    */
+    char magic[8];               /* File signature */
+    int hdr[4];                  /* imax, jmax, neq, n */
+    double rt;                   /* Stored time */
+    double rinit[neq];           /* Stored initial residuals */
+    size_t nvals = (size_t)(imax)*(size_t)(jmax)*(size_t)(neq);   /* Number of solution values */
+    unsigned long long h = 14695981039346656037ULL;               /* Computed checksum */
+    unsigned long long hfile;                                      /* Stored checksum */
+
+    FILE *fpc;                   /* Checkpoint file */
+
+    fpc = fopen(path, "rb");
+    if(fpc==NULL)
+    {
+        return 0;
+    }
+    Array3 tmp(imax, jmax, neq);
+    if( fread(magic, 1, 8, fpc)!=8 || memcmp(magic, "CAVRST01", 8)!=0 ||
+        fread(hdr, sizeof(int), 4, fpc)!=4 || hdr[0]!=imax || hdr[1]!=jmax || hdr[2]!=neq ||
+        fread(&rt, sizeof(double), 1, fpc)!=1 || fread(rinit, sizeof(double), neq, fpc)!=(size_t)(neq) ||
+        fread(tmp.getData(), sizeof(double), nvals, fpc)!=nvals || fread(&hfile, sizeof(hfile), 1, fpc)!=1 )
+    {
+        fclose(fpc);
+        return 0;
+    }
+    fclose(fpc);
+    h = checksum_fnv1a((const unsigned char *)magic, 8, h);
+    h = checksum_fnv1a((const unsigned char *)hdr, sizeof(hdr), h);
+    h = checksum_fnv1a((const unsigned char *)&rt, sizeof(double), h);
+    h = checksum_fnv1a((const unsigned char *)rinit, neq*sizeof(double), h);
+    h = checksum_fnv1a((const unsigned char *)tmp.getData(), nvals*sizeof(double), h);
+    if(h!=hfile)
+    {
+        return 0;
+    }
+    n = hdr[3];
+    rtime = rt;
+    for(int k=0; k<neq; k++)
+    {
+        resinit[k] = rinit[k];
+    }
+    u.copyData(tmp);
+    return 1;
+}
+
+/**************************************************************************/
+
+int list_checkpoints( const char *dir, int nlist[], int nlistmax )
+{
+    /* 
+    Inputs: dir (tier directory)
+    To modify: nlist (iteration numbers of the checkpoints found, descending)
+    Returns: number of checkpoints found
+    */
+    int count = 0;               /* Number of checkpoints found */
+    int nck;                     /* Iteration number of a checkpoint */
+    int tmp;                     /* Swap temporary */
+    char tail[8];                /* Rest of the file name after the number */
+
+    DIR *dp;                     /* Directory stream */
+    struct dirent *ent;          /* Directory entry */
+
+    dp = opendir(dir);
+    if(dp==NULL)
+    {
+        return 0;
+    }
+    while((ent = readdir(dp))!=NULL && count<nlistmax)
+    {
+        if(sscanf(ent->d_name, "ckpt_%d%7s", &nck, tail)==2 && strcmp(tail, ".bin")==0)
+        {
+            nlist[count++] = nck;
+        }
+    }
+    closedir(dp);
+
+    /* Sort descending (newest first) */
+    for(int a=1; a<count; a++)
+    {
+        for(int b=a; b>0 && nlist[b]>nlist[b-1]; b--)
+        {
+            tmp = nlist[b];
+            nlist[b] = nlist[b-1];
+            nlist[b-1] = tmp;
+        }
+    }
+    return count;
+}
+
+/**************************************************************************/
+
+void checkpoint_retention( const char *dir, int nkeeplast, int nkeepevery, int nupto )
+{
+    /* 
+    Uses global variable(s): ncheck
+    Deletes the checkpoints in dir up to iteration nupto except the newest nkeeplast
+    and every nkeepevery-th checkpoint (counted in units of ncheck iterations; 0 = none)
+    */
+    int nlist[4096];             /* Checkpoints present (newest first) */
+    int count;                   /* Number of checkpoints present */
+    char path[512];              /* Checkpoint file name */
+
+    count = list_checkpoints(dir, nlist, 4096);
+    for(int c=nkeeplast; c<count; c++)
+    {
+        if(nlist[c]>nupto || (nkeepevery>0 && ((nlist[c]/ncheck)%nkeepevery)==0))
+        {
+            continue;
+        }
+        snprintf(path, sizeof(path), "%s/ckpt_%09d.bin", dir, nlist[c]);
+        remove(path);
+    }
+}
+
+/**************************************************************************/
+
+void checkpoint_drain_agent()
+{
+    /* 
+    Uses global variable(s): ckdurable, nckkeep, nckevery, ck_fastdir, ck_queue, ck_mutex, ck_cond, ck_stop
+    Background thread: copies checkpoints from the fast tier to the durable tier,
+    then applies the retention policy on both tiers
+    */
+    int nck;                     /* Checkpoint being drained */
+    int ok;                      /* = 1 while the copy succeeds */
+    char src[1024];              /* Fast-tier file name */
+    char dst[512];               /* Durable-tier file name */
+    char tmp[520];               /* Durable-tier temporary file name (dst + ".tmp") */
+    size_t nread;                /* Bytes read per block */
+
+    FILE *fin;                   /* Fast-tier file */
+    FILE *fout;                  /* Durable-tier file */
+
+    char *buf = new char[1<<20]; /* Copy buffer */
+
+    for(;;)
+    {
+        {
+            std::unique_lock<std::mutex> lock(ck_mutex);
+            while(ck_queue.empty() && !ck_stop)
+            {
+                ck_cond.wait(lock);
+            }
+            if(ck_queue.empty() && ck_stop)
+            {
+                break;
+            }
+            nck = ck_queue.front();
+        }
+
+        snprintf(src, sizeof(src), "%s/ckpt_%09d.bin", ck_fastdir, nck);
+        snprintf(dst, sizeof(dst), "%s/ckpt_%09d.bin", ckdurable, nck);
+        snprintf(tmp, sizeof(tmp), "%s.tmp", dst);
+        fin = fopen(src, "rb");
+        fout = (fin!=NULL) ? fopen(tmp, "wb") : NULL;
+        ok = (fin!=NULL && fout!=NULL) ? 1 : 0;
+        if(ok==1)
+        {
+            while(ok==1 && (nread = fread(buf, 1, 1<<20, fin))>0)
+            {
+                ok = (fwrite(buf, 1, nread, fout)==nread) ? 1 : 0;
+            }
+            if(ferror(fin) || fflush(fout)!=0 || fsync(fileno(fout))!=0)   /* Durable before it becomes visible */
+            {
+                ok = 0;
+            }
+        }
+        if(fout!=NULL && fclose(fout)!=0)
+        {
+            ok = 0;
+        }
+        if(fin!=NULL)
+        {
+            fclose(fin);
+        }
+        if(ok==1 && rename(tmp, dst)==0)
+        {
+            /* The fast tier only needs the newest two of those drained; the durable tier keeps the policy set */
+            checkpoint_retention(ck_fastdir, 2, 0, nck);
+            checkpoint_retention(ckdurable, nckkeep, nckevery, nck);
+        }
+        else
+        {
+            if(fout!=NULL)
+            {
+                remove(tmp);
+            }
+            printf("Checkpoint agent: could not copy %s to %s (kept on the fast tier)\n", src, ckdurable);
+        }
+
+        /* Only now leave the queue: the solver may be waiting for room */
+        {
+            std::lock_guard<std::mutex> lock(ck_mutex);
+            ck_queue.pop_front();
+        }
+        ck_cond.notify_all();
+    }
+    delete [] buf;
+}
+
+/**************************************************************************/
+
+void checkpoint_tiered( int n, Array3& u, double resinit[neq], double rtime )
+{
+    /* 
+    Uses global variable(s): ckdurable, nckqueue, ck_agent, ck_queue, ck_mutex, ck_cond
+    Writes a checkpoint to the fast tier (synchronous) and queues it for the
+    background agent that drains it to the durable tier. When nckqueue checkpoints
+    are already waiting, first waits for the agent (the fast tier stays bounded).
+    */
+    char path[1024];             /* Fast-tier file name */
+
+    if(!ck_agent.joinable())
+    {
+        mkdir(ckfast, 0755);
+        mkdir(checkpoint_fast_dir(), 0755);
+        mkdir(ckdurable, 0755);
+        ck_agent = std::thread(checkpoint_drain_agent);
+    }
+    {
+        std::unique_lock<std::mutex> lock(ck_mutex);
+        while((int)(ck_queue.size())>=nckqueue)
+        {
+            ck_cond.wait(lock);
+        }
+    }
+    snprintf(path, sizeof(path), "%s/ckpt_%09d.bin", checkpoint_fast_dir(), n);
+    if(write_checkpoint_binary(path, n, rtime, resinit, u)==0)
+    {
+        printf("Could not write checkpoint %s\n", path);
+        return;
+    }
+    {
+        std::lock_guard<std::mutex> lock(ck_mutex);
+        ck_queue.push_back(n);
+    }
+    ck_cond.notify_all();
+}
+
+/**************************************************************************/
+
+void checkpoint_shutdown()
+{
+    /* 
+    Uses global variable(s): ck_agent, ck_mutex, ck_cond, ck_stop
+    Lets the background agent drain the remaining checkpoints and stops it
+    */
+    if(ck_agent.joinable())
+    {
+        {
+            std::lock_guard<std::mutex> lock(ck_mutex);
+            ck_stop = true;
+        }
+        ck_cond.notify_all();
+        ck_agent.join();
+    }
+}
+
+/**************************************************************************/
+
+const char* checkpoint_fast_dir()
+{
+    /* 
+    Uses global variable(s): ckfast, ckrun
+    To modify: ck_fastdir (on the first call, from the main thread)
+    Returns: this run's directory on the fast tier, ckfast/ckrun, or for ckrun = ""
+    ckfast/run_<hash of the working directory>. The fast tier is shared by every job on
+    the node; the name is stable across restarts of a run from the same directory.
+    */
+    char cwd[512];               /* Working directory */
+
+    if(ck_fastdir[0]=='\0')
+    {
+        if(ckrun[0]!='\0')
+        {
+            snprintf(ck_fastdir, sizeof(ck_fastdir), "%s/%s", ckfast, ckrun);
+        }
+        else
+        {
+            if(getcwd(cwd, sizeof(cwd))==NULL)
+            {
+                strcpy(cwd, ".");
+            }
+            snprintf(ck_fastdir, sizeof(ck_fastdir), "%s/run_%016llx", ckfast,
+                     checksum_fnv1a((const unsigned char *)cwd, strlen(cwd), 14695981039346656037ULL));
+        }
+    }
+    return ck_fastdir;
+}
+
+/**************************************************************************/
+
+int checkpoint_restart( int& ninit, double& rtime, double resinit[neq], Array3& u )
+{
+    /* 
+    Uses global variable(s): ckdurable
+    Finds the newest valid checkpoint over both tiers (fast tier first on a tie)
+    To modify: ninit, rtime, resinit, u
+    Returns: 1 if a valid checkpoint was loaded, 0 otherwise
+    */
+    int nfast[4096];             /* Fast-tier checkpoints (newest first) */
+    int ndur[4096];              /* Durable-tier checkpoints (newest first) */
+    int cf;                      /* Number of fast-tier checkpoints */
+    int cd;                      /* Number of durable-tier checkpoints */
+    int a = 0;                   /* Position in the fast-tier list */
+    int b = 0;                   /* Position in the durable-tier list */
+    char path[1024];             /* Checkpoint file name */
+
+    cf = list_checkpoints(checkpoint_fast_dir(), nfast, 4096);
+    cd = list_checkpoints(ckdurable, ndur, 4096);
+    while(a<cf || b<cd)
+    {
+        if(b>=cd || (a<cf && nfast[a]>=ndur[b]))
+        {
+            snprintf(path, sizeof(path), "%s/ckpt_%09d.bin", checkpoint_fast_dir(), nfast[a++]);
+        }
+        else
+        {
+            snprintf(path, sizeof(path), "%s/ckpt_%09d.bin", ckdurable, ndur[b++]);
+        }
+        if(read_checkpoint_binary(path, ninit, rtime, resinit, u)==1)
+        {
+            printf("Restarting from checkpoint %s\n", path);
+            return 1;
+        }
+        printf("Skipping invalid checkpoint %s\n", path);
+    }
+    return 0;
+}
+
+/**************************************************************************/
+
+void stream_writer_agent()
+{
+    /* 
+    Uses global variable(s): stream_fd, stream_buf, stream_bytes, stream_full, stream_nfree, stream_mutex, stream_cond, stream_stop
+    Background thread: writes queued frames to the stream with large blocking writes.
+    A slow consumer blocks this thread, which in turn makes 'stream_frame' wait for a
+    free buffer: backpressure always lands at a frame boundary in the solver.
+    */
+    int b;                       /* Buffer being written */
+    int fd;                      /* Stream file descriptor (-1 once the consumer went away) */
+    size_t done;                 /* Bytes written so far */
+    ssize_t nw;                  /* Bytes written by one call */
+
+    for(;;)
+    {
+        {
+            std::unique_lock<std::mutex> lock(stream_mutex);
+            while(stream_full.empty() && !stream_stop)
+            {
+                stream_cond.wait(lock);
+            }
+            if(stream_full.empty() && stream_stop)
+            {
+                break;
+            }
+            b = stream_full.front();
+        }
+
+        done = 0;
+        fd = stream_fd.load();
+        while(fd>=0 && done<stream_bytes[b])
+        {
+            nw = write(fd, stream_buf[b] + done, stream_bytes[b] - done);
+            if(nw<0 && errno==EINTR)
+            {
+                continue;
+            }
+            if(nw<=0)
+            {
+                fprintf(stderr, "Binary stream: consumer went away (%s); streaming stopped\n", strerror(errno));
+                stream_fd.store(-1);     /* 'stream_frame' stops queueing frames */
+                close(fd);
+                fd = -1;
+                break;
+            }
+            done += (size_t)(nw);
+        }
+
+        {
+            std::lock_guard<std::mutex> lock(stream_mutex);
+            stream_full.pop_front();
+            stream_nfree++;
+        }
+        stream_cond.notify_all();
+    }
+}
+
+/**************************************************************************/
+
+void stream_open()
+{
+    /* 
+    Uses global variable(s): streampath, imax, jmax, neq
+    To modify: stream_fd, stream_buf, stream_agent
+    Opens the binary stream: "-" = standard output (the text output then goes to
+    standard error), anything else = a named pipe or file (a FIFO blocks here until
+    a reader opens it)
+    */
+    size_t nbytes = sizeof(StreamFrameHeader) + (size_t)(neq)*(size_t)(imax)*(size_t)(jmax)*sizeof(double);
+
+    signal(SIGPIPE, SIG_IGN);    /* A vanished reader gives EPIPE instead of killing the solver */
+    if(strcmp(streampath, "-")==0)
+    {
+        fflush(stdout);
+        stream_fd = dup(1);
+        dup2(2, 1);
+    }
+    else
+    {
+        stream_fd = open(streampath, O_WRONLY | O_CREAT | O_TRUNC, 0644);   /* O_TRUNC is ignored for a FIFO */
+    }
+    if(stream_fd<0)
+    {
+        printf("Error opening binary stream '%s'. Stopping.\n", streampath);
+        exit (0);
+    }
+    for(int b=0; b<nstreambuf; b++)
+    {
+        if(posix_memalign((void **)&stream_buf[b], 4096, nbytes)!=0)   /* Page aligned for the pipe */
+        {
+            printf("Error allocating binary stream buffers. Stopping.\n");
+            exit (0);
+        }
+        stream_bytes[b] = nbytes;
+    }
+    stream_nfree = nstreambuf;
+    stream_agent = std::thread(stream_writer_agent);
+}
+
+/**************************************************************************/
+
+void stream_frame( int n, double rtime, double conv, Array3& u )
+{
+    /* 
+    Uses global variable(s): imax, jmax, neq, xmin, xmax, ymin, ymax, stream_*
+    Queues one framed snapshot: header, then the p, u and v planes (i-major, as the grid)
+    Blocks while every buffer is still waiting for the consumer (backpressure)
+    */
+    int b;                       /* Buffer to fill */
+    size_t nplane = (size_t)(imax)*(size_t)(jmax);   /* Values per plane */
+
+    StreamFrameHeader hdr;       /* Frame header */
+    double *plane;               /* Start of the field planes in the buffer */
+
+    if(stream_fd<0)
+    {
+        return;
+    }
+    {
+        std::unique_lock<std::mutex> lock(stream_mutex);
+        while(stream_nfree==0)
+        {
+            stream_cond.wait(lock);
+        }
+        stream_nfree--;
+        b = stream_next;
+        stream_next = (stream_next + 1)%nstreambuf;
+    }
+
+    memcpy(hdr.magic, "CAVFRAME", 8);
+    hdr.version = 1;
+    hdr.ni = imax;
+    hdr.nj = jmax;
+    hdr.nplanes = neq;
+    hdr.n = n;
+    hdr.flags = 0;
+    hdr.rtime = rtime;
+    hdr.conv = conv;
+    hdr.xmin = xmin;
+    hdr.xmax = xmax;
+    hdr.ymin = ymin;
+    hdr.ymax = ymax;
+    hdr.payload = (unsigned long long)(neq)*(unsigned long long)(nplane)*sizeof(double);
+    memcpy(stream_buf[b], &hdr, sizeof(hdr));
+
+    /* Array-of-structures u(i,j,k) to structure-of-arrays planes */
+    plane = (double *)(stream_buf[b] + sizeof(hdr));
+    for(int k=0; k<neq; k++)
+    {
+        View2(plane + (size_t)(k)*nplane, imax, jmax, jmax, 1).copyFrom(u.plane(k));
+    }
+
+    {
+        std::lock_guard<std::mutex> lock(stream_mutex);
+        stream_full.push_back(b);
+    }
+    stream_cond.notify_all();
+}
+
+/**************************************************************************/
+
+void stream_close()
+{
+    /* 
+    Uses global variable(s): stream_*
+    Writes the end-of-stream marker (a header with nplanes = 0), drains and stops the writer
+    */
+    StreamFrameHeader hdr;       /* End-of-stream header */
+
+    if(!stream_agent.joinable())
+    {
+        return;
+    }
+    {
+        std::lock_guard<std::mutex> lock(stream_mutex);
+        stream_stop = true;
+    }
+    stream_cond.notify_all();
+    stream_agent.join();
+
+    if(stream_fd>=0)
+    {
+        memset(&hdr, 0, sizeof(hdr));
+        memcpy(hdr.magic, "CAVFRAME", 8);
+        hdr.version = 1;
+        hdr.flags = 1;
+        if(write(stream_fd, &hdr, sizeof(hdr))!=(ssize_t)(sizeof(hdr)))
+        {
+            fprintf(stderr, "Binary stream: could not write the end-of-stream marker\n");
+        }
+        close(stream_fd);
+        stream_fd = -1;
+    }
+    for(int b=0; b<nstreambuf; b++)
+    {
+        free(stream_buf[b]);
+    }
+}
+
+/**************************************************************************/
+
+GridInputs::GridInputs (int i, int j) :
+    s(i, j, neq), bx(2, j, neq), by(i, 2, neq)
+{
+    ni = i;
+    nj = j;
+    pref = pinf;
+}
+
+/**************************************************************************/
+
+CavityGrid::CavityGrid (int i, int j) :
+    u(i, j, neq), uold(i, j, neq), viscx(i, j), viscy(i, j), dt(i, j)
+{
+    ni = i;
+    nj = j;
+    in = grid_inputs(i, j);
+    hx = (xmax - xmin)/(double)(ni - 1);
+    hy = (ymax - ymin)/(double)(nj - 1);
+    mu = rmu;
+    niter = 0;
+    conv = one;
+}
+
+//Takes its arrays from grid_storage(i,j) doubles of external storage (e.g. an arena), which the caller keeps alive
+CavityGrid::CavityGrid (int i, int j, double *storage) :
+    u(i, j, neq, storage), uold(i, j, neq, storage + i*j*neq),
+    viscx(i, j, storage + 2*i*j*neq), viscy(i, j, storage + (2*neq + 1)*i*j), dt(i, j, storage + (2*neq + 2)*i*j)
+{
+    ni = i;
+    nj = j;
+    in = grid_inputs(i, j);
+    hx = (xmax - xmin)/(double)(ni - 1);
+    hy = (ymax - ymin)/(double)(nj - 1);
+    mu = rmu;
+    niter = 0;
+    conv = one;
+}
+
+/**************************************************************************/
+
+void grid_bndry( CavityGrid& g )
+{
+    /* 
+    Uses global variable(s): imms
+    To modify: g.u
+    Cavity (imms = 0) or manufactured-solution (imms = 1) boundary conditions on any grid size
+    */
+    if(imms==1)
+    {
+        bndrymms_lines(g, g.u, 0, g.ni);
+    }
+    else
+    {
+        bndry_lines(g, g.u, 0, g.ni);
+    }
+}
+
+/**************************************************************************/
+
+void grid_initial( CavityGrid& g )
+{
+    /* 
+    Uses global variable(s): zero, one, pinf
+    To modify: g.u, g.uold (= u), g.viscx, g.viscy, g.dt, g.resinit
+    Quiescent start (as 'initial' with irstr = 0); the MMS source terms are in g.in
+    */
+    for(int i=0; i<g.ni; i++)
+    {
+        for(int j=0; j<g.nj; j++)
+        {
+            g.u(i,j,0) = pinf;
+            g.u(i,j,1) = zero;
+            g.u(i,j,2) = zero;
+            g.viscx(i,j) = zero;
+            g.viscy(i,j) = zero;
+            g.dt(i,j) = zero;
+        }
+    }
+    for(int k=0; k<neq; k++)
+    {
+        g.resinit[k] = one;
+    }
+    g.niter = 0;
+    g.conv = one;
+    grid_bndry(g);
+    g.uold.copyData(g.u);
+}
+
+/**************************************************************************/
+
+void grid_iteration( CavityGrid& g )
+{
+    /* 
+    To modify: g (one SGS or point Jacobi iteration; residual norms and conv)
+    */
+    grid_sweep(g, 1);
+    grid_residual_norms(g);
+}
+
+/**************************************************************************/
+
+void grid_sweep( CavityGrid& g, int keepold )
+{
+    /* 
+    Uses global variable(s): isgs
+    Uses: keepold (= 1 to leave the previous iterate in g.uold, needed by 'grid_residual_norms')
+    To modify: g.u, g.uold, g.viscx, g.viscy, g.dt, g.niter
+    One SGS or point Jacobi iteration without the residual norms, with the kernels of
+    'GS_iteration' and 'PJ_iteration' on the grid g. Point Jacobi swaps u and uold, so it
+    never copies; SGS copies only if keepold = 1.
+    */
+    const Array3& s = g.in->s;      /* Source terms */
+    double dtmin;                   /* Time step of the last point (not used) */
+
+    time_step_lines(g, g.u, g.dt, dtmin, 1, g.ni-1);
+    if(isgs==1)
+    {
+        if(keepold==1)
+        {
+            g.uold.copyData(g.u);
+        }
+        artificial_viscosity_lines(g, g.u, g.viscx, g.viscy, 1, g.ni-1);
+        SGS_forward_sweep(g, g.u, g.viscx, g.viscy, g.dt, s);
+        grid_bndry(g);
+        artificial_viscosity_lines(g, g.u, g.viscx, g.viscy, 1, g.ni-1);
+        SGS_backward_sweep(g, g.u, g.viscx, g.viscy, g.dt, s);
+    }
+    else
+    {
+        g.uold.swapData(g.u);
+        artificial_viscosity_lines(g, g.uold, g.viscx, g.viscy, 1, g.ni-1);
+        point_Jacobi_lines(g, g.u, g.uold, g.viscx, g.viscy, g.dt, s, 1, g.ni-1);
+    }
+    grid_bndry(g);
+    pressure_rescaling(g, g.u);
+    g.niter++;
+}
+
+/**************************************************************************/
+
+void grid_residual_norms( CavityGrid& g )
+{
+    /* 
+    Uses: g.u, g.uold (previous iterate), g.dt, g.resinit
+    To modify: g.res, g.conv (as 'check_iterative_convergence')
+    */
+    iterative_residual_norms(g, g.u, g.uold, g.dt, g.res);
+    g.conv = convergence_measure(g, g.res, g.resinit);
+}
+
+/**************************************************************************/
+
+int grid_solve( CavityGrid& g, int nit, double tol )
+{
+    /* 
+    Iterates g until conv < tol or nit iterations; returns 1 if converged, -1 on NaN, 0 otherwise
+    */
+    for(int n=0; n<nit; n++)
+    {
+        grid_iteration(g);
+        if(g.conv!=g.conv)
+        {
+            return -1;
+        }
+        if(g.conv<tol)
+        {
+            return 1;
+        }
+    }
+    return 0;
+}
+
+/**************************************************************************/
+
+double grid_interpolate( CavityGrid& g, double x, double y, int k )
+{
+    /* 
+    Uses global variable(s): xmin, ymin
+    Returns: bilinear interpolation of equation k at (x,y)
+    */
+    double xi = (x - xmin)/g.hx;      /* Fractional grid index in x */
+    double yj = (y - ymin)/g.hy;      /* Fractional grid index in y */
+    int i = min(max((int)(xi), 0), g.ni-2);
+    int j = min(max((int)(yj), 0), g.nj-2);
+    double fx = xi - (double)(i);
+    double fy = yj - (double)(j);
+
+    return (one-fx)*(one-fy)*g.u(i,j,k) + fx*(one-fy)*g.u(i+1,j,k)
+         + (one-fx)*fy*g.u(i,j+1,k) + fx*fy*g.u(i+1,j+1,k);
+}
+
+/**************************************************************************/
+
+void grid_error_norms( CavityGrid& g, double rL1[neq], double rL2[neq], double rLinf[neq] )
+{
+    /* 
+    Uses global variable(s): zero, xmin, ymin
+    To modify: rL1, rL2, rLinf (MMS discretization error norms over the interior, as 'Discretization_Error_Norms')
+    */
+    double DE;                      /* Discretization error (absolute value) */
+
+    for(int k=0; k<neq; k++)
+    {
+        rL1[k] = zero;
+        rL2[k] = zero;
+        rLinf[k] = zero;
+    }
+    for(int i=1; i<g.ni-1; i++)
+    {
+        for(int j=1; j<g.nj-1; j++)
+        {
+            for(int k=0; k<neq; k++)
+            {
+                DE = fabs(g.u(i,j,k) - umms(xmin + g.hx*(double)(i), ymin + g.hy*(double)(j), k));
+                rL1[k] += DE;
+                rL2[k] += DE*DE;
+                rLinf[k] = fmax(rLinf[k], DE);
+            }
+        }
+    }
+    for(int k=0; k<neq; k++)
+    {
+        rL1[k] = rL1[k]/(double)(g.ni*g.nj);
+        rL2[k] = sqrt(rL2[k]/(double)(g.ni*g.nj));
+    }
+}
+
+/**************************************************************************/
+
+void combination_driver()
+{
+    /* 
+    Uses global variable(s): ncombl, ncombmin, ncombthreads, ncombit, toler, imms, xmin, ymin
+    Sparse-grid combination technique: solves every (2^l1+1) x (2^l2+1) grid with
+    l1 + l2 = ncombl + ncombmin (coefficient +1) and l1 + l2 = ncombl + ncombmin - 1
+    (coefficient -1), l1, l2 >= ncombmin, concurrently; then combines the bilinearly
+    interpolated solutions on the (2^ncombl+1) x (2^ncombl+1) grid ('combination.dat')
+    */
+    std::vector<CavityGrid> grids;      /* Component grids */
+    std::vector<double> coef;           /* Combination coefficients */
+    std::vector<int> status;            /* grid_solve result per component grid */
+    std::vector<std::thread> workers;   /* Solver threads */
+    std::atomic<int> next(0);           /* Next component grid to solve */
+    int nthreads;                       /* Number of solver threads */
+    int nfine = (1<<ncombl) + 1;        /* Points per direction of the combined grid */
+    double rL1[neq], rL2[neq], rLinf[neq];   /* MMS discretization error norms */
+
+    if(ncombmin<2 || ncombl<ncombmin)
+    {
+        printf("ERROR: need 2 <= ncombmin <= ncombl for the combination technique!\n");
+        exit (0);
+    }
+    for(int q=ncombl+ncombmin; q>=ncombl+ncombmin-1; q--)
+    {
+        for(int l1=ncombmin; l1<=q-ncombmin; l1++)
+        {
+            grids.emplace_back((1<<l1) + 1, (1<<(q-l1)) + 1);
+            coef.push_back((q==ncombl+ncombmin) ? one : -one);
+        }
+    }
+    status.assign(grids.size(), 0);
+
+    nthreads = (ncombthreads>0) ? ncombthreads : (int)(std::thread::hardware_concurrency());
+    nthreads = max(1, min(nthreads, (int)(grids.size())));
+    printf("Combination technique: level %d (min %d), %d component grids on %d threads\n",
+           ncombl, ncombmin, (int)(grids.size()), nthreads);
+
+    for(int t=0; t<nthreads; t++)
+    {
+        workers.push_back(std::thread([&]()
+        {
+            for(int m = next++; m<(int)(grids.size()); m = next++)
+            {
+                grid_initial(grids[m]);
+                status[m] = grid_solve(grids[m], ncombit, toler);
+                printf("  grid %4d x %-4d  coefficient %+2.0f  %8d iterations  conv = %e%s\n",
+                       grids[m].ni, grids[m].nj, coef[m], grids[m].niter, grids[m].conv,
+                       (status[m]==1) ? "" : ((status[m]<0) ? "  (diverged)" : "  (not converged)"));
+            }
+        }));
+    }
+    for(int t=0; t<nthreads; t++)
+    {
+        workers[t].join();
+    }
+
+    /* Combine on the fine grid */
+    CavityGrid fine(nfine, nfine);
+    for(int i=0; i<nfine; i++)
+    {
+        for(int j=0; j<nfine; j++)
+        {
+            for(int k=0; k<neq; k++)
+            {
+                fine.u(i,j,k) = zero;
+                for(int m=0; m<(int)(grids.size()); m++)
+                {
+                    fine.u(i,j,k) += coef[m]*grid_interpolate(grids[m], xmin + fine.hx*(double)(i), ymin + fine.hy*(double)(j), k);
+                }
+            }
+        }
+    }
+
+    fp2 = fopen("./combination.dat","w");
+    fprintf(fp2,"TITLE = \"Cavity Field Data (combination technique)\"\n");
+    fprintf(fp2,"variables=\"x(m)\"\"y(m)\"\"p(N/m^2)\"\"u(m/s)\"\"v(m/s)\"\n");
+    fprintf(fp2, "zone T=\"level=%d\"\n", ncombl);
+    fprintf(fp2, "I= %d J= %d\n", nfine, nfine);
+    fprintf(fp2, "DATAPACKING=POINT\n");
+    for(int i=0; i<nfine; i++)
+    {
+        for(int j=0; j<nfine; j++)
+        {
+            fprintf(fp2,"%e %e %e %e %e\n", xmin + fine.hx*(double)(i), ymin + fine.hy*(double)(j),
+                    fine.u(i,j,0), fine.u(i,j,1), fine.u(i,j,2));
+        }
+    }
+    fclose(fp2);
+
+    if(imms==1)
+    {
+        grid_error_norms(fine, rL1, rL2, rLinf);
+        printf("Combined solution DE norms (%d x %d):\n", nfine, nfine);
+        for(int k=0; k<neq; k++)
+        {
+            printf("  eq %d: L1Norm: %e L2Norm: %e LinfNorm: %e\n", k, rL1[k], rL2[k], rLinf[k]);
+        }
+    }
+}
+
+/**************************************************************************/
+
+int pipeline_run( int nfirst, int nlast, boundaryLinesPointer set_boundary_lines, Array3& u, Array3& uold, Array3& src, Array2& viscx, Array2& viscy, Array2& dt, double res[neq], double resinit[neq], int ninit, double& rtime, double& dtmin, double& conv )
+{
+    /* 
+    Uses global variable(s): imax, jmax, neq, npipeblock, npipethreads, toler, rho, rkappa, uinf, iinit, irstr, nramp, maingrid
+    To modify: u, uold, viscx, viscy, dt, res, rtime, dtmin, conv, ulid
+    Returns: the last iteration performed (its solution is in u; uold, viscx, viscy and dt are
+    scratch on return, see the end of the function)
+    Point Jacobi iterations nfirst..nlast (stopping early on conv < toler) as a pipeline over
+    blocks of npipeblock grid lines (i = const, contiguous in memory):
+        stage 1: time step and artificial viscosity of the block       (npipethreads threads)
+        stage 2: point Jacobi update of the block                       (npipethreads threads)
+        stage 3: boundary conditions and residual sums of the block     (1 thread, in order)
+    Stage 1 of iteration m+1 starts on a block as soon as stage 3 of iteration m has finished
+    the block after it, so the stages overlap within and across iterations.
+    The pressure is not rescaled inside the pipeline: the scheme only sees pressure
+    differences, so the unshifted field evolves exactly like the rescaled one up to a
+    constant. The continuity residual is recovered from the sums S0 = sum a^2,
+    S1 = sum a*c, S2 = sum c^2 (a = dp/(beta2 dt), c = 1/(beta2 dt)) once the shift s of the
+    center pressure is known: sum (a - s*c)^2 = S0 - 2 s S1 + s^2 S2. The caller rescales
+    the pressure at the end ('pressure_rescaling').
+    */
+    int nb = max(1, (imax-2)/npipeblock);        /* Number of blocks (each >= npipeblock lines) */
+    int iref = (imax-1)/2;                       /* Pressure rescaling point */
+    int jref = (jmax-1)/2;
+    int nstop = nlast;                           /* Last iteration (lowered on convergence) */
+    int nthreads = max(1, npipethreads);         /* Threads in stage groups 1 and 2 */
+    double pcprev = u(iref,jref,0);              /* Center pressure of the previous iteration */
+    double dtlast[2];                            /* dtmin of the two iterations in flight */
+
+    std::vector<int> lo(nb), hi(nb);             /* Interior lines lo <= i < hi of each block */
+    std::vector<int> done1(nb, nfirst-1);        /* Last iteration finished per block, stage 1 */
+    std::vector<int> done2(nb, nfirst-1);        /*                                    stage 2 */
+    std::vector<int> done3(nb, nfirst-1);        /*                                    stage 3 */
+    std::vector<double> sums(nb*(neq+2), zero);  /* Residual sums per block */
+    std::atomic<int> next1(0);                   /* Next stage 1 work item */
+    std::atomic<int> next2(0);                   /* Next stage 2 work item */
+    std::mutex mtx;                              /* Protects the done arrays and nstop */
+    std::condition_variable cond;                /* Signals progress */
+    std::vector<std::thread> workers;            /* Stage threads */
+
+    for(int b=0; b<nb; b++)
+    {
+        lo[b] = 1 + b*npipeblock;
+        hi[b] = (b==nb-1) ? imax-1 : lo[b] + npipeblock;
+    }
+
+    /* Iteration m reads the solution from rd(m) and writes it to wr(m) (as PJ_iteration's swap) */
+    auto rd = [&](int m) -> Array3& { return ((m-nfirst)%2==0) ? u : uold; };
+    auto wr = [&](int m) -> Array3& { return ((m-nfirst)%2==0) ? uold : u; };
+
+    auto publish = [&](std::vector<int>& done, int b, int m)
+    {
+        {
+            std::lock_guard<std::mutex> lock(mtx);
+            done[b] = m;
+        }
+        cond.notify_all();
+    };
+
+    auto stage1 = [&]()
+    {
+        for(int t = next1++; ; t = next1++)
+        {
+            int m = nfirst + t/nb;
+            int b = t%nb;
+            int bn = min(b+1, nb-1);
+            double dtl;
+            {
+                std::unique_lock<std::mutex> lock(mtx);
+                cond.wait(lock, [&]{ return m>nstop || (done3[bn]>=m-1 && done3[nb-1]>=m-2); });
+                if(m>nstop)
+                {
+                    return;
+                }
+            }
+            time_step_lines(maingrid, rd(m), dt, dtl, lo[b], hi[b]);
+            artificial_viscosity_lines(maingrid, rd(m), viscx, viscy, lo[b], hi[b]);
+            if(b==nb-1)
+            {
+                dtlast[m%2] = dtl;
+            }
+            publish(done1, b, m);
+        }
+    };
+
+    auto stage2 = [&]()
+    {
+        for(int t = next2++; ; t = next2++)
+        {
+            int m = nfirst + t/nb;
+            int b = t%nb;
+            {
+                std::unique_lock<std::mutex> lock(mtx);
+                cond.wait(lock, [&]{ return m>nstop || done1[b]>=m; });
+                if(m>nstop)
+                {
+                    return;
+                }
+            }
+            point_Jacobi_lines(maingrid, wr(m), rd(m), viscx, viscy, dt, src, lo[b], hi[b]);
+            publish(done2, b, m);
+        }
+    };
+
+    for(int t=0; t<nthreads; t++)
+    {
+        workers.push_back(std::thread(stage1));
+        workers.push_back(std::thread(stage2));
+    }
+
+    /* Stage 3 runs here, block by block in order */
+    int m;
+    for(m=nfirst; m<=nstop; m++)
+    {
+        Array3& un = wr(m);
+        Array3& uo = rd(m);
+        if(iinit==2 && irstr==0)
+        {
+            ulid = uinf*fmin(one, (double)(m)/(double)(nramp));
+        }
+        for(int b=0; b<nb; b++)
+        {
+            double *sb = &sums[b*(neq+2)];
+            double uvel2;           /* Local velocity squared */
+            double beta2;           /* Beta squared parameter for time derivative preconditioning */
+            double a;               /* Scaled pressure change */
+            double c;               /* Scale, 1/(beta2 dt) */
+            double r;               /* Local momentum residual */
+            {
+                std::unique_lock<std::mutex> lock(mtx);
+                cond.wait(lock, [&]{ return done2[b]>=m; });
+            }
+            set_boundary_lines(maingrid, un, (b==0) ? 0 : lo[b], (b==nb-1) ? imax : hi[b]);
+
+            for(int k=0; k<neq+2; k++)
+            {
+                sb[k] = zero;
+            }
+            for(int i=lo[b]; i<hi[b]; i++)
+            {
+                for(int j=1; j<jmax-1; j++)
+                {
+                    uvel2 = pow2(un(i,j,1)) + pow2(un(i,j,2));
+                    beta2 = fmax(uvel2,rkappa*uinf);
+                    c = one/(beta2*dt(i,j));
+                    a = (un(i,j,0) - uo(i,j,0))*c;
+                    sb[0] += a*a;
+                    sb[1] += a*c;
+                    sb[2] += c*c;
+                    for(int k=1; k<neq; k++)
+                    {
+                        r = rho*(un(i,j,k) - uo(i,j,k))*visc_diag(maingrid, dt(i,j))/dt(i,j);
+                        sb[k+2] += r*r;
+                    }
+                }
+            }
+            if(b<nb-1)
+            {
+                publish(done3, b, m);
+            }
+        }
+
+        /* All blocks of iteration m are in: finish the residuals (fixed block order) */
+        double s0 = zero, s1 = zero, s2 = zero;     /* Continuity residual sums */
+        double shift = un(iref,jref,0) - pcprev;    /* Change of the center pressure */
+        for(int k=1; k<neq; k++)
+        {
+            res[k] = zero;
+        }
+        for(int b=0; b<nb; b++)
+        {
+            s0 += sums[b*(neq+2)];
+            s1 += sums[b*(neq+2)+1];
+            s2 += sums[b*(neq+2)+2];
+            for(int k=1; k<neq; k++)
+            {
+                res[k] += sums[b*(neq+2)+k+2];
+            }
+        }
+        res[0] = sqrt(fmax(zero, s0 - two*shift*s1 + shift*shift*s2)/double(imax*jmax));
+        for(int k=1; k<neq; k++)
+        {
+            res[k] = sqrt(res[k]/double(imax*jmax));
+        }
+        pcprev = un(iref,jref,0);
+        dtmin = dtlast[m%2];
+        rtime += dtmin;
+        report_iterative_convergence(m, res, resinit, ninit, rtime, dtmin, conv);
+
+        {
+            std::lock_guard<std::mutex> lock(mtx);
+            if(conv<toler || m==nlast)
+            {
+                nstop = m;          /* Stage 1/2 work on later iterations is discarded */
+            }
+            done3[nb-1] = m;
+        }
+        cond.notify_all();
+        if(nstop==m)
+        {
+            break;
+        }
+    }
+
+    for(size_t t=0; t<workers.size(); t++)
+    {
+        workers[t].join();
+    }
+
+    /* Leave the last solution in u. uold is not the previous iterate after a stop: stage 2 of    */
+    /* iteration m+1 may already have overwritten some of its blocks (and stage 1 those of dt,    */
+    /* viscx, viscy) with the discarded update. The caller only uses u, and the next call starts  */
+    /* from u alone.                                                                              */
+    if(&wr(m)==&uold)
+    {
+        u.swapData(uold);
+    }
+    return m;
+}
+
+/**************************************************************************/
+
+void point_Jacobi_faces( const GridGeometry& g, Array3& u, Array3& uold, Array2& viscx, Array2& viscy, Array2& dt, const Array3& s, int i0, int i1 )
+{
+    /* 
+    Uses global variable(s): half, two, rho, rhoinv, rkappa, vel2ref
+    Uses: g (points, spacing, viscosity), uold, artviscx, artviscy, dt, s
+    To Modify: u (interior lines i0 <= i < i1)
+    Point Jacobi with the differences of p, u, v formed once per face and shared by the two
+    nodes of the face: the central first derivative is the mean of the two face differences,
+    the second derivative their difference. Same discretization as 'point_Jacobi_lines'.
+    */
+    static thread_local std::vector<double> fw;     /* x-face differences on face i-1/2 (p, u, v per j) */
+    static thread_local std::vector<double> fe;     /* x-face differences on face i+1/2 */
+    static thread_local std::vector<double> fy;     /* y-face differences on faces j+1/2 of line i */
+    double rdx2 = half/g.hx;            /* 1/(2 hx) */
+    double rdy2 = half/g.hy;            /* 1/(2 hy) */
+    double rdxx = one/(g.hx*g.hx);      /* 1/hx^2 */
+    double rdyy = one/(g.hy*g.hy);      /* 1/hy^2 */
+
+    /* Scratch kept per thread across calls (pipeline and batch threads live for the whole run) */
+    fw.resize(3*g.nj);
+    fe.resize(3*g.nj);
+    fy.resize(3*g.nj);
+
+    for(int j=1; j<g.nj-1; j++)
+    {
+        for(int k=0; k<neq; k++)
+        {
+            fw[3*j+k] = uold(i0,j,k) - uold(i0-1,j,k);
+        }
+    }
+
+    for(int i=i0; i<i1; i++)
+    {
+        for(int j=1; j<g.nj-1; j++)
+        {
+            for(int k=0; k<neq; k++)
+            {
+                fe[3*j+k] = uold(i+1,j,k) - uold(i,j,k);
+            }
+        }
+        for(int j=0; j<g.nj-1; j++)
+        {
+            for(int k=0; k<neq; k++)
+            {
+                fy[3*j+k] = uold(i,j+1,k) - uold(i,j,k);
+            }
+        }
+
+        for(int j=1; j<g.nj-1; j++)
+        {
+            double *e = &fe[3*j];       /* East face */
+            double *w = &fw[3*j];       /* West face */
+            double *n = &fy[3*j];       /* North face */
+            double *so = &fy[3*j-3];    /* South face */
+            double dtl = dt(i,j);
+            double uvel2 = pow2(u(i,j,1)) + pow2(u(i,j,2));     /* As 'point_Jacobi' (u, not uold) */
+            double beta2 = fmax(uvel2,rkappa*vel2ref);
+            double uc = uold(i,j,1);
+            double vc = uold(i,j,2);
+            double rmom = dtl*rhoinv/visc_diag(g, dtl);
+
+            u(i,j,0) = uold(i,j,0) - beta2*dtl*( rho*(e[1] + w[1])*rdx2 + rho*(n[2] + so[2])*rdy2
+                                                - viscx(i,j) - viscy(i,j) - s(i,j,0) );
+            u(i,j,1) = uc - rmom*( rho*uc*(e[1] + w[1])*rdx2 + rho*vc*(n[1] + so[1])*rdy2 + (e[0] + w[0])*rdx2
+                                 - g.mu*(e[1] - w[1])*rdxx - g.mu*(n[1] - so[1])*rdyy - s(i,j,1) );
+            u(i,j,2) = vc - rmom*( rho*uc*(e[2] + w[2])*rdx2 + rho*vc*(n[2] + so[2])*rdy2 + (n[0] + so[0])*rdy2
+                                 - g.mu*(e[2] - w[2])*rdxx - g.mu*(n[2] - so[2])*rdyy - s(i,j,2) );
+        }
+        fw.swap(fe);
+    }
+}
+
+/**************************************************************************/
+
+void artificial_viscosity_faces( const GridGeometry& g, Array3& u, Array2& viscx, Array2& viscy, int i0, int i1 )
+{
+    /* 
+    Uses global variable(s): three, four, rkappa, uinf, Cx, Cy
+    Uses: g (points and spacing), u
+    To Modify: artviscx, artviscy (nodes 2 <= i < ni-2, 2 <= j < nj-2 of lines i0 <= i < i1)
+    4th-difference pressure dissipation of 'artificial_viscosity_lines' with the third
+    difference t(i+1/2) = p(i+2) - 3 p(i+1) + 3 p(i) - p(i-1) formed once per face and
+    shared by its two nodes: d4p(i) = t(i+1/2) - t(i-1/2). Same as the 5-point stencil up
+    to round-off.
+    */
+    static thread_local std::vector<double> tw;     /* x-face third differences on face i-1/2 (per j) */
+    static thread_local std::vector<double> te;     /* x-face third differences on face i+1/2 */
+    static thread_local std::vector<double> ty;     /* y-face third differences on faces j+1/2 of line i */
+    int ia = max(i0,2);                 /* First and last+1 line with a full 5-point stencil */
+    int ib = min(i1,g.ni-2);
+
+    tw.resize(g.nj);
+    te.resize(g.nj);
+    ty.resize(g.nj);
+
+    if(ia>=ib)
+    {
+        return;
+    }
+    for(int j=2; j<g.nj-2; j++)
+    {
+        tw[j] = u(ia+1,j,0) - three*u(ia,j,0) + three*u(ia-1,j,0) - u(ia-2,j,0);
+    }
+
+    for(int i=ia; i<ib; i++)
+    {
+        for(int j=2; j<g.nj-2; j++)
+        {
+            te[j] = u(i+2,j,0) - three*u(i+1,j,0) + three*u(i,j,0) - u(i-1,j,0);
+        }
+        for(int j=1; j<g.nj-2; j++)
+        {
+            ty[j] = u(i,j+2,0) - three*u(i,j+1,0) + three*u(i,j,0) - u(i,j-1,0);
+        }
+
+        for(int j=2; j<g.nj-2; j++)
+        {
+            double uvel2 = pow2(u(i,j,1)) + pow2(u(i,j,2));
+            double beta2 = fmax(uvel2,rkappa*uinf);
+            double lambda_x = 0.5 * (fabs(u(i,j,1)) +  sqrt(uvel2 + four*beta2));
+            double lambda_y = 0.5 * (fabs(u(i,j,2)) +  sqrt(uvel2 + four*beta2));
+
+            viscx(i,j) = (-lambda_x*Cx*(te[j] - tw[j])/g.hx)/beta2;
+            viscy(i,j) = (-lambda_y*Cy*(ty[j] - ty[j-1])/g.hy)/beta2;
+        }
+        tw.swap(te);
+    }
+}
+
+/**************************************************************************/
+
+const char* map_file( const char *path, size_t& nbytes )
+{
+    /* 
+    Maps 'path' read-only into memory
+    Returns: start of the mapping (NULL on failure); nbytes = file size
+    */
+    int fd;                      /* File descriptor */
+    struct stat st;              /* File status */
+    void *map;                   /* Mapping */
+
+    fd = open(path, O_RDONLY);
+    if(fd<0)
+    {
+        return NULL;
+    }
+    if(fstat(fd, &st)!=0 || st.st_size==0)
+    {
+        close(fd);
+        return NULL;
+    }
+    nbytes = (size_t)(st.st_size);
+    map = mmap(NULL, nbytes, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);                   /* The mapping stays valid */
+    if(map==MAP_FAILED)
+    {
+        return NULL;
+    }
+    madvise(map, nbytes, MADV_SEQUENTIAL);
+    return (const char *)(map);
+}
+
+/**************************************************************************/
+
+int parse_double_fast( const char*& p, const char *end, double& value )
+{
+    /* 
+    Parses the next number in [p,end) and advances p past it; the number must end at
+    whitespace or at end ("1.2.3" and "12abc" are not numbers)
+    Numbers with at most 15 significant digits and a decimal exponent within +-22
+    (all of the %e output) take the exact fast path: integer mantissa times or
+    divided by an exact power of ten, a single rounding. Everything else (long
+    mantissas, nan, inf) goes through strtod.
+    Returns: 1 = number parsed, 0 = no more numbers, -1 = not a number
+    */
+    static const double pow10[23] = {1e0, 1e1, 1e2, 1e3, 1e4, 1e5, 1e6, 1e7, 1e8, 1e9, 1e10, 1e11,
+                                     1e12, 1e13, 1e14, 1e15, 1e16, 1e17, 1e18, 1e19, 1e20, 1e21, 1e22};
+    const char *start;           /* Start of the token */
+    unsigned long long mant = 0; /* Decimal mantissa */
+    int ndig = 0;                /* Significant digits in the mantissa */
+    int exp10 = 0;               /* Decimal exponent applied to the mantissa */
+    int eexp = 0;                /* Exponent after 'e' */
+    int neg = 0;                 /* Sign of the number */
+    int eneg = 0;                /* Sign of the exponent */
+    int any = 0;                 /* = 1 once a digit has been seen */
+
+    while(p<end && (*p==' ' || *p=='\t' || *p=='\n' || *p=='\r'))
+    {
+        p++;
+    }
+    if(p>=end)
+    {
+        return 0;
+    }
+    start = p;
+    if(*p=='-' || *p=='+')
+    {
+        neg = (*p=='-');
+        p++;
+    }
+    while(p<end && *p>='0' && *p<='9')
+    {
+        if(ndig<19 && (mant>0 || *p!='0'))
+        {
+            mant = 10*mant + (unsigned long long)(*p - '0');
+            ndig++;
+        }
+        else if(mant>0)
+        {
+            exp10++;             /* Digit beyond the mantissa: only its place value counts */
+            ndig++;
+        }
+        any = 1;
+        p++;
+    }
+    if(p<end && *p=='.')
+    {
+        p++;
+        while(p<end && *p>='0' && *p<='9')
+        {
+            if(ndig<19 && (mant>0 || *p!='0'))
+            {
+                mant = 10*mant + (unsigned long long)(*p - '0');
+                ndig++;
+                exp10--;
+            }
+            else if(mant==0)
+            {
+                exp10--;         /* Leading zero after the point */
+            }
+            else
+            {
+                ndig++;
+            }
+            any = 1;
+            p++;
+        }
+    }
+    if(any && p<end && (*p=='e' || *p=='E'))
+    {
+        p++;
+        if(p<end && (*p=='-' || *p=='+'))
+        {
+            eneg = (*p=='-');
+            p++;
+        }
+        while(p<end && *p>='0' && *p<='9')
+        {
+            if(eexp<100000)
+            {
+                eexp = 10*eexp + (*p - '0');
+            }
+            p++;
+        }
+        exp10 += eneg ? -eexp : eexp;
+    }
+
+    if(any && ndig<=15 && exp10>=-22 && exp10<=22)
+    {
+        if(p<end && *p!=' ' && *p!='\t' && *p!='\n' && *p!='\r')
+        {
+            return -1;           /* Trailing characters after the number */
+        }
+        value = (exp10>=0) ? (double)(mant)*pow10[exp10] : (double)(mant)/pow10[-exp10];
+        value = neg ? -value : value;
+        return 1;
+    }
+
+    /* Slow path: copy the token (the mapping is not NUL terminated) */
+    char tok[64];
+    char *tend;
+    size_t len;
+    p = start;
+    while(p<end && *p!=' ' && *p!='\t' && *p!='\n' && *p!='\r')
+    {
+        p++;
+    }
+    len = min((size_t)(p - start), sizeof(tok)-1);
+    memcpy(tok, start, len);
+    tok[len] = '\0';
+    value = strtod(tok, &tend);
+    return (tend==tok || tend!=tok+len) ? -1 : 1;
+}
+
+/**************************************************************************/
+
+long parse_doubles_parallel( const char *begin, const char *end, std::vector<double>& out )
+{
+    /* 
+    Uses global variable(s): nparsethreads
+    Parses all numbers in [begin,end) into out (in file order), splitting the text into
+    line-aligned chunks parsed concurrently
+    Returns: number of values, -1 if something that is not a number was found
+    */
+    int nthreads = (nparsethreads>0) ? nparsethreads : (int)(std::thread::hardware_concurrency());
+    nthreads = max(1, min(nthreads, (int)((end - begin)/65536) + 1));   /* At least 64 kB per chunk */
+
+    std::vector<const char *> cut(nthreads+1);          /* Chunk boundaries (line starts) */
+    std::vector< std::vector<double> > part(nthreads);   /* Values per chunk */
+    std::vector<int> bad(nthreads, 0);                   /* = 1 if a chunk hit a bad token */
+    std::vector<std::thread> workers;                    /* Parser threads */
+    size_t nvals = 0;                                    /* Total number of values */
+
+    cut[0] = begin;
+    cut[nthreads] = end;
+    for(int t=1; t<nthreads; t++)
+    {
+        const char *c = begin + (size_t)(end - begin)*(size_t)(t)/(size_t)(nthreads);
+        c = max(c, cut[t-1]);
+        const char *nl = (const char *)memchr(c, '\n', (size_t)(end - c));
+        cut[t] = (nl==NULL) ? end : nl + 1;
+    }
+
+    for(int t=0; t<nthreads; t++)
+    {
+        workers.push_back(std::thread([&, t]()
+        {
+            const char *p = cut[t];
+            double v;
+            int status;
+            part[t].reserve((size_t)(cut[t+1] - cut[t])/13 + 1);   /* "%e " is 13 bytes */
+            while((status = parse_double_fast(p, cut[t+1], v))==1)
+            {
+                part[t].push_back(v);
+            }
+            bad[t] = (status<0) ? 1 : 0;
+        }));
+    }
+    for(int t=0; t<nthreads; t++)
+    {
+        workers[t].join();
+    }
+    for(int t=0; t<nthreads; t++)
+    {
+        if(bad[t]==1)
+        {
+            return -1;
+        }
+        nvals += part[t].size();
+    }
+
+    out.clear();
+    out.reserve(nvals);
+    for(int t=0; t<nthreads; t++)
+    {
+        out.insert(out.end(), part[t].begin(), part[t].end());
+    }
+    return (long)(nvals);
+}
+
+/**************************************************************************/
+
+int read_restart_fast( const char *path, int& ninit, double& rtime, double resinit[neq], Array3& u )
+{
+    /* 
+    Uses global variable(s): imax, jmax, neq
+    Reads an ASCII restart file ('write_output' format: n rtime / resinit / x y p u v per point)
+    Returns: 1 on success, 0 on failure
+    */
+    size_t nbytes;               /* File size */
+    const char *map;             /* File contents */
+    std::vector<double> vals;    /* All numbers in the file */
+    long nvals;                  /* Number of values parsed */
+    long nexpect = 2 + neq + 5*(long)(imax)*(long)(jmax);   /* Expected number of values */
+
+    map = map_file(path, nbytes);
+    if(map==NULL)
+    {
+        return 0;
+    }
+    nvals = parse_doubles_parallel(map, map + nbytes, vals);
+    munmap((void *)(map), nbytes);
+    if(nvals!=nexpect)
+    {
+        printf("Restart file '%s' has %ld values, expected %ld for a %d x %d grid\n", path, nvals, nexpect, imax, jmax);
+        return 0;
+    }
+
+    ninit = (int)(vals[0]);
+    rtime = vals[1];
+    for(int k=0; k<neq; k++)
+    {
+        resinit[k] = vals[2+k];
+    }
+    for(int i=0; i<imax; i++)
+    {
+        for(int j=0; j<jmax; j++)
+        {
+            const double *row = &vals[2 + neq + 5*((size_t)(i)*(size_t)(jmax) + (size_t)(j))];
+            u(i,j,0) = row[2];
+            u(i,j,1) = row[3];
+            u(i,j,2) = row[4];
+        }
+    }
+    return 1;
+}
+
+/**************************************************************************/
+
+void convert_legacy( const char *path )
+{
+    /* 
+    Uses global variable(s): imax, jmax, neq, xmin, xmax, ymin, ymax
+    Converts a legacy ASCII file to binary, next to it as '<path>.bin':
+        restart file  -> binary restart ('write_checkpoint_binary' format)
+        cavity.dat    -> one StreamFrameHeader + p, u, v planes per zone ('stream_frame'
+                         format), so archived histories feed the same post-processing chain
+    */
+    char binpath[512];           /* Output file name */
+    size_t nbytes;               /* File size */
+    const char *map;             /* File contents */
+    std::vector<double> vals;    /* Numbers of one zone */
+    double resinit[neq];         /* Initial residuals (restart file) */
+    double rtime;                /* Pseudo time (restart file) */
+    int n;                       /* Iteration (restart file) */
+    int nzone = 0;               /* Number of zones converted */
+
+    snprintf(binpath, sizeof(binpath), "%s.bin", path);
+    map = map_file(path, nbytes);
+    if(map==NULL)
+    {
+        printf("ERROR: cannot read legacy file '%s'!\n", path);
+        exit (0);
+    }
+
+    if(nbytes<5 || strncmp(map, "TITLE", 5)!=0)      /* Restart file */
+    {
+        Array3 u(imax, jmax, neq);
+        munmap((void *)(map), nbytes);
+        if(read_restart_fast(path, n, rtime, resinit, u)==0 || write_checkpoint_binary(binpath, n, rtime, resinit, u)==0)
+        {
+            printf("ERROR: could not convert restart file '%s'!\n", path);
+            exit (0);
+        }
+        printf("Converted restart file '%s' (iteration %d) to '%s'\n", path, n, binpath);
+        return;
+    }
+
+    /* Field file: text headers, then zones of "zone T=..." / "I= .. J= .." / "DATAPACKING=POINT" / data */
+    /* ("zone" in any case, as Tecplot writes "ZONE")                                                    */
+    FILE *fpb = fopen(binpath, "wb");
+    const char *end = map + nbytes;
+    const char *p = map;
+    auto is_zone = [&](const char *q) { return end - q>=4 && strncasecmp(q, "zone", 4)==0; };
+    if(fpb==NULL)
+    {
+        printf("ERROR: cannot write '%s'!\n", binpath);
+        exit (0);
+    }
+    while(p<end)
+    {
+        const char *z = NULL;           /* Next zone line */
+        for(const char *q = p; q<end; )
+        {
+            if(is_zone(q))
+            {
+                z = q;
+                break;
+            }
+            const char *nl = (const char *)memchr(q, '\n', (size_t)(end - q));
+            q = (nl==NULL) ? end : nl + 1;
+        }
+        if(z==NULL)
+        {
+            break;
+        }
+
+        /* Zone header: iteration and dimensions (three short lines) */
+        int nz = 0, ni = 0, nj = 0;
+        const char *data = z;
+        char line[256];
+        for(int l=0; l<3 && data<end; l++)
+        {
+            const char *nl = (const char *)memchr(data, '\n', (size_t)(end - data));
+            size_t len = min((size_t)(((nl==NULL) ? end : nl) - data), sizeof(line)-1);
+            memcpy(line, data, len);
+            line[len] = '\0';
+            if(strncasecmp(line, "zone", 4)==0)
+            {
+                sscanf(line + 4, " T=\"n=%d\"", &nz);
+            }
+            sscanf(line, "I= %d J= %d", &ni, &nj);
+            data = (nl==NULL) ? end : nl + 1;
+        }
+
+        /* Data block runs up to the next zone */
+        const char *dend = end;
+        for(const char *q = data; q<end; )
+        {
+            if(is_zone(q))
+            {
+                dend = q;
+                break;
+            }
+            const char *nl = (const char *)memchr(q, '\n', (size_t)(end - q));
+            q = (nl==NULL) ? end : nl + 1;
+        }
+        long nvals = parse_doubles_parallel(data, dend, vals);
+        long npts = (long)(ni)*(long)(nj);
+        if(npts<=0 || nvals<=0 || nvals%npts!=0 || nvals/npts<5)
+        {
+            printf("ERROR: zone %d of '%s' is not a %d x %d point block!\n", nzone+1, path, ni, nj);
+            exit (0);
+        }
+        int ncol = (int)(nvals/npts);      /* 5 columns, or 11 for MMS output */
+
+        StreamFrameHeader hdr;
+        memset(&hdr, 0, sizeof(hdr));
+        memcpy(hdr.magic, "CAVFRAME", 8);
+        hdr.version = 1;
+        hdr.ni = ni;
+        hdr.nj = nj;
+        hdr.nplanes = neq;
+        hdr.n = nz;
+        hdr.xmin = vals[0];
+        hdr.ymin = vals[1];
+        hdr.xmax = vals[(size_t)(npts-1)*ncol];
+        hdr.ymax = vals[(size_t)(npts-1)*ncol + 1];
+        hdr.payload = (unsigned long long)(neq)*(unsigned long long)(npts)*sizeof(double);
+        fwrite(&hdr, sizeof(hdr), 1, fpb);
+        for(int k=0; k<neq; k++)
+        {
+            std::vector<double> plane(npts);
+            for(long m=0; m<npts; m++)
+            {
+                plane[m] = vals[(size_t)(m)*ncol + 2 + k];
+            }
+            fwrite(plane.data(), sizeof(double), npts, fpb);
+        }
+        nzone++;
+        p = dend;
+    }
+    munmap((void *)(map), nbytes);
+
+    StreamFrameHeader eos;      /* End-of-stream marker, as 'stream_close' */
+    memset(&eos, 0, sizeof(eos));
+    memcpy(eos.magic, "CAVFRAME", 8);
+    eos.version = 1;
+    eos.flags = 1;
+    fwrite(&eos, sizeof(eos), 1, fpb);
+    fclose(fpb);
+    printf("Converted %d zones of '%s' to '%s'\n", nzone, path, binpath);
+}
+
+/**************************************************************************/
+
+double wall_clock()
+{
+    /* 
+    Returns: wall-clock seconds since the first call (made at the start of main)
+    */
+    static const std::chrono::steady_clock::time_point t0 = std::chrono::steady_clock::now();
+
+    return std::chrono::duration<double>(std::chrono::steady_clock::now() - t0).count();
+}
+
+/**************************************************************************/
+
+int budget_exhausted( double titer, double tfinal )
+{
+    /* 
+    Uses global variable(s): tbudget, budgetreserve
+    Returns: 1 if one more iteration (titer) plus the final output (tfinal) would run
+    into the reserve at the end of the wall-clock budget, 0 otherwise (or without a budget)
+    */
+    if(tbudget<=0.0)
+    {
+        return 0;
+    }
+    return (wall_clock() + titer + tfinal > (1.0 - budgetreserve)*tbudget) ? 1 : 0;
+}
+
+/**************************************************************************/
+
+int budget_allows_output( double tlast, double tcost )
+{
+    /* 
+    Uses global variable(s): tbudget, budgetio
+    Returns: 1 if a periodic write that costs tcost seconds may go ahead, i.e. at least
+    tcost/budgetio seconds have passed since the last one at tlast (always 1 without a budget)
+    */
+    if(tbudget<=0.0)
+    {
+        return 1;
+    }
+    return (wall_clock() - tlast >= tcost/budgetio) ? 1 : 0;
+}
+
+/**************************************************************************/
+
+double predict_memory( int ni, int nj )
+{
+    /* 
+    Uses global variable(s): neq, iengine, istats, ipipe, iinit, irstr, tbudget
+    Inputs: ni, nj (grid points in x and y)
+    Returns: bytes of field storage an ni x nj run allocates (arrays in main plus the
+    engine, statistics, stream and Stokes work arrays that the inputs switch on)
+    */
+    double np = (double)(ni)*(double)(nj);          /* Nodes */
+    double nx = (double)(ni - 1);                   /* Cells in x */
+    double ny = (double)(nj - 1);                   /* Cells in y */
+    double ndoubles;                                /* Doubles allocated */
+
+    ndoubles = (double)(4*neq + 3)*np;              /* u, uold, src, shared inputs; viscx, viscy, dt */
+    if(tbudget>0.0)
+    {
+        ndoubles += (double)(neq)*np;               /* ubest */
+    }
+    if(iengine==1)
+    {
+        ndoubles += 15.0*nx*ny;                     /* lbm_f (9), lbm_m (3), lbm_s (3) */
+    }
+    if(iengine==2)
+    {
+        ndoubles += 9.0*(nx + 1.0)*ny + 9.0*nx*(ny + 1.0);   /* Face velocities, predictions, d, coefficients */
+        ndoubles += 12.0*nx*ny;                     /* p, pc, ap (6), CG work arrays (4) */
+    }
+    if(iengine==3)
+    {
+        ndoubles += (double)(neq)*np + 150.0*np;    /* dc_r; AMG operators (15 entries per row), transfers, work */
+    }
+    if(istats==1)
+    {
+        ndoubles += (double)(4*neq)*np;             /* Mean, M2, min, max */
+    }
+    if(ipipe==1)
+    {
+        ndoubles += (double)(2*neq)*np;             /* Two frame buffers */
+    }
+    if(iinit==1 && irstr==0)
+    {
+        ndoubles += 7.0*np;                         /* Stokes initial condition work arrays (freed) */
+    }
+    return 8.0*ndoubles;
+}
+
+/**************************************************************************/
+
+int read_history( const char *path, int& ni, int& nj, double& rehist, double& lr0, std::vector<double>& its, std::vector<double>& drop )
+{
+    /* 
+    Uses global variable(s): imax, jmax, Re
+    Inputs: path (history.dat of a past run)
+    To modify: ni, nj, rehist (grid and Reynolds number from the '# run:' line; the compiled
+    imax, jmax, Re for files written before the line was added), lr0 (log10 of the largest
+    residual on the first line), its (iterations since the first line), drop (decades of
+    max(Res1,Res2,Res3) below the first line)
+    Returns: number of residual lines (0 if the file is missing)
+    */
+    FILE *fp;                    /* History file */
+    char line[512];              /* One line of the file */
+    int it;                      /* Iteration of a line */
+    int nfirst = -1;             /* First iteration */
+    double t;                    /* Time of a line */
+    double r[3];                 /* Residuals of a line */
+    double lr;                   /* log10 of the largest residual */
+
+    lr0 = 0.0;
+    ni = imax;
+    nj = jmax;
+    rehist = Re;
+    its.clear();
+    drop.clear();
+    fp = fopen(path, "r");
+    if(fp==NULL)
+    {
+        return 0;
+    }
+    while(fgets(line, sizeof(line), fp)!=NULL)
+    {
+        if(strncmp(line, "# run:", 6)==0)
+        {
+            sscanf(line, "# run: imax= %d jmax= %d Re= %lf", &ni, &nj, &rehist);
+            continue;
+        }
+        if(sscanf(line, "%d %lf %lf %lf %lf", &it, &t, &r[0], &r[1], &r[2])!=5)
+        {
+            continue;            /* TITLE, variables */
+        }
+        lr = log10(fmax(fmax(r[0], r[1]), fmax(r[2], 1.0e-300)));
+        if(nfirst<0)
+        {
+            nfirst = it;
+            lr0 = lr;
+        }
+        its.push_back((double)(it - nfirst));
+        drop.push_back(lr0 - lr);
+    }
+    fclose(fp);
+    return (int)(its.size());
+}
+
+/**************************************************************************/
+
+double history_iterations( std::vector<double>& its, std::vector<double>& drop, double target, double& rate )
+{
+    /* 
+    Inputs: its, drop (from 'read_history'), target (decades of drop wanted)
+    To modify: rate (decades per iteration of the tail: least-squares line through the
+    points in the upper half of the drop)
+    Returns: iterations until the residual first fell 'target' decades, interpolated along
+    the history, or extrapolated at 'rate' past its end (-1 if it cannot be reached)
+    */
+    int np = (int)(its.size());  /* Points */
+    int m = 0;                   /* Points in the tail fit */
+    double dmax = 0.0;           /* Largest drop reached */
+    double sx = 0.0, sy = 0.0, sxx = 0.0, sxy = 0.0;
+
+    rate = 0.0;
+    for(int l=0; l<np; l++)
+    {
+        if(drop[l]>=target)
+        {
+            if(l==0)
+            {
+                return 0.0;
+            }
+            return its[l-1] + (its[l] - its[l-1])*(target - drop[l-1])/fmax(drop[l] - drop[l-1], 1.0e-300);
+        }
+        dmax = fmax(dmax, drop[l]);
+    }
+    for(int l=0; l<np; l++)
+    {
+        if(drop[l]>=0.5*dmax)
+        {
+            m++;
+            sx += its[l];
+            sy += drop[l];
+            sxx += its[l]*its[l];
+            sxy += its[l]*drop[l];
+        }
+    }
+    if(m<4 || (double)(m)*sxx - sx*sx<=0.0)
+    {
+        return -1.0;
+    }
+    rate = ((double)(m)*sxy - sx*sy)/((double)(m)*sxx - sx*sx);
+    if(rate<=0.0)
+    {
+        return -1.0;
+    }
+    return its[np-1] + (target - drop[np-1])/rate;
+}
+
+/**************************************************************************/
+
+double calibrate_iteration( iterationStepPointer iterationStep, timeStepPointer set_time_step, boundaryConditionPointer set_boundary_conditions, Array3& u, Array3& uold, Array3& src, Array2& viscx, Array2& viscy, Array2& dt, int nthreads, double& fpar )
+{
+    /* 
+    Uses global variable(s): imax, iengine, isgs, ipipeline, maingrid
+    Inputs: nthreads (threads of this node)
+    To modify: u, uold, src, viscx, viscy, dt (scratch: the run stops after the prediction)
+    Returns: wall-clock seconds per iteration (time step, iteration step, pressure rescaling)
+    of the compiled configuration on the compiled imax x jmax grid, on one thread of this node.
+    fpar: parallel fraction (Amdahl) of the iteration, -1 if the configuration has no
+    parallel kernel or it cannot be measured on this node:
+        lattice Boltzmann (OpenMP): fitted from the same iterations timed again on all
+            'nthreads' threads, so memory bandwidth limits are included; -1 on one thread
+        pipelined point Jacobi: share of the one-thread iteration spent in the kernels of
+            pipeline stages 1 and 2 (time step, dissipation, point update). The stages only
+            run inside 'pipeline_run', so this is an upper bound that ignores contention
+    */
+    int ninit = 0;               /* Initial iteration number */
+    int ncal = 0;                /* Iterations of the last timing */
+    int none;                    /* Iterations of the one-thread timing */
+    double rtime;                /* Simulation time (not used) */
+    double resinit[neq];         /* Initial residuals (not used) */
+    double dtmin = 1.0e99;       /* Minimum time step */
+    double t0;                   /* Start of the timed iterations */
+    double tone;                 /* Seconds per iteration on one thread */
+
+    initial( ninit, rtime, resinit, u, src );
+    set_boundary_conditions( u );
+    if(iengine==1)
+    {
+        lbm_initialize( u );
+    }
+    if(iengine==2)
+    {
+        mac_initialize( u );
+    }
+    compute_source_terms( src );
+
+    auto timed = [&](int nrun) -> double
+    {
+        /* nrun iterations, or (nrun = 0) at least 0.5 s and 5 iterations; sets ncal */
+        double t = wall_clock();
+        ncal = 0;
+        while((nrun>0) ? ncal<nrun : (ncal<5 || (wall_clock() - t<0.5 && ncal<1000)))
+        {
+            set_time_step( u, dt, dtmin );
+            iterationStep( set_boundary_conditions, u, uold, src, viscx, viscy, dt );
+            pressure_rescaling( maingrid, u );
+            ncal++;
+        }
+        return (wall_clock() - t)/(double)(ncal);
+    };
+
+#ifdef _OPENMP
+    int nomp = omp_get_max_threads();       /* OpenMP threads to restore */
+    omp_set_num_threads(1);
+#endif
+    /* One untimed warm-up iteration (page faults, first touch), then the one-thread timing */
+    timed(1);
+    tone = timed(0);
+    none = ncal;
+    fpar = -1.0;
+
+#ifdef _OPENMP
+    int npar = parallel_threads(nthreads);  /* OpenMP threads of the lattice Boltzmann sweep */
+    if(iengine==1 && npar>1)
+    {
+        omp_set_num_threads(npar);
+        timed(1);
+        double tpar = timed(none);          /* Seconds per iteration on npar threads */
+
+        /* Amdahl: tpar/tone = (1 - f) + f/npar */
+        fpar = (1.0 - tpar/tone)/(1.0 - 1.0/(double)(npar));
+        fpar = fmin(fmax(fpar, 0.0), 1.0);
+    }
+    omp_set_num_threads(nomp);
+#endif
+    if(iengine==0 && isgs==0 && ipipeline==1)
+    {
+        double dtl;                         /* Time step of the last point (not used) */
+        t0 = wall_clock();
+        for(int m=0; m<none; m++)
+        {
+            time_step_lines(maingrid, u, dt, dtl, 1, imax-1);
+            artificial_viscosity_lines(maingrid, u, viscx, viscy, 1, imax-1);
+            point_Jacobi_lines(maingrid, uold, u, viscx, viscy, dt, src, 1, imax-1);
+        }
+        fpar = fmin((wall_clock() - t0)/(double)(none)/tone, 1.0);
+    }
+    return tone;
+}
+
+/**************************************************************************/
+
+int parallel_threads( int nthreads )
+{
+    /* 
+    Uses global variable(s): iengine, isgs, ipipeline, npipethreads
+    Inputs: nthreads (threads available to the run)
+    Returns: threads the compiled configuration can use. Only the lattice Boltzmann sweep
+    (OpenMP) and the pipelined point Jacobi stages run in parallel; everything else is serial
+    */
+    int nuse = 1;                /* Threads the solver can use */
+
+#ifdef _OPENMP
+    if(iengine==1)
+    {
+        nuse = nthreads;
+    }
+#endif
+    if(iengine==0 && isgs==0 && ipipeline==1)
+    {
+        nuse = min(nthreads, 2*npipethreads + 1);
+    }
+    return max(nuse, 1);
+}
+
+/**************************************************************************/
+
+double predict_speedup( int nthreads, double fpar )
+{
+    /* 
+    Inputs: nthreads (threads available to the run), fpar (parallel fraction from
+    'calibrate_iteration'; < 0 if not fitted, then 90% parallel is assumed)
+    Returns: modelled (Amdahl) speedup over one thread of the compiled configuration
+    */
+    double f = (fpar>=0.0) ? fpar : 0.9;     /* Parallel fraction */
+
+    return 1.0/((1.0 - f) + f/(double)(parallel_threads(nthreads)));
+}
+
+/**************************************************************************/
+
+void predict_job( iterationStepPointer iterationStep, timeStepPointer set_time_step, boundaryConditionPointer set_boundary_conditions, Array3& u, Array3& uold, Array3& src, Array2& viscx, Array2& viscy, Array2& dt )
+{
+    /* 
+    Uses global variable(s): imax, jmax, Re, toler, iengine, isgs, icheck, ipipe, tbudget,
+                             npredi, npredj, npredthreads, predhist, predsafety, rlength, uinf, rho, rmu
+    To modify: u, uold, src, viscx, viscy, dt (scratch for the calibration)
+    Prints the memory footprint, time per iteration and iterations to 'toler' predicted
+    for an npredi x npredj run, and a recommended allocation (threads, memory, wall time).
+
+    Time per iteration: a short calibration of the compiled kernels on this node, scaled
+    by the number of points (so calibrate on a grid whose arrays sit in the same level of
+    the memory hierarchy as the target) and by 'predict_speedup' for the thread count, with
+    the parallel fraction fitted by the calibration (assumed 90% when there is nothing to fit).
+
+    Iterations: the run stops at conv < toler, i.e. (fresh start, resinit = 1) when the
+    largest residual falls below toler/sqrt(ni*nj). Each history in 'predhist' gives the
+    iterations its own run took to fall that far below its first residual ('history_iterations':
+    read off the history, extrapolated at the tail rate past its end), rescaled to the target
+    grid as (L/Lhist)^p with L = max(ni,nj) - 1. The exponent p is fitted from the histories
+    when they cover two or more grids; otherwise p = 2 when the target's cell Reynolds number
+    is below 2 (viscous time step limit) and p = 1 above it. The estimates of all histories
+    are averaged in log. Histories at a different Re are used but flagged: the model does not
+    scale with Re.
+    */
+    const int nhistmax = 32;     /* Largest number of histories */
+    char paths[1024];            /* Copy of predhist for tokenizing */
+    char *tok;                   /* One path */
+    char *save;                  /* strtok_r state */
+    int nh = 0;                  /* Histories read */
+    char hname[nhistmax][256];   /* Path of each history */
+    int hni[nhistmax];           /* Grid of each history */
+    int hnj[nhistmax];
+    double hre[nhistmax];        /* Reynolds number of each history */
+    double hlr0[nhistmax];       /* log10 of the first residual of each history */
+    double hmax[nhistmax];       /* Largest drop of each history (decades) */
+    double rate;                 /* Tail rate (decades per iteration) */
+    double nit;                  /* Iterations read off a history */
+    std::vector<double> its[nhistmax];      /* Iterations of each history */
+    std::vector<double> drop[nhistmax];     /* Drop below the first residual of each history */
+
+    int ni = (npredi>0) ? npredi : imax;     /* Target grid */
+    int nj = (npredj>0) ? npredj : jmax;
+    int nthreads = (npredthreads>0) ? npredthreads : (int)(std::thread::hardware_concurrency());
+    int ncal = (int)(std::thread::hardware_concurrency());   /* Threads of this node */
+    double ltarget = (double)(max(ni, nj) - 1);
+    double recell = rho*uinf*(rlength/ltarget)/rmu;          /* Target cell Reynolds number */
+    double lrstop = log10(toler) - 0.5*log10((double)(ni)*(double)(nj));   /* log10 of the largest residual at the stop */
+    double p;                    /* Grid exponent of the iteration count */
+    double iters = 0.0;          /* Predicted iterations */
+    int nest = 0;                /* Histories that gave an estimate */
+    double tcal;                 /* Calibrated seconds per iteration (imax x jmax, one thread) */
+    double fpar;                 /* Fitted parallel fraction (< 0: not fitted) */
+    double titer;                /* Predicted seconds per iteration (target) */
+    double twall;                /* Predicted wall time */
+    double mem = predict_memory(ni, nj);
+    int nrec = 1;                /* Recommended threads */
+
+    nthreads = max(nthreads, 1);
+    ncal = max(ncal, 1);
+    printf("Job prediction for a %d x %d grid, Re = %g, iengine = %d, isgs = %d, %d thread(s)\n", ni, nj, Re, iengine, isgs, nthreads);
+
+    /* Residual histories */
+    strncpy(paths, predhist, sizeof(paths) - 1);
+    paths[sizeof(paths) - 1] = '\0';
+    for(tok = strtok_r(paths, ",", &save); tok!=NULL && nh<nhistmax; tok = strtok_r(NULL, ",", &save))
+    {
+        if(read_history(tok, hni[nh], hnj[nh], hre[nh], hlr0[nh], its[nh], drop[nh])<4)
+        {
+            printf("  history '%s': missing or too short, skipped\n", tok);
+            continue;
+        }
+        snprintf(hname[nh], sizeof(hname[nh]), "%s", tok);
+        hmax[nh] = 0.0;
+        for(int l=0; l<(int)(drop[nh].size()); l++)
+        {
+            hmax[nh] = fmax(hmax[nh], drop[nh][l]);
+        }
+        printf("  history '%s': %d x %d, Re = %g, %.2f decades in %.0f iterations%s\n", tok, hni[nh], hnj[nh], hre[nh], hmax[nh], its[nh].back(),
+               (fabs(hre[nh] - Re)>0.1*Re) ? "  (different Re)" : "");
+        nh++;
+    }
+
+    /* Grid exponent: fitted from the histories if they span two or more grids (iterations */
+    /* each took to fall 90% of the smallest total drop among them)                           */
+    p = (recell<2.0) ? 2.0 : 1.0;
+    if(nh>=2)
+    {
+        double dcommon = 1.0e99;
+        double sx = 0.0, sy = 0.0, sxx = 0.0, sxy = 0.0;
+        for(int h=0; h<nh; h++)
+        {
+            dcommon = fmin(dcommon, 0.9*hmax[h]);
+        }
+        for(int h=0; h<nh; h++)
+        {
+            double lx = log((double)(max(hni[h], hnj[h]) - 1));
+            double ly = log(fmax(history_iterations(its[h], drop[h], dcommon, rate), 1.0));
+            sx += lx;
+            sy += ly;
+            sxx += lx*lx;
+            sxy += lx*ly;
+        }
+        double det = (double)(nh)*sxx - sx*sx;
+        if(det>1.0e-6)
+        {
+            p = ((double)(nh)*sxy - sx*sy)/det;
+            printf("  grid exponent fitted from %d histories: iterations ~ L^%.2f\n", nh, p);
+        }
+    }
+
+    /* Iterations to toler: each history rescaled to the target grid, then averaged in log */
+    for(int h=0; h<nh; h++)
+    {
+        double lhist = (double)(max(hni[h], hnj[h]) - 1);
+        nit = history_iterations(its[h], drop[h], hlr0[h] - lrstop, rate);
+        if(nit<0.0)
+        {
+            printf("  history '%s': stalls short of toler, no estimate from it\n", hname[h]);
+            continue;
+        }
+        iters += log(fmax(pow(ltarget/lhist, p)*nit, 1.0));
+        nest++;
+    }
+    if(nest>0)
+    {
+        iters = exp(iters/(double)(nest));
+    }
+    else
+    {
+        printf("  no usable history: iterations to toler not predicted\n");
+    }
+
+    /* Time per iteration: calibrated here, scaled by points and threads */
+    tcal = calibrate_iteration(iterationStep, set_time_step, set_boundary_conditions, u, uold, src, viscx, viscy, dt, ncal, fpar);
+    titer = tcal*((double)(ni)*(double)(nj))/((double)(imax)*(double)(jmax))/predict_speedup(nthreads, fpar);
+    twall = iters*titer;
+
+    /* Fewest threads within 5% of the modelled speedup on all of them (+ background writers) */
+    while(nrec<nthreads && predict_speedup(nrec, fpar)<0.95*predict_speedup(nthreads, fpar))
+    {
+        nrec++;
+    }
+    nrec = min(nrec + icheck + ipipe, max(nthreads, 1));
+
+    printf("  memory          : %.1f MB\n", mem/1048576.0);
+    printf("  time/iteration  : %e s (calibrated %e s on %d x %d, one thread)\n", titer, tcal, imax, jmax);
+    if(parallel_threads(nthreads)>1)
+    {
+        if(fpar<0.0)
+        {
+            printf("  parallel part   : 90%% (assumed: one thread on this node, nothing to fit)\n");
+        }
+        else if(iengine==1)
+        {
+            printf("  parallel part   : %.0f%% (fitted from 1 and %d threads)\n", 100.0*fpar, parallel_threads(ncal));
+        }
+        else
+        {
+            printf("  parallel part   : %.0f%% (pipeline stage 1 and 2 kernels on one thread; upper bound)\n", 100.0*fpar);
+        }
+    }
+    if(nest>0)
+    {
+        printf("  iterations      : %.0f to conv < %e\n", iters, toler);
+        printf("  wall time       : %.1f s (periodic output not included)\n", twall);
+    }
+    printf("Recommended: %d thread(s), %.0f MB, %.0f s wall time\n", nrec, ceil(predsafety*mem/1048576.0), (nest>0) ? ceil(predsafety*twall) : 0.0);
+    if(tbudget>0.0 && nest>0 && twall>(1.0 - budgetreserve)*tbudget)
+    {
+        printf("  the run is not expected to reach toler within tbudget = %g s\n", tbudget);
+    }
+}
+
+/**************************************************************************/
+
+int subcycle_count( double res[neq] )
+{
+    /* 
+    Uses global variable(s): nsubmax, fsmall
+    Inputs: res (latest iterative residual norms)
+    Returns: pressure sub-cycles for the next iteration: one per decade by which the
+    continuity residual lags (exceeds) the larger momentum residual, at most nsubmax
+    */
+    double lag = log10(fmax(res[0], fsmall)/fmax(fmax(res[1], res[2]), fsmall));
+
+    if(lag<=0.0)
+    {
+        return 0;
+    }
+    return min(nsubmax, (int)(ceil(lag)));
+}
+
+/**************************************************************************/
+
+void pressure_subcycle( boundaryConditionPointer set_boundary_conditions, Array3& u, Array2& viscx, Array2& viscy, Array2& dt, Array3& s )
+{
+    /* 
+    Uses global variable(s): imax, jmax, two, rho, rhoinv, dx, dy, rkappa, vel2ref, sub_dp, maingrid
+    Uses: dt, s
+    To Modify: u, viscx, viscy
+    One sweep of the pseudo-acoustic subsystem only: the pressure update of the continuity
+    equation, then the velocity response to that pressure change through the momentum
+    pressure gradient. Convection and viscous terms are left to the next full iteration.
+    The increment form (gradient of the pressure change) leaves a converged solution
+    unchanged, so the steady state is that of the full scheme.
+    */
+    int i;                       /* i index (x direction) */
+    int j;                       /* j index (y direction) */
+    double dudx;                 /* First derivative of x velocity w.r.t. x */
+    double dvdy;                 /* First derivative of y velocity w.r.t. y */
+    double beta2;                /* Beta squared parameter for time derivative preconditioning */
+
+    if(sub_dp==NULL)
+    {
+        sub_dp = new Array2(imax, jmax);
+    }
+    Array2& dp = *sub_dp;
+
+    /* Pressure: continuity update (in place, lexicographic); wall pressures follow through */
+    /* the boundary conditions, so their change is taken around the call                     */
+    Compute_Artificial_Viscosity(u, viscx, viscy);
+    for(i=1; i<imax-1; i++)
+    {
+        for(j=1; j<jmax-1; j++)
+        {
+            dudx = (u(i+1,j,1) - u(i-1,j,1))/(two*dx);
+            dvdy = (u(i,j+1,2) - u(i,j-1,2))/(two*dy);
+            beta2 = fmax(pow2(u(i,j,1)) + pow2(u(i,j,2)), rkappa*vel2ref);
+            dp(i,j) = -beta2*dt(i,j)*(rho*dudx + rho*dvdy - viscx(i,j) - viscy(i,j) - s(i,j,0));
+            u(i,j,0) = u(i,j,0) + dp(i,j);
+        }
+    }
+    for(i=0; i<imax; i++)
+    {
+        dp(i,0) = u(i,0,0);
+        dp(i,jmax-1) = u(i,jmax-1,0);
+    }
+    for(j=1; j<jmax-1; j++)
+    {
+        dp(0,j) = u(0,j,0);
+        dp(imax-1,j) = u(imax-1,j,0);
+    }
+    set_boundary_conditions(u);
+    for(i=0; i<imax; i++)
+    {
+        dp(i,0) = u(i,0,0) - dp(i,0);
+        dp(i,jmax-1) = u(i,jmax-1,0) - dp(i,jmax-1);
+    }
+    for(j=1; j<jmax-1; j++)
+    {
+        dp(0,j) = u(0,j,0) - dp(0,j);
+        dp(imax-1,j) = u(imax-1,j,0) - dp(imax-1,j);
+    }
+
+    /* Velocity: response to the pressure change */
+    for(i=1; i<imax-1; i++)
+    {
+        for(j=1; j<jmax-1; j++)
+        {
+            u(i,j,1) = u(i,j,1) - dt(i,j)*rhoinv/visc_diag(maingrid, dt(i,j))*(dp(i+1,j) - dp(i-1,j))/(two*dx);
+            u(i,j,2) = u(i,j,2) - dt(i,j)*rhoinv/visc_diag(maingrid, dt(i,j))*(dp(i,j+1) - dp(i,j-1))/(two*dy);
+        }
+    }
+    set_boundary_conditions(u);
+}
+
+/**************************************************************************/
+
+void steady_residual( Array3& u, Array2& viscx, Array2& viscy, Array3& s, Array3& r )
+{
+    /* 
+    Uses global variable(s): zero, two, imax, jmax, rho, rmu, dx, dy
+    Uses: u, s
+    To modify: viscx, viscy (recomputed from u), r (steady residual of the continuity and
+    momentum equations at the interior points, the bracketed terms of the SGS/PJ updates;
+    zero on the walls)
+    */
+    Compute_Artificial_Viscosity(u, viscx, viscy);
+    r.plane(0).fill(zero);
+    r.plane(1).fill(zero);
+    r.plane(2).fill(zero);
+    for(int i=1; i<imax-1; i++)
+    {
+        for(int j=1; j<jmax-1; j++)
+        {
+            double dpdx = (u(i+1,j,0) - u(i-1,j,0))/(two*dx);
+            double dpdy = (u(i,j+1,0) - u(i,j-1,0))/(two*dy);
+            double dudx = (u(i+1,j,1) - u(i-1,j,1))/(two*dx);
+            double dudy = (u(i,j+1,1) - u(i,j-1,1))/(two*dy);
+            double dvdx = (u(i+1,j,2) - u(i-1,j,2))/(two*dx);
+            double dvdy = (u(i,j+1,2) - u(i,j-1,2))/(two*dy);
+            double lapu = (u(i+1,j,1) - two*u(i,j,1) + u(i-1,j,1))/(dx*dx)
+                        + (u(i,j+1,1) - two*u(i,j,1) + u(i,j-1,1))/(dy*dy);
+            double lapv = (u(i+1,j,2) - two*u(i,j,2) + u(i-1,j,2))/(dx*dx)
+                        + (u(i,j+1,2) - two*u(i,j,2) + u(i,j-1,2))/(dy*dy);
+
+            r(i,j,0) = rho*dudx + rho*dvdy - viscx(i,j) - viscy(i,j) - s(i,j,0);
+            r(i,j,1) = rho*u(i,j,1)*dudx + rho*u(i,j,2)*dudy + dpdx - rmu*lapu - s(i,j,1);
+            r(i,j,2) = rho*u(i,j,1)*dvdx + rho*u(i,j,2)*dvdy + dpdy - rmu*lapv - s(i,j,2);
+        }
+    }
+}
+
+/**************************************************************************/
+
+void remove_pressure_drift( Array3& u, Array2& dt, Array3& r )
+{
+    /* 
+    Uses global variable(s): zero, imax, jmax, rkappa, vel2ref
+    Uses: u, dt
+    To modify: r (continuity residual at the interior points)
+    The pseudo-time iteration settles to a uniform pressure change beta2*dt*R per
+    iteration, which 'pressure_rescaling' removes; the mean of beta2*dt*R is taken out
+    of the continuity residual so that only the part that is an error remains
+    */
+    Array2 wp(imax, jmax);              /* Pressure update weight beta2*dt */
+    double rmean = zero;
+
+    for(int i=1; i<imax-1; i++)
+    {
+        for(int j=1; j<jmax-1; j++)
+        {
+            wp(i,j) = fmax(pow2(u(i,j,1)) + pow2(u(i,j,2)), rkappa*vel2ref)*dt(i,j);
+            rmean += wp(i,j)*r(i,j,0);
+        }
+    }
+    rmean = rmean/(double)((imax - 2)*(jmax - 2));
+    for(int i=1; i<imax-1; i++)
+    {
+        for(int j=1; j<jmax-1; j++)
+        {
+            r(i,j,0) -= rmean/wp(i,j);
+        }
+    }
+}
+
+/**************************************************************************/
+
+SparseMatrix::SparseMatrix () : ptr(1, 0)
+{
+    nrow = 0;
+    ncol = 0;
+}
+
+//Matrix-vector product y = A x
+void SparseMatrix::multiply (const std::vector<double>& x, std::vector<double>& y) const
+{
+    y.assign(nrow, 0.0);
+    for(int i=0; i<nrow; i++)
+    {
+        double sum = 0.0;
+        for(int e=ptr[i]; e<ptr[i+1]; e++)
+        {
+            sum += val[e]*x[col[e]];
+        }
+        y[i] = sum;
+    }
+}
+
+/**************************************************************************/
+
+void sparse_transpose( const SparseMatrix& A, SparseMatrix& T )
+{
+    /* 
+    Uses: A
+    To modify: T (transpose of A)
+    */
+    T.nrow = A.ncol;
+    T.ncol = A.nrow;
+    T.ptr.assign(T.nrow + 1, 0);
+    T.col.resize(A.col.size());
+    T.val.resize(A.val.size());
+    for(size_t e=0; e<A.col.size(); e++)
+    {
+        T.ptr[A.col[e] + 1]++;
+    }
+    for(int i=0; i<T.nrow; i++)
+    {
+        T.ptr[i+1] += T.ptr[i];
+    }
+    std::vector<int> next(T.ptr.begin(), T.ptr.end() - 1);     /* Next free entry of each row of T */
+    for(int i=0; i<A.nrow; i++)
+    {
+        for(int e=A.ptr[i]; e<A.ptr[i+1]; e++)
+        {
+            int et = next[A.col[e]]++;
+            T.col[et] = i;
+            T.val[et] = A.val[e];
+        }
+    }
+}
+
+/**************************************************************************/
+
+void sparse_product( const SparseMatrix& A, const SparseMatrix& B, SparseMatrix& C )
+{
+    /* 
+    Uses: A, B
+    To modify: C (= A B, row by row with a dense accumulator)
+    */
+    std::vector<int> mark(B.ncol, -1);  /* Entry of the current row of C holding each column */
+
+    C.nrow = A.nrow;
+    C.ncol = B.ncol;
+    C.ptr.assign(1, 0);
+    C.col.clear();
+    C.val.clear();
+    for(int i=0; i<A.nrow; i++)
+    {
+        int rowstart = (int)(C.col.size());
+        for(int ea=A.ptr[i]; ea<A.ptr[i+1]; ea++)
+        {
+            int k = A.col[ea];
+            for(int eb=B.ptr[k]; eb<B.ptr[k+1]; eb++)
+            {
+                int jc = B.col[eb];
+                if(mark[jc]<rowstart)
+                {
+                    mark[jc] = (int)(C.col.size());
+                    C.col.push_back(jc);
+                    C.val.push_back(A.val[ea]*B.val[eb]);
+                }
+                else
+                {
+                    C.val[mark[jc]] += A.val[ea]*B.val[eb];
+                }
+            }
+        }
+        C.ptr.push_back((int)(C.col.size()));
+    }
+}
+
+/**************************************************************************/
+
+void dc_assemble( Array3& u, Array2& dtdc, SparseMatrix& A )
+{
+    /* 
+    Uses global variable(s): zero, two, four, half, imax, jmax, imms, rho, rmu, dx, dy, rkappa, vel2ref, Cx, Cy, dcdiss
+    Uses: u, dtdc (implicit pseudo-time step)
+    To modify: A (low-order operator of the defect correction, unknowns neq*dc_node(i,j)+k)
+    Linearized (Picard) first-order operator of the interior equations:
+      - pseudo-time terms 1/(beta2*dtdc) (continuity) and rho/dtdc (momentum);
+      - first-order upwind convection and the central viscous terms;
+      - central pressure gradient and velocity divergence;
+      - instead of the 4th-difference dissipation, a 2nd-difference pressure dissipation
+        dcdiss*Cx*(lambda*h/beta2) d2p/dx2, the form of first-order upwinding of the
+        acoustic waves. Its strength matters: on the grid-scale (odd-even) pressure mode
+        the 4th difference is 16 Cx and the 2nd difference 4 dcdiss Cx, so the outer
+        iteration amplifies that mode unless dcdiss > 2; the full upwind value
+        (dcdiss = 1/(2 Cx)) is stable but converges slowly on the pressure.
+    Wall velocities are fixed. Wall pressures follow the extrapolation of the boundary
+    conditions (p_wall = 2 p_1 - p_2), or are fixed for the manufactured solution.
+    */
+    int nrow = neq*(imax - 2)*(jmax - 2);
+    int ncol[neq];                      /* Entries in the row being assembled, per equation */
+    int cols[neq][16];                  /* Their columns */
+    double vals[neq][16];               /* Their values */
+    const int di[4] = {1, -1, 0, 0};    /* Neighbours: E, W, N, S */
+    const int dj[4] = {0, 0, 1, -1};
+
+    A.nrow = nrow;
+    A.ncol = nrow;
+    A.ptr.assign(1, 0);
+    A.col.clear();
+    A.val.clear();
+    A.col.reserve(15*nrow);
+    A.val.reserve(15*nrow);
+
+    /* Adds v to entry (row k of the current point, unknown kc of point (ic,jc)) */
+    auto add = [&](int k, int ic, int jc, int kc, double v)
+    {
+        int c = neq*dc_node(ic, jc) + kc;
+        for(int e=0; e<ncol[k]; e++)
+        {
+            if(cols[k][e]==c)
+            {
+                vals[k][e] += v;
+                return;
+            }
+        }
+        cols[k][ncol[k]] = c;
+        vals[k][ncol[k]] = v;
+        ncol[k]++;
+    };
+    /* Adds v times the pressure at (in,jn), a neighbour of (i,j) that may be a wall point */
+    auto add_p = [&](int k, int i, int j, int in, int jn, double v)
+    {
+        if(in>0 && in<imax-1 && jn>0 && jn<jmax-1)
+        {
+            add(k, in, jn, 0, v);
+        }
+        else if(imms==0)
+        {
+            add(k, i, j, 0, two*v);
+            add(k, 2*i - in, 2*j - jn, 0, -v);
+        }
+    };
+
+    for(int i=1; i<imax-1; i++)
+    {
+        for(int j=1; j<jmax-1; j++)
+        {
+            double uc = u(i,j,1);
+            double vc = u(i,j,2);
+            double uvel2 = pow2(uc) + pow2(vc);
+            double beta2 = fmax(uvel2, rkappa*vel2ref);
+            double lambda_x = half*(fabs(uc) + sqrt(uvel2 + four*beta2));
+            double lambda_y = half*(fabs(vc) + sqrt(uvel2 + four*beta2));
+            double epsx = dcdiss*Cx*lambda_x/(beta2*dx);    /* Pressure dissipation coefficients (/h^2) */
+            double epsy = dcdiss*Cy*lambda_y/(beta2*dy);
+            double cx[4];                                   /* Momentum neighbour coefficients */
+            cx[0] = rho*fmin(uc, zero)/dx - rmu/(dx*dx);
+            cx[1] = -rho*fmax(uc, zero)/dx - rmu/(dx*dx);
+            cx[2] = rho*fmin(vc, zero)/dy - rmu/(dy*dy);
+            cx[3] = -rho*fmax(vc, zero)/dy - rmu/(dy*dy);
+
+            for(int k=0; k<neq; k++)
+            {
+                ncol[k] = 0;
+            }
+            add(0, i, j, 0, one/(beta2*dtdc(i,j)) + two*epsx + two*epsy);
+            add(1, i, j, 1, rho/dtdc(i,j) + rho*fabs(uc)/dx + rho*fabs(vc)/dy + two*rmu/(dx*dx) + two*rmu/(dy*dy));
+            add(2, i, j, 2, rho/dtdc(i,j) + rho*fabs(uc)/dx + rho*fabs(vc)/dy + two*rmu/(dx*dx) + two*rmu/(dy*dy));
+            for(int m=0; m<4; m++)
+            {
+                int in = i + di[m];
+                int jn = j + dj[m];
+                double sgn = (m%2==0) ? one : -one;         /* + for E and N, - for W and S */
+                int wall = (in==0 || in==imax-1 || jn==0 || jn==jmax-1);
+
+                add_p(0, i, j, in, jn, (m<2) ? -epsx : -epsy);
+                add_p((m<2) ? 1 : 2, i, j, in, jn, sgn/(two*((m<2) ? dx : dy)));
+                if(!wall)
+                {
+                    add(0, in, jn, (m<2) ? 1 : 2, sgn*rho/(two*((m<2) ? dx : dy)));
+                    add(1, in, jn, 1, cx[m]);
+                    add(2, in, jn, 2, cx[m]);
+                }
+            }
+            for(int k=0; k<neq; k++)
+            {
+                for(int e=0; e<ncol[k]; e++)
+                {
+                    A.col.push_back(cols[k][e]);
+                    A.val.push_back(vals[k][e]);
+                }
+                A.ptr.push_back((int)(A.col.size()));
+            }
+        }
+    }
+}
+
+/**************************************************************************/
+
+int amg_aggregate( const SparseMatrix& A, std::vector<int>& agg )
+{
+    /* 
+    Uses global variable(s): neq, amgtheta
+    Uses: A (blocks of neq unknowns)
+    To modify: agg (aggregate of each block)
+    Returns: number of aggregates
+    Greedy aggregation of the blocks over the strong connections, measured on the
+    equation-by-equation (same unknown) couplings:
+        s_IJ = sum_k |A(IJ)kk| > amgtheta*sqrt(d_I d_J),  d_I = sum_k |A(II)kk|
+      1. a block with no aggregated strong neighbour starts an aggregate with all of them;
+      2. a leftover block joins the aggregate of a strong neighbour from step 1;
+      3. the rest start aggregates with their remaining strong neighbours.
+    */
+    int nb = A.nrow/neq;                /* Blocks */
+    int nagg = 0;                       /* Aggregates */
+    std::vector<double> d(nb, 0.0);     /* Diagonal measure of each block */
+    std::vector<double> acc(nb, 0.0);   /* Coupling of the current block to each block */
+    std::vector<int> touched;           /* Blocks with a nonzero coupling */
+    std::vector<int> sptr(1, 0);        /* Strong neighbours of each block (compressed rows) */
+    std::vector<int> sadj;
+
+    for(int ib=0; ib<nb; ib++)
+    {
+        for(int k=0; k<neq; k++)
+        {
+            int row = neq*ib + k;
+            for(int e=A.ptr[row]; e<A.ptr[row+1]; e++)
+            {
+                if(A.col[e]==row)
+                {
+                    d[ib] += fabs(A.val[e]);
+                }
+            }
+        }
+    }
+    for(int ib=0; ib<nb; ib++)
+    {
+        touched.clear();
+        for(int k=0; k<neq; k++)
+        {
+            int row = neq*ib + k;
+            for(int e=A.ptr[row]; e<A.ptr[row+1]; e++)
+            {
+                int jb = A.col[e]/neq;
+                if(jb!=ib && A.col[e]%neq==k)
+                {
+                    if(acc[jb]==0.0)
+                    {
+                        touched.push_back(jb);
+                    }
+                    acc[jb] += fabs(A.val[e]);
+                }
+            }
+        }
+        for(size_t t=0; t<touched.size(); t++)
+        {
+            int jb = touched[t];
+            if(acc[jb]>amgtheta*sqrt(d[ib]*d[jb]))
+            {
+                sadj.push_back(jb);
+            }
+            acc[jb] = 0.0;
+        }
+        sptr.push_back((int)(sadj.size()));
+    }
+
+    agg.assign(nb, -1);
+    for(int ib=0; ib<nb; ib++)
+    {
+        int isfree = (agg[ib]==-1);
+        for(int e=sptr[ib]; e<sptr[ib+1] && isfree; e++)
+        {
+            isfree = (agg[sadj[e]]==-1);
+        }
+        if(isfree)
+        {
+            agg[ib] = nagg;
+            for(int e=sptr[ib]; e<sptr[ib+1]; e++)
+            {
+                agg[sadj[e]] = nagg;
+            }
+            nagg++;
+        }
+    }
+    std::vector<int> agg1(agg);         /* Aggregates of step 1 */
+    for(int ib=0; ib<nb; ib++)
+    {
+        for(int e=sptr[ib]; e<sptr[ib+1] && agg[ib]==-1; e++)
+        {
+            agg[ib] = agg1[sadj[e]];
+        }
+    }
+    for(int ib=0; ib<nb; ib++)
+    {
+        if(agg[ib]==-1)
+        {
+            agg[ib] = nagg;
+            for(int e=sptr[ib]; e<sptr[ib+1]; e++)
+            {
+                if(agg[sadj[e]]==-1)
+                {
+                    agg[sadj[e]] = nagg;
+                }
+            }
+            nagg++;
+        }
+    }
+    return nagg;
+}
+
+/**************************************************************************/
+
+void amg_block_inverse( const SparseMatrix& A, std::vector<double>& dinv )
+{
+    /* 
+    Uses global variable(s): zero, neq (= 3)
+    Uses: A
+    To modify: dinv (inverse of each 3 x 3 diagonal block, row-major; the inverse of the
+    diagonal alone if a block is numerically singular)
+    */
+    int nb = A.nrow/neq;                /* Blocks */
+    double a[3][3];                     /* Diagonal block */
+
+    dinv.assign(nb*9, zero);
+    for(int ib=0; ib<nb; ib++)
+    {
+        for(int k=0; k<3; k++)
+        {
+            int row = 3*ib + k;
+            a[k][0] = a[k][1] = a[k][2] = zero;
+            for(int e=A.ptr[row]; e<A.ptr[row+1]; e++)
+            {
+                if(A.col[e]/3==ib)
+                {
+                    a[k][A.col[e]%3] = A.val[e];
+                }
+            }
+        }
+        double *inv = &dinv[9*ib];
+        double det = a[0][0]*(a[1][1]*a[2][2] - a[1][2]*a[2][1])
+                   - a[0][1]*(a[1][0]*a[2][2] - a[1][2]*a[2][0])
+                   + a[0][2]*(a[1][0]*a[2][1] - a[1][1]*a[2][0]);
+        if(fabs(det)>1.e-12*fabs(a[0][0]*a[1][1]*a[2][2]))
+        {
+            inv[0] = (a[1][1]*a[2][2] - a[1][2]*a[2][1])/det;
+            inv[1] = (a[0][2]*a[2][1] - a[0][1]*a[2][2])/det;
+            inv[2] = (a[0][1]*a[1][2] - a[0][2]*a[1][1])/det;
+            inv[3] = (a[1][2]*a[2][0] - a[1][0]*a[2][2])/det;
+            inv[4] = (a[0][0]*a[2][2] - a[0][2]*a[2][0])/det;
+            inv[5] = (a[0][2]*a[1][0] - a[0][0]*a[1][2])/det;
+            inv[6] = (a[1][0]*a[2][1] - a[1][1]*a[2][0])/det;
+            inv[7] = (a[0][1]*a[2][0] - a[0][0]*a[2][1])/det;
+            inv[8] = (a[0][0]*a[1][1] - a[0][1]*a[1][0])/det;
+        }
+        else
+        {
+            for(int k=0; k<3; k++)
+            {
+                inv[4*k] = (a[k][k]!=zero) ? one/a[k][k] : zero;
+            }
+        }
+    }
+}
+
+/**************************************************************************/
+
+void amg_setup( SparseMatrix& A )
+{
+    /* 
+    Uses global variable(s): zero, one, neq
+    Uses: A (taken over by the finest level)
+    To modify: amg_levels, amg_lu, amg_piv
+    Smoothed-aggregation hierarchy: on each level the tentative prolongation P0 copies
+    each unknown of an aggregate to its blocks (the near null space is a constant per
+    equation), is smoothed by one damped Jacobi step
+        P = (I - 4/(3 rho) D^-1 A) P0      (rho: Gershgorin bound of D^-1 A)
+    and the coarse operator is the Galerkin product P^T A P. Coarsening stops below
+    100 blocks or when aggregation stalls; the coarsest level is factored (dense LU).
+    */
+    const int nbmin = 100;              /* Blocks on the coarsest level */
+    const int nlevmax = 20;             /* Most levels */
+    std::vector<int> agg;               /* Aggregate of each block */
+
+    amg_levels.clear();
+    amg_levels.push_back(AMGLevel());
+    std::swap(amg_levels[0].A, A);
+    for(int l=0; ; l++)
+    {
+        int n = amg_levels[l].A.nrow;
+        amg_levels[l].x.assign(n, zero);
+        amg_levels[l].b.assign(n, zero);
+        amg_levels[l].r.assign(n, zero);
+        amg_block_inverse(amg_levels[l].A, amg_levels[l].dinv);
+        if(n<=neq*nbmin || l==nlevmax-1)
+        {
+            break;
+        }
+        int nagg = amg_aggregate(amg_levels[l].A, agg);
+        if(neq*nagg>=n*9/10)
+        {
+            break;
+        }
+
+        /* Smoothed prolongation: rows of (I - w D^-1 A) P0 */
+        SparseMatrix& Af = amg_levels[l].A;
+        SparseMatrix P0;
+        SparseMatrix& P = amg_levels[l].P;
+        double rhobound = zero;
+        P0.nrow = n;
+        P0.ncol = neq*nagg;
+        for(int row=0; row<n; row++)
+        {
+            P0.col.push_back(neq*agg[row/neq] + row%neq);
+            P0.val.push_back(one);
+            P0.ptr.push_back(row + 1);
+        }
+        std::vector<double> dscal(n, zero);     /* Inverse diagonal */
+        for(int row=0; row<n; row++)
+        {
+            double sum = zero;
+            for(int e=Af.ptr[row]; e<Af.ptr[row+1]; e++)
+            {
+                sum += fabs(Af.val[e]);
+                if(Af.col[e]==row)
+                {
+                    dscal[row] = one/Af.val[e];
+                }
+            }
+            rhobound = fmax(rhobound, sum*fabs(dscal[row]));
+        }
+        sparse_product(Af, P0, P);
+        double w = 4.0/(3.0*rhobound);
+        for(int row=0; row<n; row++)
+        {
+            for(int e=P.ptr[row]; e<P.ptr[row+1]; e++)
+            {
+                P.val[e] = -w*dscal[row]*P.val[e] + ((P.col[e]==P0.col[row]) ? one : zero);
+            }
+        }
+        sparse_transpose(P, amg_levels[l].R);
+
+        /* Galerkin coarse operator */
+        SparseMatrix AP;
+        SparseMatrix Ac;
+        sparse_product(Af, P, AP);
+        sparse_product(amg_levels[l].R, AP, Ac);
+        amg_levels.push_back(AMGLevel());
+        std::swap(amg_levels[l+1].A, Ac);
+    }
+
+    /* Dense LU factorization (partial pivoting) of the coarsest operator */
+    SparseMatrix& Ac = amg_levels.back().A;
+    int n = Ac.nrow;
+    amg_lu.assign((size_t)(n)*n, zero);
+    amg_piv.assign(n, 0);
+    for(int row=0; row<n; row++)
+    {
+        for(int e=Ac.ptr[row]; e<Ac.ptr[row+1]; e++)
+        {
+            amg_lu[(size_t)(row)*n + Ac.col[e]] = Ac.val[e];
+        }
+    }
+    for(int k=0; k<n; k++)
+    {
+        int p = k;
+        for(int row=k+1; row<n; row++)
+        {
+            if(fabs(amg_lu[(size_t)(row)*n + k])>fabs(amg_lu[(size_t)(p)*n + k]))
+            {
+                p = row;
+            }
+        }
+        amg_piv[k] = p;
+        if(p!=k)
+        {
+            for(int c=0; c<n; c++)
+            {
+                std::swap(amg_lu[(size_t)(k)*n + c], amg_lu[(size_t)(p)*n + c]);
+            }
+        }
+        if(amg_lu[(size_t)(k)*n + k]==zero)
+        {
+            amg_lu[(size_t)(k)*n + k] = fsmall;
+        }
+        for(int row=k+1; row<n; row++)
+        {
+            double f = amg_lu[(size_t)(row)*n + k]/amg_lu[(size_t)(k)*n + k];
+            amg_lu[(size_t)(row)*n + k] = f;
+            for(int c=k+1; c<n; c++)
+            {
+                amg_lu[(size_t)(row)*n + c] -= f*amg_lu[(size_t)(k)*n + c];
+            }
+        }
+    }
+}
+
+/**************************************************************************/
+
+void amg_smooth( AMGLevel& L, int backward )
+{
+    /* 
+    Uses global variable(s): neq (= 3)
+    Uses: L.A, L.dinv, L.b
+    To modify: L.x (one block Gauss-Seidel sweep, forward or backward)
+    */
+    int nb = L.A.nrow/3;                /* Blocks */
+    double rb[3];                       /* Block residual without the diagonal block */
+
+    for(int m=0; m<nb; m++)
+    {
+        int ib = (backward==1) ? nb - 1 - m : m;
+        for(int k=0; k<3; k++)
+        {
+            int row = 3*ib + k;
+            rb[k] = L.b[row];
+            for(int e=L.A.ptr[row]; e<L.A.ptr[row+1]; e++)
+            {
+                if(L.A.col[e]/3!=ib)
+                {
+                    rb[k] -= L.A.val[e]*L.x[L.A.col[e]];
+                }
+            }
+        }
+        double *inv = &L.dinv[9*ib];
+        for(int k=0; k<3; k++)
+        {
+            L.x[3*ib + k] = inv[3*k]*rb[0] + inv[3*k+1]*rb[1] + inv[3*k+2]*rb[2];
+        }
+    }
+}
+
+/**************************************************************************/
+
+void amg_vcycle( int l )
+{
+    /* 
+    Uses global variable(s): zero, amg_levels, amg_lu, amg_piv
+    To modify: amg_levels[l].x (improved by one V-cycle from its current value for the
+    right-hand side amg_levels[l].b; coarser levels start from zero)
+    */
+    AMGLevel& L = amg_levels[l];
+    int n = L.A.nrow;
+
+    if(l==(int)(amg_levels.size()) - 1)
+    {
+        /* Coarsest level: direct solve */
+        for(int row=0; row<n; row++)
+        {
+            L.x[row] = L.b[row];
+        }
+        for(int k=0; k<n; k++)
+        {
+            std::swap(L.x[k], L.x[amg_piv[k]]);
+            for(int row=k+1; row<n; row++)
+            {
+                L.x[row] -= amg_lu[(size_t)(row)*n + k]*L.x[k];
+            }
+        }
+        for(int k=n-1; k>=0; k--)
+        {
+            for(int c=k+1; c<n; c++)
+            {
+                L.x[k] -= amg_lu[(size_t)(k)*n + c]*L.x[c];
+            }
+            L.x[k] /= amg_lu[(size_t)(k)*n + k];
+        }
+        return;
+    }
+
+    AMGLevel& C = amg_levels[l+1];
+    amg_smooth(L, 0);
+    L.A.multiply(L.x, L.r);
+    for(int row=0; row<n; row++)
+    {
+        L.r[row] = L.b[row] - L.r[row];
+    }
+    L.R.multiply(L.r, C.b);
+    C.x.assign(C.A.nrow, zero);
+    amg_vcycle(l+1);
+    L.P.multiply(C.x, L.r);
+    for(int row=0; row<n; row++)
+    {
+        L.x[row] += L.r[row];
+    }
+    amg_smooth(L, 1);
+}
+
+/**************************************************************************/
+
+int amg_solve( std::vector<double>& b, std::vector<double>& x )
+{
+    /* 
+    Uses global variable(s): zero, one, namgit, amgtol, amg_levels
+    Uses: b
+    To modify: x (from zero, until the residual drops by amgtol or after namgit iterations)
+    Returns: number of iterations
+    BiCGStab preconditioned by one V-cycle (from zero) per operator application: the
+    V-cycle alone diverges on the pressure-velocity coupling at large dccfl
+    */
+    AMGLevel& L = amg_levels[0];
+    int n = L.A.nrow;
+    int it = 0;                         /* Iterations performed */
+    double rnorm0;                      /* Initial residual norm */
+    double rho0 = one;                  /* BiCGStab scalars */
+    double rho1;
+    double alpha = one;
+    double omega = one;
+    double beta;
+    std::vector<double> r(b);           /* Residual */
+    std::vector<double> rhat(b);        /* Shadow residual */
+    std::vector<double> p(n, zero);     /* Search direction */
+    std::vector<double> v(n, zero);     /* A M^-1 p */
+    std::vector<double> t(n, zero);     /* A M^-1 s */
+    std::vector<double> ph(n);          /* M^-1 p */
+    std::vector<double> sh(n);          /* M^-1 s */
+
+    /* z = M^-1 y: one V-cycle from zero */
+    auto precondition = [&](std::vector<double>& y, std::vector<double>& z)
+    {
+        L.b = y;
+        L.x.assign(n, zero);
+        amg_vcycle(0);
+        z = L.x;
+    };
+    auto dot = [&](std::vector<double>& y, std::vector<double>& z)
+    {
+        double sum = zero;
+        for(int row=0; row<n; row++)
+        {
+            sum += y[row]*z[row];
+        }
+        return sum;
+    };
+
+    x.assign(n, zero);
+    rnorm0 = sqrt(dot(r, r));
+    while(rnorm0>zero && it<namgit)
+    {
+        it++;
+        rho1 = dot(rhat, r);
+        beta = (rho1/rho0)*(alpha/omega);
+        rho0 = rho1;
+        for(int row=0; row<n; row++)
+        {
+            p[row] = r[row] + beta*(p[row] - omega*v[row]);
+        }
+        precondition(p, ph);
+        L.A.multiply(ph, v);
+        double rv = dot(rhat, v);
+        if(rv==zero)
+        {
+            break;
+        }
+        alpha = rho1/rv;
+        for(int row=0; row<n; row++)
+        {
+            x[row] += alpha*ph[row];
+            r[row] -= alpha*v[row];             /* r is now s */
+        }
+        if(sqrt(dot(r, r))<=amgtol*rnorm0)
+        {
+            break;
+        }
+        precondition(r, sh);
+        L.A.multiply(sh, t);
+        double tt = dot(t, t);
+        if(tt==zero)
+        {
+            break;
+        }
+        omega = dot(t, r)/tt;
+        for(int row=0; row<n; row++)
+        {
+            x[row] += omega*sh[row];
+            r[row] -= omega*t[row];
+        }
+        if(sqrt(dot(r, r))<=amgtol*rnorm0 || omega==zero)
+        {
+            break;
+        }
+    }
+    return it;
+}
+
+/**************************************************************************/
+
+void DC_iteration( boundaryConditionPointer set_boundary_conditions, Array3& u, Array3& uold, Array3& src, Array2& viscx, Array2& viscy, Array2& dt )
+{
+    /* 
+    Uses global variable(s): zero, fsmall, imax, jmax, cfl, dccfl, dccfl0
+    Uses: src, dt (explicit local time step, rescaled to the implicit CFL number)
+    To modify: u, uold, viscx, viscy, dc_r (allocated on first use), dc_rnormold, dc_cfl
+    Defect correction: with R the full (second-order, 4th-difference dissipation) steady
+    residual and L the low-order operator of 'dc_assemble',
+        L du = -R,   u = u + du
+    solved approximately by AMG-preconditioned BiCGStab ('amg_solve'). The CFL number
+    follows the residual (switched evolution relaxation): it is multiplied by the drop of
+    |R| over the last iteration, starting from and never below dccfl0, at most dccfl.
+    The residual norms of the iteration are the norms of R ('check_iterative_convergence').
+    */
+    Array2 dtdc(imax, jmax);            /* Implicit pseudo-time step */
+    SparseMatrix A;                     /* Low-order operator */
+    std::vector<double> b(neq*(imax - 2)*(jmax - 2));
+    std::vector<double> du;
+    double rnorm = zero;                /* Norm of the full residual */
+
+    if(dc_r==NULL)
+    {
+        dc_r = new Array3(imax, jmax, neq);
+    }
+    Array3& r = *dc_r;
+    uold.copyData(u);
+
+    /* Full residual (uniform pressure drift removed, as for the explicit iterations) */
+    steady_residual(u, viscx, viscy, src, r);
+    remove_pressure_drift(u, dt, r);
+    for(int i=1; i<imax-1; i++)
+    {
+        for(int j=1; j<jmax-1; j++)
+        {
+            for(int k=0; k<neq; k++)
+            {
+                b[neq*dc_node(i,j) + k] = -r(i,j,k);
+                rnorm += pow2(r(i,j,k));
+            }
+        }
+    }
+
+    /* Pseudo-time step: CFL scaled by the residual drop of the last iteration, within [dccfl0, dccfl] */
+    rnorm = sqrt(rnorm);
+    if(dc_cfl==0.0)
+    {
+        dc_cfl = dccfl0;
+    }
+    else
+    {
+        dc_cfl = fmax(dccfl0, fmin(dccfl, dc_cfl*dc_rnormold/fmax(rnorm, fsmall)));
+    }
+    dc_rnormold = rnorm;
+    for(int i=1; i<imax-1; i++)
+    {
+        for(int j=1; j<jmax-1; j++)
+        {
+            dtdc(i,j) = dt(i,j)*dc_cfl/cfl;
+        }
+    }
+
+    /* Low-order correction */
+    dc_assemble(u, dtdc, A);
+    amg_setup(A);
+    amg_solve(b, du);
+    for(int i=1; i<imax-1; i++)
+    {
+        for(int j=1; j<jmax-1; j++)
+        {
+            for(int k=0; k<neq; k++)
+            {
+                u(i,j,k) += du[neq*dc_node(i,j) + k];
+            }
+        }
+    }
+    set_boundary_conditions(u);
+}
+
+/**************************************************************************/
+
+void batch_solve( std::vector<int>& bni, std::vector<int>& bnj, std::vector<double>& bre, std::vector<double>& results )
+{
+    /* 
+    Uses global variable(s): nbatchthreads, nbatchit, nbatchres, nbatchout, toler, imms, rho, uinf, rlength,
+                             xmin, xmax, ymin, ymax, zero, half
+    Uses: bni, bnj, bre (points in x and y, Reynolds number of each case)
+    To modify: results (nbatchout values per case, in case order)
+    Solves every case with no allocation, file I/O or printing per case. Each thread keeps one
+    CavityGrid per distinct grid size and reuses it, so a case's whole state (9 doubles per point;
+    the source terms and wall velocities are shared by all cases of a size) stays in the core's
+    cache for its whole solve: in L1 at 17 x 17 (about 20 KB), in L2 at 33 x 33 (80 KB) and, on
+    cores with an L2 of 512 KB or more, at 65 x 65 (300 KB); on smaller L2s a 65 x 65 case runs
+    from L3. Cases are handed out largest first for load balance. Residual norms, the only reason
+    to keep the previous iterate, are formed every nbatchres iterations ('grid_sweep' skips the
+    copy in between).
+    */
+    int ncase = (int)(bni.size());      /* Number of cases */
+    int nthreads;                       /* Number of solver threads */
+    std::vector<int> order(ncase);      /* Cases, largest grid first */
+    std::vector<std::thread> workers;   /* Solver threads */
+    std::atomic<int> next(0);           /* Next entry of order to solve */
+
+    for(int m=0; m<ncase; m++)
+    {
+        order[m] = m;
+    }
+    std::stable_sort(order.begin(), order.end(), [&](int a, int b) { return bni[a]*bnj[a] > bni[b]*bnj[b]; });
+    results.assign((size_t)(ncase)*nbatchout, zero);
+
+    nthreads = (nbatchthreads>0) ? nbatchthreads : (int)(std::thread::hardware_concurrency());
+    nthreads = max(1, min(nthreads, ncase));
+
+    for(int t=0; t<nthreads; t++)
+    {
+        workers.push_back(std::thread([&]()
+        {
+            std::vector<CavityGrid> cache;           /* One grid per size seen by this thread */
+            double rL1[neq], rL2[neq], rLinf[neq];   /* MMS discretization error norms */
+            double xc = half*(xmin + xmax);          /* Vertical centerline */
+            double yc = half*(ymin + ymax);          /* Horizontal centerline */
+            double y;                                /* Temporary variable for y location */
+            double vel;                              /* Interpolated centerline velocity */
+
+            for(int q = next++; q<ncase; q = next++)
+            {
+                int m = order[q];
+                int c = 0;
+                int status = 0;
+                double *out = &results[(size_t)(m)*nbatchout];
+
+                while(c<(int)(cache.size()) && (cache[c].ni!=bni[m] || cache[c].nj!=bnj[m]))
+                {
+                    c++;
+                }
+                if(c==(int)(cache.size()))
+                {
+                    cache.emplace_back(bni[m], bnj[m]);
+                }
+                CavityGrid& g = cache[c];
+
+                g.mu = rho*uinf*rlength/bre[m];
+                grid_initial(g);
+                for(int n=1; n<=nbatchit; n++)
+                {
+                    if(n==1 || n%nbatchres==0 || n==nbatchit)
+                    {
+                        grid_sweep(g, 1);
+                        grid_residual_norms(g);
+                        if(g.conv!=g.conv)
+                        {
+                            status = -1;
+                            break;
+                        }
+                        if(g.conv<toler)
+                        {
+                            status = 1;
+                            break;
+                        }
+                    }
+                    else
+                    {
+                        grid_sweep(g, 0);
+                    }
+                }
+
+                out[0] = (double)(status);
+                out[1] = (double)(g.niter);
+                out[2] = g.conv;
+                out[3] = 1.0e99;
+                out[5] = -1.0e99;
+                out[6] = 1.0e99;
+                for(int j=0; j<g.nj; j++)
+                {
+                    y = ymin + g.hy*(double)(j);
+                    vel = grid_interpolate(g, xc, y, 1);
+                    if(vel<out[3])
+                    {
+                        out[3] = vel;
+                        out[4] = y;
+                    }
+                }
+                for(int i=0; i<g.ni; i++)
+                {
+                    vel = grid_interpolate(g, xmin + g.hx*(double)(i), yc, 2);
+                    out[5] = fmax(out[5], vel);
+                    out[6] = fmin(out[6], vel);
+                }
+                if(imms==1)
+                {
+                    grid_error_norms(g, rL1, rL2, rLinf);
+                    out[7] = rL2[1];
+                }
+            }
+        }));
+    }
+    for(int t=0; t<nthreads; t++)
+    {
+        workers[t].join();
+    }
+}
+
+/**************************************************************************/
+
+void batch_driver()
+{
+    /* 
+    Uses global variable(s): batchfile, nbatchout, imms, Re, zero, half, fsmall
+    Reads the case list, solves it with 'batch_solve' and writes the packed results once ('batch.dat')
+    */
+    std::vector<int> bni, bnj;          /* Points in x and y of each case */
+    std::vector<double> bre;            /* Reynolds number of each case */
+    std::vector<double> results;        /* Packed results, nbatchout per case */
+    int ni, nj;                         /* Case read from the list */
+    double re;
+    int nconv = 0;                      /* Converged cases */
+    double tsolve;                      /* Solve time (s) */
+    FILE *fp;
+
+    fp = fopen(batchfile, "r");
+    if(fp==NULL)
+    {
+        printf("ERROR: cannot open batch case list %s!\n", batchfile);
+        exit (0);
+    }
+    while(fscanf(fp, "%d %d %lf", &ni, &nj, &re)==3)
+    {
+        if(ni<5 || nj<5 || !(re>zero))
+        {
+            printf("ERROR: batch case %d needs ni, nj >= 5 and Re > 0!\n", (int)(bni.size())+1);
+            exit (0);
+        }
+        if(imms==1 && re!=Re)
+        {
+            printf("ERROR: batch case %d: the MMS source terms are only valid for Re = %f!\n", (int)(bni.size())+1, Re);
+            exit (0);
+        }
+        bni.push_back(ni);
+        bnj.push_back(nj);
+        bre.push_back(re);
+    }
+    fclose(fp);
+    if(bni.empty())
+    {
+        printf("ERROR: no cases in %s!\n", batchfile);
+        exit (0);
+    }
+
+    tsolve = wall_clock();
+    batch_solve(bni, bnj, bre, results);
+    tsolve = wall_clock() - tsolve;
+
+    fp2 = fopen("./batch.dat","w");
+    fprintf(fp2,"TITLE = \"Cavity Batch Results\"\n");
+    fprintf(fp2,"variables=\"case\"\"ni\"\"nj\"\"Re\"\"status\"\"iterations\"\"conv\"\"umin\"\"y(umin)(m)\"\"vmax\"\"vmin\"\"DE-L2(u)\"\n");
+    for(int m=0; m<(int)(bni.size()); m++)
+    {
+        double *out = &results[(size_t)(m)*nbatchout];
+        fprintf(fp2, "%d %d %d %e %2.0f %8.0f %e %e %e %e %e %e\n", m+1, bni[m], bnj[m], bre[m],
+                out[0], out[1], out[2], out[3], out[4], out[5], out[6], out[7]);
+        nconv += (out[0]>half) ? 1 : 0;
+    }
+    fclose(fp2);
+
+    printf("Batch: %d cases (%d converged) in %f s, %f cases/s\n", (int)(bni.size()), nconv, tsolve,
+           (double)(bni.size())/fmax(tsolve, fsmall));
+}
+
+/**************************************************************************/
+
+double ladder_centerline_change( CavityGrid& gc, CavityGrid& gf )
+{
+    /* 
+    Uses global variable(s): zero, half, xmin, xmax, ymin
+    Returns: the largest change of u along the vertical centerline between the coarse grid gc
+    and the fine grid gf, at the points of gc
+    */
+    double xc = half*(xmin + xmax);     /* Vertical centerline */
+    double y;                           /* Temporary variable for y location */
+    double dmax = zero;
+
+    for(int j=0; j<gc.nj; j++)
+    {
+        y = ymin + gc.hy*(double)(j);
+        dmax = fmax(dmax, fabs(grid_interpolate(gf, xc, y, 1) - grid_interpolate(gc, xc, y, 1)));
+    }
+    return dmax;
+}
+
+/**************************************************************************/
+
+void accuracy_driver()
+{
+    /* 
+    Uses global variable(s): nladmin, nladmax, nladit, errtarget, toler, imms, xmin, ymin, zero, one, two
+    Solve to accuracy: solves (n x n) grids n = nladmin, 2 nladmin - 1, ... (each level halves h,
+    so the grids are nested), warm-starting every level from the bilinear interpolation of the
+    previous one, and stops at the first (coarsest) level whose error is below errtarget:
+      imms = 1: the largest L2 discretization error norm of the three equations;
+      imms = 0: the Richardson estimate of the centerline-velocity error against the previous
+                level, max |u(h) - u(H)|/(r^p - 1) on the vertical centerline, r = H/h
+                (r = 2 on the nested ladder).
+    Every level's error is measured, so the target is never met by extrapolation alone.
+    The observed order p comes from the last two error levels (last three nested grids for
+    imms = 0; the formal order 2 until then, clipped to [0.5, 4]). Once p is observed, the grid
+    predicted to meet the target, n = 1 + 1.1 (n-1) (error/errtarget)^(1/p) (odd), replaces the
+    next ladder level when it is coarser. The ladder stops early when the prediction exceeds
+    nladmax. The chosen grid is written to 'accuracy.dat'.
+    The warm start does not save iterations: the interpolated field still has to converge
+    its slowest modes, and it reaches toler later than the quiescent start (toler = 1e-6,
+    Re = 10: cavity 17 x 17 12261 vs 11900 iterations, 33 x 33 53352 vs 48185; MMS 17 x 17
+    1420 vs 1253, 33 x 33 5659 vs 4098).
+    */
+    std::vector<CavityGrid> levels;     /* Solved grids, coarsest first */
+    int n = nladmin;                    /* Points per direction of the current level */
+    int nested;                         /* = 1 if the current level halves h of the previous one */
+    int status;                         /* grid_solve result */
+    int observed = 0;                   /* = 1 once the order has been measured */
+    int done = 0;                       /* = 1 once the target is met */
+    double work = zero;                 /* Point-iterations on all levels */
+    double err = -one;                  /* Error (measured or estimated) of the current level (< 0 unknown) */
+    double errold;                      /* Error of the previous level */
+    double dold = -one;                 /* Centerline change between the previous two levels */
+    double d;                           /* Centerline change between the last two levels */
+    double p = two;                     /* Observed order (formal order until measured) */
+    double npred = zero;                /* Predicted points per direction to meet the target */
+    double rL1[neq], rL2[neq], rLinf[neq];   /* MMS discretization error norms */
+
+    if(nladmin<5 || nladmax<nladmin || !(errtarget>zero))
+    {
+        printf("ERROR: solve to accuracy needs nladmin >= 5, nladmax >= nladmin and errtarget > 0!\n");
+        exit (0);
+    }
+    printf("Solve to accuracy: target %e on the %s\n", errtarget,
+           (imms==1) ? "MMS L2 error norms" : "estimated centerline-velocity error");
+    printf("  level      grid  iterations          error   order  predicted grid\n");
+
+    for(int l=0; n<=nladmax; l++)
+    {
+        levels.emplace_back(n, n);
+        CavityGrid& g = levels[l];
+        grid_initial(g);
+        nested = (l>0 && 2*levels[l-1].ni-1==n) ? 1 : 0;
+        if(l>0)
+        {
+            CavityGrid& gc = levels[l-1];
+            for(int i=1; i<n-1; i++)
+            {
+                for(int j=1; j<n-1; j++)
+                {
+                    for(int k=0; k<neq; k++)
+                    {
+                        g.u(i,j,k) = grid_interpolate(gc, xmin + g.hx*(double)(i), ymin + g.hy*(double)(j), k);
+                    }
+                }
+            }
+            grid_bndry(g);
+        }
+        status = grid_solve(g, nladit, toler);
+        work += (double)(g.niter)*(double)(n)*(double)(n);
+        if(status<0)
+        {
+            printf("ERROR: level %d (%d x %d) diverged!\n", l, n, n);
+            exit (0);
+        }
+
+        /* Error of this level and observed order */
+        errold = err;
+        if(imms==1)
+        {
+            grid_error_norms(g, rL1, rL2, rLinf);
+            err = fmax(rL2[0], fmax(rL2[1], rL2[2]));
+            if(errold>zero && err>zero)
+            {
+                p = fmin(fmax(log(errold/err)/log((double)(n-1)/(double)(levels[l-1].ni-1)), 0.5), 4.0);
+                observed = 1;
+            }
+        }
+        else if(l>0)
+        {
+            double r = (double)(n-1)/(double)(levels[l-1].ni-1);    /* H/h */
+            d = ladder_centerline_change(levels[l-1], g);
+            if(nested==1 && dold>zero && d>zero)
+            {
+                p = fmin(fmax(log(dold/d)/log(two), 0.5), 4.0);
+                observed = 1;
+            }
+            err = d/(pow(r, p) - one);
+            dold = (nested==1) ? d : -one;     /* The order needs two changes at r = 2 */
+        }
+
+        if(err<zero)
+        {
+            printf("  %5d %4d x %-4d %10d  %13s  %6s%s\n", l, n, n, g.niter, "-", "-",
+                   (status==1) ? "" : "  (not converged)");
+        }
+        else
+        {
+            npred = one + 1.1*(double)(n-1)*pow(fmax(err/errtarget, one), one/p);
+            printf("  %5d %4d x %-4d %10d  %13e  %6.3f  %6.0f x %-6.0f%s\n", l, n, n, g.niter, err, p, npred, npred,
+                   (status==1) ? "" : "  (not converged)");
+            if(err<=errtarget)
+            {
+                done = 1;
+                break;
+            }
+            if(npred>(double)(nladmax))
+            {
+                printf("  predicted grid exceeds nladmax = %d: stopping\n", nladmax);
+                break;
+            }
+        }
+
+        /* Next level: the nested one, or the predicted grid when that is coarser */
+        if(observed==1 && npred<(double)(2*n-1))
+        {
+            n = max(n+2, 2*((int)(ceil(npred))/2) + 1);
+        }
+        else
+        {
+            n = 2*n - 1;
+        }
+    }
+
+    CavityGrid& g = levels.back();
+    if(done==1)
+    {
+        printf("Target met on the %d x %d grid; work %e point-iterations (%4.2f iterations of that grid)\n",
+               g.ni, g.nj, work, work/((double)(g.ni)*(double)(g.nj)));
+    }
+    else
+    {
+        printf("Target not met up to %d x %d; writing the finest grid solved\n", g.ni, g.nj);
+    }
+
+    fp2 = fopen("./accuracy.dat","w");
+    fprintf(fp2,"TITLE = \"Cavity Field Data (solve to accuracy)\"\n");
+    fprintf(fp2,"variables=\"x(m)\"\"y(m)\"\"p(N/m^2)\"\"u(m/s)\"\"v(m/s)\"\n");
+    fprintf(fp2, "zone T=\"n=%d\"\n", g.niter);
+    fprintf(fp2, "I= %d J= %d\n", g.ni, g.nj);
+    fprintf(fp2, "DATAPACKING=POINT\n");
+    for(int i=0; i<g.ni; i++)
+    {
+        for(int j=0; j<g.nj; j++)
+        {
+            fprintf(fp2,"%e %e %e %e %e\n", xmin + g.hx*(double)(i), ymin + g.hy*(double)(j),
+                    g.u(i,j,0), g.u(i,j,1), g.u(i,j,2));
+        }
+    }
+    fclose(fp2);
+}
+
+/**************************************************************************/
+
+void grid_inputs_fill( GridInputs& in )
+{
+    /* 
+    Uses global variable(s): zero, pinf, imms, xmin, xmax, ymin, ymax
+    To modify: in (MMS source terms, wall velocities, pinned center pressure)
+    The wall values use the coordinate expressions of the boundary kernels they replace, so
+    'bndry_lines', 'bndrymms_lines' and 'pressure_rescaling' set the same bits as before
+    */
+    int ni = in.ni;              /* Points in x */
+    int nj = in.nj;              /* Points in y */
+    double hx = (xmax - xmin)/(double)(ni - 1);
+    double hy = (ymax - ymin)/(double)(nj - 1);
+    double x;                    /* Temporary variable for x location */
+    double y;                    /* Temporary variable for y location */
+
+    for(int i=0; i<ni; i++)
+    {
+        for(int j=0; j<nj; j++)
+        {
+            x = xmin + hx*(double)(i);
+            y = ymin + hy*(double)(j);
+            in.s(i,j,0) = (double)(imms)*srcmms_mass(x, y);
+            in.s(i,j,1) = (double)(imms)*srcmms_xmtm(x, y);
+            in.s(i,j,2) = (double)(imms)*srcmms_ymtm(x, y);
+        }
+    }
+
+    /* Wall velocities (the wall pressures are extrapolated by the kernels, so k = 0 is unused) */
+    for(int j=0; j<nj; j++)
+    {
+        y = (ymax - ymin)*(double)(j)/(double)(nj - 1);
+        for(int k=0; k<neq; k++)
+        {
+            in.bx(0,j,k) = (imms==1 && k>0) ? umms(xmin, y, k) : zero;
+            in.bx(1,j,k) = (imms==1 && k>0) ? umms(xmax, y, k) : zero;
+        }
+    }
+    for(int i=0; i<ni; i++)
+    {
+        x = (xmax - xmin)*(double)(i)/(double)(ni - 1);
+        for(int k=0; k<neq; k++)
+        {
+            in.by(i,0,k) = (imms==1 && k>0) ? umms(x, ymin, k) : zero;
+            in.by(i,1,k) = (imms==1 && k>0) ? umms(x, ymax, k) : zero;
+        }
+        if(imms==0)
+        {
+            in.by(i,1,1) = lid_profile(xmin + hx*(double)(i));
+        }
+    }
+
+    x = (xmax - xmin)*(double)((ni-1)/2)/(double)(ni - 1);
+    y = (ymax - ymin)*(double)((nj-1)/2)/(double)(nj - 1);
+    in.pref = (imms==1) ? umms(x, y, 0) : pinf;
+}
+
+/**************************************************************************/
+
+std::shared_ptr<const GridInputs> grid_inputs( int ni, int nj )
+{
+    /* 
+    Uses global variable(s): inputs_mutex, inputs_registry
+    Returns: the inputs of an ni x nj grid, computed by the first caller and shared read-only by every
+    later one (threads of the batch engine, the combination technique and the accuracy ladder). The
+    grid size is the whole key: everything else the inputs depend on (imms, ilid, the domain, rmu)
+    is fixed for the run. The registry keeps the inputs for the rest of the run, so a size that is
+    solved again (the batch engine's per-thread grids) does not recompute them.
+    */
+    std::lock_guard<std::mutex> lock(inputs_mutex);
+    std::shared_ptr<const GridInputs>& in = inputs_registry[std::make_pair(ni, nj)];
+
+    if(!in)
+    {
+        std::shared_ptr<GridInputs> fill = std::make_shared<GridInputs>(ni, nj);
+        grid_inputs_fill(*fill);
+        in = fill;
+    }
+    return in;
+}
+
+/**************************************************************************/
+
+size_t grid_storage( int ni, int nj )
+{
+    /* 
+    Returns: doubles of arena storage for one ni x nj CavityGrid (u, uold, viscx, viscy, dt), rounded
+    up to whole 64-byte cache lines so that grids solved by different threads never share a line
+    */
+    size_t n = (size_t)(2*neq + 3)*(size_t)(ni)*(size_t)(nj);
+
+    return 8*((n + 7)/8);
+}
+
+/**************************************************************************/
+
+void hierarchy_driver()
+{
+    /* 
+    Uses global variable(s): imax, jmax, nhiermin, ihierinject, nhiercheck, nmax, toler, imms, xmin, ymin,
+                             zero, one, two, fp2
+    Nested verification hierarchy: solves the (n x n) grids n = nhiermin, 2 nhiermin - 1, ..., imax (each
+    halves h, so every level is an exact subsample of the next) as independent solves, one thread per
+    level, all started together. All grids live in one arena allocated up front.
+    With ihierinject = 1, every nhiercheck iterations a level looks for a coarser level that has
+    converged since its last look, and the bilinear interpolation of the finest such level replaces its
+    own iterate. That costs iterations in every case measured: the interpolated field still has to
+    converge its slowest modes, and it reaches toler later than the level left alone (toler = 1e-6:
+    cavity 33 x 33 56352 vs 48185 iterations, MMS 33 x 33 6059 vs 4098; MMS 65 x 65 at toler = 1e-8
+    33695 vs 28022), so it is off by default. All levels' errors are reported together:
+      imms = 1: the L2 discretization error norms of p, u and v;
+      imms = 0: the largest difference of p, u and v from the finest level at the points shared with it
+                (read through strided views of the finest grid);
+    with the observed order of the largest one between consecutive levels. All levels are written to
+    'hierarchy.dat', one zone each.
+    */
+    std::vector<int> npts;              /* Points per direction of each level, coarsest first */
+    std::vector<CavityGrid> levels;     /* Solved grids */
+    std::vector<double> arena;          /* Storage of all levels */
+    std::vector<int> status;            /* 0 running, 1 converged, -1 diverged, 2 iteration limit */
+    std::vector<int> injected;          /* Level last injected into each level (-1 none) */
+    std::vector<int> ninjected;         /* Iteration of that injection */
+    std::vector<std::thread> workers;   /* One solver thread per level */
+    std::mutex hier_mutex;              /* Protects status (a level's u is read-only once it is converged) */
+    double *base;                       /* Arena storage, 64-byte aligned */
+    size_t nstore = 0;                  /* Doubles in the arena */
+    int nlev;                           /* Number of levels */
+    int r;                              /* Finest points per coarse point in each direction */
+    double err;                         /* Largest error of a level */
+    double errold = -one;               /* Largest error of the previous level */
+    double rL1[neq], rL2[neq], rLinf[neq];   /* MMS discretization error norms */
+    double dmax[neq];                   /* Largest difference from the finest level */
+    double tsolve;                      /* Wall-clock seconds of the concurrent solve */
+
+    for(int n=imax; n>=nhiermin; n = (n + 1)/2)
+    {
+        npts.insert(npts.begin(), n);
+        if(n==nhiermin || (n - 1)%2!=0)
+        {
+            break;
+        }
+    }
+    if(imax!=jmax || nhiermin<5 || nhiercheck<1 || npts.empty() || npts[0]!=nhiermin)
+    {
+        printf("ERROR: the nested hierarchy needs imax = jmax = (nhiermin-1) 2^L + 1, nhiermin >= 5 and nhiercheck >= 1!\n");
+        exit (0);
+    }
+    nlev = (int)(npts.size());
+
+    /* One arena for every level, each grid on a fresh cache line */
+    for(int l=0; l<nlev; l++)
+    {
+        nstore += grid_storage(npts[l], npts[l]);
+    }
+    arena.assign(nstore + 8, zero);
+    base = arena.data();
+    while(((size_t)(base))%64!=0)
+    {
+        base++;
+    }
+    levels.reserve(nlev);
+    for(int l=0; l<nlev; l++)
+    {
+        levels.emplace_back(npts[l], npts[l], base);
+        base += grid_storage(npts[l], npts[l]);
+        grid_initial(levels[l]);
+    }
+    status.assign(nlev, 0);
+    injected.assign(nlev, -1);
+    ninjected.assign(nlev, 0);
+    printf("Nested hierarchy: %d levels from %d x %d to %d x %d, arena %6.2f MB, %s\n", nlev, npts[0], npts[0],
+           imax, jmax, (double)(nstore)*sizeof(double)/1.0e6, (imms==1) ? "MMS" : "cavity");
+
+    tsolve = wall_clock();
+    for(int l=0; l<nlev; l++)
+    {
+        workers.push_back(std::thread([&, l]()
+        {
+            CavityGrid& g = levels[l];
+            int tried = -1;                 /* Coarser levels up to this one have been looked at */
+            int m;                          /* Finest newly converged coarser level */
+            int result = 2;
+
+            for(int n=0; n<nmax; n++)
+            {
+                if(ihierinject==1 && l>0 && n%nhiercheck==0 && tried<l-1)
+                {
+                    {
+                        std::lock_guard<std::mutex> lock(hier_mutex);
+                        m = l - 1;
+                        while(m>tried && status[m]!=1)
+                        {
+                            m--;
+                        }
+                    }
+                    if(m>tried)
+                    {
+                        CavityGrid& gc = levels[m];
+
+                        tried = m;
+                        for(int i=1; i<g.ni-1; i++)
+                        {
+                            for(int j=1; j<g.nj-1; j++)
+                            {
+                                for(int k=0; k<neq; k++)
+                                {
+                                    g.u(i,j,k) = grid_interpolate(gc, xmin + g.hx*(double)(i), ymin + g.hy*(double)(j), k);
+                                }
+                            }
+                        }
+                        grid_bndry(g);
+                        injected[l] = m;
+                        ninjected[l] = g.niter;
+                    }
+                }
+                grid_iteration(g);
+                if(g.conv!=g.conv)
+                {
+                    result = -1;
+                    break;
+                }
+                if(g.conv<toler)
+                {
+                    result = 1;
+                    break;
+                }
+            }
+            std::lock_guard<std::mutex> lock(hier_mutex);
+            status[l] = result;
+        }));
+    }
+    for(int l=0; l<nlev; l++)
+    {
+        workers[l].join();
+    }
+    tsolve = wall_clock() - tsolve;
+
+    /* All levels' errors together */
+    CavityGrid& gf = levels[nlev-1];
+    if(imms==1)
+    {
+        printf("  level      grid  iterations  injected (at)     L2 DE p       L2 DE u       L2 DE v    order\n");
+    }
+    else
+    {
+        printf("  level      grid  iterations  injected (at)   max |dp|      max |du|      max |dv|    order  (vs finest)\n");
+    }
+    for(int l=0; l<nlev; l++)
+    {
+        CavityGrid& g = levels[l];
+        char inj[32];
+
+        if(imms==1)
+        {
+            grid_error_norms(g, rL1, rL2, rLinf);
+            for(int k=0; k<neq; k++)
+            {
+                dmax[k] = rL2[k];
+            }
+        }
+        else
+        {
+            r = (imax - 1)/(g.ni - 1);
+            for(int k=0; k<neq; k++)
+            {
+                View2 f = gf.u.plane(k).coarse(r, r);   /* Finest-grid values at this level's points */
+                View2 c = g.u.plane(k);
+                dmax[k] = zero;
+                for(int i=0; i<g.ni; i++)
+                {
+                    for(int j=0; j<g.nj; j++)
+                    {
+                        dmax[k] = fmax(dmax[k], fabs(c(i,j) - f(i,j)));
+                    }
+                }
+            }
+        }
+        if(injected[l]>=0)
+        {
+            snprintf(inj, sizeof(inj), "%4d (%d)", npts[injected[l]], ninjected[l]);
+        }
+        else
+        {
+            snprintf(inj, sizeof(inj), "   -");
+        }
+        err = fmax(dmax[0], fmax(dmax[1], dmax[2]));
+        printf("  %5d %4d x %-4d %10d  %-14s %e  %e  %e", l, g.ni, g.nj, g.niter, inj, dmax[0], dmax[1], dmax[2]);
+        if(errold>zero && err>zero)
+        {
+            printf("  %6.3f", log(errold/err)/log(two));
+        }
+        printf("%s\n", (status[l]==1) ? "" : (status[l]<0) ? "  (diverged)" : "  (not converged)");
+        errold = err;
+    }
+    printf("Wall time %f s; finest level %d iterations\n", tsolve, gf.niter);
+
+    fp2 = fopen("./hierarchy.dat","w");
+    fprintf(fp2,"TITLE = \"Cavity Field Data (nested hierarchy)\"\n");
+    fprintf(fp2,"variables=\"x(m)\"\"y(m)\"\"p(N/m^2)\"\"u(m/s)\"\"v(m/s)\"\n");
+    for(int l=0; l<nlev; l++)
+    {
+        CavityGrid& g = levels[l];
+        fprintf(fp2, "zone T=\"%d x %d, n=%d\"\n", g.ni, g.nj, g.niter);
+        fprintf(fp2, "I= %d J= %d\n", g.ni, g.nj);
+        fprintf(fp2, "DATAPACKING=POINT\n");
+        for(int i=0; i<g.ni; i++)
+        {
+            for(int j=0; j<g.nj; j++)
+            {
+                fprintf(fp2,"%e %e %e %e %e\n", xmin + g.hx*(double)(i), ymin + g.hy*(double)(j),
+                        g.u(i,j,0), g.u(i,j,1), g.u(i,j,2));
+            }
+        }
+    }
+    fclose(fp2);
+}
+
+/********************************************************************************************************************/
+/*                                                                                                                  */
+/*                                                End Functions                                                     */
+/*                                                                                                                  */
+/********************************************************************************************************************/
+
+
+
+
+
+
+
+/********************************************************************************************************************/
+/*                                                                                                                  */
+/*                                                Main Function                                                     */
+/*                                                                                                                  */
+/********************************************************************************************************************/
+int main()
+{
+    //Data class declarations: hold all the data needed across the entire grid
+    Array3 u     (imax, jmax, neq);     //u and uold store the current and previous primitive variable solution on the entire grid
+    Array3 uold  (imax, jmax, neq);
+
+    Array3 src   (imax, jmax, neq);     //src stores the source terms over the entire grid (used for MMS)
+
+    Array2 viscx (imax, jmax);          //Artificial viscosity, x and y directions
+    Array2 viscy (imax, jmax);
+
+    Array2 dt    (imax, jmax);          //Local timestep array
+
+    Array3 *ubest = (tbudget>0.0) ? new Array3(imax, jmax, neq) : NULL;   //Lowest-residual solution so far (tbudget > 0 only)
+
+
+    /* Minimum of iterative residual norms from three equations */
+    double conv = 1.0;
+    int monstate;   //Residual monitor classification
+    double resTest;
+    int n = 0;  //Iteration number
+
+    /*--------- Wall-clock budget (tbudget > 0) ---------------------*/
+
+    double tstart = wall_clock();   //Starts the clock
+    double titer = 0.0;             //Running estimate of the time per iteration (s)
+    double tlast = tstart;          //Wall clock at the end of the previous iteration
+    double twrite = 0.0;            //Cost of one 'write_output' (s)
+    double tcheck = 0.0;            //Cost of one tiered checkpoint (s)
+    double toutput = tstart;        //Wall clock of the last periodic output
+    double tcheckout = tstart;      //Wall clock of the last tiered checkpoint
+    double bestconv = 1.0e99;       //Lowest conv so far
+    int nbest = 0;                  //Iteration of the lowest conv
+    double rtbest = 0.0;            //Simulation time of the lowest conv
+
+                                                      
+    /*--------- Solution variables declaration ----------------------*/
+      
+     int ninit = 0;                 /* Initial iteration number (used for restart file) */
+
+     double res[neq];               /* Iterative residual for each equation */
+     double resinit[neq];           /* Initial iterative residual for each equation (from iteration 1) */
+     double rtime;                  /* Variable to estimate simulation time */
+     double dtmin = 1.0e99;         /* Minimum time step for a given iteration (initialized large) */
+
+     double x;                      /* Temporary variable for x location */
+     double y;                      /* Temporary variable for y location */
+
+
+    /* Open the binary stream sink (before any text output if it replaces standard output) */
+    if(ipipe==1)
+    {
+        stream_open();
+    }
+
+    /*-------Set Function Pointers-----------------------------------*/
+    
+    iterationStepPointer     iterationStep;
+    boundaryConditionPointer set_boundary_conditions;
+    boundaryLinesPointer     set_boundary_lines;
+    timeStepPointer          set_time_step;
+
+    if(iengine==1)              /* ==Lattice Boltzmann (D2Q9)== */
+    {
+        iterationStep = &LBM_iteration;
+        set_time_step = &lbm_time_step;
+    }
+    else if(iengine==2)         /* ==SIMPLE/SIMPLEC/PISO on a staggered grid== */
+    {
+        iterationStep = &SIMPLE_iteration;
+        set_time_step = &compute_time_step;   /* Only scales the residuals (same units as iengine = 0) */
+        if(ipcorr<0 || ipcorr>2 || (ipcorr==1 && !(alphau<1.0)))
+        {
+            printf("ERROR: ipcorr must equal 0, 1 or 2, and SIMPLEC (ipcorr = 1) needs alphau < 1!\n");
+            exit (0);
+        }
+    }
+    else if(iengine==0)         /* ==Artificial compressibility== */
+    {
+        set_time_step = &compute_time_step;
+        if(isgs==1)                 /* ==Symmetric Gauss Seidel== */
+        {
+            iterationStep = &GS_iteration;
+        }
+        else if(isgs==0)             /* ==Point Jacobi== */
+        {
+            iterationStep = &PJ_iteration;
+        }
+        else
+        {
+            printf("ERROR: isgs must equal 0 or 1!\n");
+            exit (0);  
+        }
+    }
+    else if(iengine==3)         /* ==Artificial compressibility, defect correction with AMG== */
+    {
+        iterationStep = &DC_iteration;
+        set_time_step = &compute_time_step;   /* Scaled by dccfl/cfl in 'DC_iteration' */
+    }
+    else
+    {
+        printf("ERROR: iengine must equal 0, 1, 2 or 3!\n");
+        exit (0);
+    }
+      
+    if(imms==0) 
+    {
+            set_boundary_conditions = &bndry;
+            set_boundary_lines = &bndry_lines;
+    }
+    else if(imms==1)
+        {
+            set_boundary_conditions = &bndrymms;
+            set_boundary_lines = &bndrymms_lines;
+        }
+        else
+        {
+            printf("ERROR: imms must equal 0 or 1!\n");
+            exit (0);
+        }
+
+    if(ilid<0 || ilid>2 || !(lidwidth>0.0 && lidwidth<=0.5))
+    {
+        printf("ERROR: ilid must equal 0, 1 or 2 and 0 < lidwidth <= 0.5!\n");
+        exit (0);
+    }
+
+    if(irstr==0 && (iinit<0 || iinit>2 || (iinit!=0 && imms!=0)))
+    {
+        printf("ERROR: iinit must equal 0, 1 or 2, and the Stokes (1) and ramped-lid (2) starts need imms = 0!\n");
+        exit (0);
+    }
+
+    if(imonitor==1 && imonpolicy==3 && iengine!=0)
+    {
+        printf("ERROR: imonpolicy = 3 (switch SGS <-> PJ) needs iengine = 0!\n");
+        exit (0);
+    }
+
+    if(ivisc==1 && iengine!=0)
+    {
+        printf("ERROR: ivisc = 1 needs iengine = 0!\n");
+        exit (0);
+    }
+
+    if(isubcycle==1 && iengine!=0)
+    {
+        printf("ERROR: isubcycle = 1 needs iengine = 0!\n");
+        exit (0);
+    }
+
+    if(ipipeline==1 && (iengine!=0 || isgs!=0 || ischedule!=0 || imonitor!=0 || istats!=0 || isubcycle!=0 || npipeblock<3))
+    {
+        printf("ERROR: ipipeline = 1 needs iengine = 0, isgs = 0, npipeblock >= 3 and no schedule, monitor, statistics or sub-cycling!\n");
+        exit (0);
+    }
+
+    /*-------End Set Function Pointers-------------------------------*/
+
+    /* Debug output: Uncomment and modify if debugging */
+    //$$$$$$ fp6 = fopen("./Debug.dat","w");
+    //$$$$$$ fprintf(fp6,"TITLE = \"Debug Data Data\"\n");
+    //$$$$$$ fprintf(fp6,"variables=\"x(m)\"\"y(m)\"\"visc-x\"\"visc-y\"\n");
+    //$$$$$$ fprintf(fp6, "zone T=\"n=%d\"\n",n);
+    //$$$$$$ fprintf(fp6, "I= %d J= %d\n",imax, jmax);
+    //$$$$$$ fprintf(fp6, "DATAPACKING=POINT\n");
+
+    /* Set derived input quantities */
+    set_derived_inputs();
+
+    /* Convert a legacy ASCII restart/field file to binary and stop */
+    if(iconvert==1)
+    {
+        convert_legacy(legacyfile);
+        return 0;
+    }
+
+    /* Predict memory, run time and iterations for job sizing, then stop (before any output file is opened) */
+    if(ipredict==1)
+    {
+        predict_job( iterationStep, set_time_step, set_boundary_conditions, u, uold, src, viscx, viscy, dt );
+        return 0;
+    }
+
+    /* Sparse-grid combination technique replaces the single-grid run */
+    if(icombine==1)
+    {
+        combination_driver();
+        return 0;
+    }
+
+    /* Solve to accuracy on a grid ladder replaces the single-grid run */
+    if(iaccuracy==1)
+    {
+        accuracy_driver();
+        return 0;
+    }
+
+    /* Nested verification hierarchy replaces the single-grid run */
+    if(ihier==1)
+    {
+        hierarchy_driver();
+        return 0;
+    }
+
+    /* Batch of small cases replaces the single-grid run */
+    if(ibatch==1)
+    {
+        batch_driver();
+        return 0;
+    }
+
+    /* Running statistics: zeroed accumulators, SIGUSR1 requests an intermediate write */
+    if(istats==1)
+    {
+        stat_mean = new Array3(imax, jmax, neq);
+        stat_m2   = new Array3(imax, jmax, neq);
+        stat_min  = new Array3(imax, jmax, neq);
+        stat_max  = new Array3(imax, jmax, neq);
+        for(int i=0; i<imax; i++)
+        {
+            for(int j=0; j<jmax; j++)
+            {
+                for(int k=0; k<neq; k++)
+                {
+                    (*stat_mean)(i,j,k) = zero;
+                    (*stat_m2)(i,j,k) = zero;
+                }
+            }
+        }
+        signal(SIGUSR1, stats_request_handler);
+    }
+
+    /* Read the cfl/dissipation/rkappa schedule */
+    if(ischedule==1)
+    {
+        read_schedule();
+    }
+
+    /* Set up headers for output files */
+    output_file_headers();
+
+    /* Set Initial Profile for u vector */
+    initial( ninit, rtime, resinit, u, src );   
+
+    /* Set Boundary Conditions for u */
+    set_boundary_conditions( u );
+
+    /* Write out inital conditions to solution file (timed: sets the output cost under a budget) */
+    twrite = wall_clock();
+    write_output(ninit, u, dt, resinit, rtime);
+    twrite = wall_clock() - twrite;
+
+    /* Build the lattice populations from the initial (or restart) solution */
+    if(iengine==1)
+    {
+        lbm_initialize( u );
+    }
+
+    /* Build the staggered-grid fields from the initial (or restart) solution */
+    if(iengine==2)
+    {
+        mac_initialize( u );
+    }
+     
+    /* Evaluate Source Terms Once at Beginning */
+    /*(only interior points; will be zero for standard cavity) */
+    compute_source_terms( src );
+
+    /*========== Main Loop ==========*/
+    for (n = ninit; n<= nmax; n++)
+    {
+        /* Pipelined point Jacobi: run up to the next output/stream/checkpoint iteration at once */
+        if(ipipeline==1)
+        {
+            int nlast = nmax;
+            nlast = min(nlast, ((n + iterout - 1)/iterout)*iterout);
+            if(ipipe==1)
+            {
+                nlast = min(nlast, ((n + nstream - 1)/nstream)*nstream);
+            }
+            if(icheck==1)
+            {
+                nlast = min(nlast, ((n + ncheck - 1)/ncheck)*ncheck);
+            }
+            n = pipeline_run(n, nlast, set_boundary_lines, u, uold, src, viscx, viscy, dt, res, resinit, ninit, rtime, dtmin, conv);
+            pressure_rescaling( maingrid, u );
+            goto iterated;
+        }
+
+        /* Ramp the lid velocity up linearly over the first nramp iterations */
+        if(iinit==2 && irstr==0)
+        {
+            ulid = uinf*fmin(one, (double)(n)/(double)(nramp));
+        }
+
+        /* Scheduled cfl, Cx, Cy, rkappa (triggered by iteration count or conv) */
+        if(ischedule==1)
+        {
+            schedule_update(n, conv);
+        }
+
+        /* Calculate time step */  
+        set_time_step( u, dt, dtmin );
+           
+        /* Perform main iteration step (point jacobi or gauss seidel)*/    
+        iterationStep( set_boundary_conditions, u, uold, src, viscx, viscy, dt ); 
+
+        /* Pressure Rescaling (based on center point); also accumulates the running statistics */
+        stat_accumulate = (istats==1 && n>=nstatbeg && n<=nstatend) ? 1 : 0;
+        pressure_rescaling( maingrid, u );
+        if(stat_request==1)
+        {
+            stat_request = 0;
+            write_statistics(n);
+        }
+
+        /* Update the time */
         rtime += dtmin;
 
         /* Check iterative convergence using L2 norms of iterative residuals */
         check_iterative_convergence(n, u, uold, dt, res, resinit, ninit, rtime, dtmin, conv);
 
+iterated:
         if(conv<toler) 
         {
-            fprintf(fp1, "%d %e %e %e %e\n",n, rtime, res[0], res[1], res[2]);
+            write_history(n, rtime, res);
                 goto converged;
         }
+
+        /* Classify the residual history and act on runs that will not converge */
+        if(imonitor==1)
+        {
+            monstate = monitor_residual(n, conv);
+            if(monstate>0)
+            {
+                if(imonpolicy==1 || (monstate==3 && imonpolicy!=0))
+                {
+                    write_history(n, rtime, res);
+                    goto stalled;
+                }
+                else if(imonpolicy==2)
+                {
+                    write_output(n, u, dt, resinit, rtime);
+                }
+                else if(imonpolicy==3)
+                {
+                    iterationStep = (iterationStep==&GS_iteration) ? &PJ_iteration : &GS_iteration;
+                    sched_cflscale = half*sched_cflscale;   /* Keeps the schedule from restoring the cfl */
+                    cfl = half*cfl;
+                    printf("Residual monitor: switched to %s, cfl = %f\n",
+                           (iterationStep==&GS_iteration) ? "symmetric Gauss-Seidel" : "point Jacobi", cfl);
+                }
+            }
+        }
             
-        /* Output solution and restart file every 'iterout' steps */
-        if( ((n%iterout)==0) ) 
+        /* Output solution and restart file every 'iterout' steps (paced to the budget) */
+        if( ((n%iterout)==0) && budget_allows_output(toutput, twrite) ) 
         {
+                toutput = wall_clock();
                 write_output(n, u, dt, resinit, rtime);
+                twrite = wall_clock() - toutput;
+        }
+
+        /* Framed binary snapshot to the stream sink every 'nstream' steps */
+        if( ipipe==1 && ((n%nstream)==0) )
+        {
+                stream_frame(n, rtime, conv, u);
+        }
+
+        /* Cheap checkpoint to the fast tier every 'ncheck' steps (drained in the background) */
+        if( icheck==1 && ((n%ncheck)==0) && budget_allows_output(tcheckout, tcheck) )
+        {
+                tcheckout = wall_clock();
+                checkpoint_tiered(n, u, resinit, rtime);
+                tcheck = wall_clock() - tcheckout;
+        }
+
+        /* Keep the lowest-residual state; stop before the budget runs out */
+        if(tbudget>0.0)
+        {
+            if(conv<bestconv)
+            {
+                bestconv = conv;
+                nbest = n;
+                rtbest = rtime;
+                ubest->copyData(u);
+            }
+            titer = (titer==0.0) ? wall_clock() - tlast : 0.8*titer + 0.2*(wall_clock() - tlast);
+            tlast = wall_clock();
+            if(budget_exhausted(titer, 2.0*(twrite + tcheck)))
+            {
+                goto outoftime;
+            }
         }
         
     }  /* ========== End Main Loop ========== */
@@ -1626,15 +8416,56 @@ converged:  /* go here once solution is converged */
 
     printf("\nSolver stopped in %d iterations because the convergence criteria was met OR because the solution diverged.\n", n);
     printf("   Solution divergence is indicated by inf or NaN residuals.\n", n);
+
+    goto notconverged;
+
+outoftime:  /* go here when the wall-clock budget is used up */
+
+    printf("\nSolver stopped in %d iterations to stay within the wall-clock budget of %.1f s (%.1f s used).\n", n, tbudget, wall_clock());
+    printf("   conv = %e; resume with irstr = 1 from 'restart.out'%s.\n", conv, (icheck==1) ? " or the tiered checkpoints" : "");
+
+    goto notconverged;
+
+stalled:  /* go here when the residual monitor stops the run */
+
+    printf("\nSolver stopped in %d iterations because the residual monitor found the run %s.\n", n,
+           (monstate==3) ? "diverging" : ((monstate==2) ? "oscillating" : "stagnating"));
     
 notconverged:
 
     /* Calculate and Write Out Discretization Error Norms (will do this for MMS only) */
     Discretization_Error_Norms( u );
 
+    /* Write the running statistics */
+    if(istats==1)
+    {
+        write_statistics(n);
+    }
+
     /* Output solution and restart file */
     write_output(n, u, dt, resinit, rtime);
 
+    /* Lowest-residual state under a budget ('best.bin', binary restart format) */
+    if(tbudget>0.0 && nbest>0)
+    {
+        write_checkpoint_binary("./best.bin", nbest, rtbest, resinit, *ubest);
+        printf("Lowest conv = %e at iteration %d (written to 'best.bin'); final conv = %e\n", bestconv, nbest, conv);
+    }
+
+    /* Final tiered checkpoint; wait for the agent to drain it */
+    if(icheck==1)
+    {
+        checkpoint_tiered(n, u, resinit, rtime);
+        checkpoint_shutdown();
+    }
+
+    /* Last snapshot and end-of-stream marker */
+    if(ipipe==1)
+    {
+        stream_frame(n, rtime, conv, u);
+        stream_close();
+    }
+
     /* Close open files */
     fclose(fp1);
     fclose(fp2);